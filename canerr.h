@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  canerr.h - SocketCAN error frame tables, builder and decoder, by Zeljko Avramovic (c) 2024    //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  Header only. Shared by canerrsim (building frames from options) and canerrdump (decoding      //
+//  frames to text), so option names and decoded names come from the same tables and can not      //
+//  drift apart. Plain C99 without feature test macros, also compiles as C++ for services which   //
+//  include it directly:                                                                          //
+//                                                                                                //
+//  struct can_frame frame;                                                                       //
+//  canerr_frame_init(&frame);                                                                    //
+//  canerr_apply_option(&frame, "BusOff");                                                        //
+//  canerr_apply_option(&frame, "Bit0");                                                          //
+//  canerr_apply_option(&frame, "DATA");                                                          //
+//  canerr_decode(&frame, str, sizeof(str));   // "BusOff,Prot(Type(Bit0),Loc(DATA))"             //
+//                                                                                                //
+//  Receive stream, capture and bridge formats are in canerr_stream.h, which needs _GNU_SOURCE.   //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CANERR_H
+#define CANERR_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+
+#define CANERR_COUNT(table) (sizeof(table) / sizeof((table)[0]))
+
+struct canerr_code {
+    const char *name;                  // option name in canerrsim and decoded name in canerrdump
+    uint32_t    value;                 // error class bit in CAN ID, or sub code in data byte
+};
+
+struct canerr_subclass {
+    canid_t     class_mask;            // error class bit in CAN ID
+    int         data_index;            // data byte holding the sub code
+    const char *unspec_option;         // canerrsim option which sets sub code to unspecified (0)
+    bool        is_bitmask;            // sub codes are single bits which can be combined
+    bool        build_or;              // canerrsim ORs sub codes (true) or keeps only last one (false)
+    const struct canerr_code *codes;
+    size_t      count;
+};
+
+// error class (mask) in can_id without sub codes
+static const struct canerr_code canerr_class_codes[] = {
+    { "TxTimeout",          CAN_ERR_TX_TIMEOUT },
+    { "NoAck",              CAN_ERR_ACK },
+    { "BusOff",             CAN_ERR_BUSOFF },
+    { "BusError",           CAN_ERR_BUSERROR },
+    { "Restarted",          CAN_ERR_RESTARTED },
+};
+
+// error status of CAN controller / data[1]
+static const struct canerr_code canerr_ctrl_codes[] = {
+    { "OverflowRX",         CAN_ERR_CRTL_RX_OVERFLOW },
+    { "OverflowTX",         CAN_ERR_CRTL_TX_OVERFLOW },
+    { "WarningRX",          CAN_ERR_CRTL_RX_WARNING },
+    { "WarningTX",          CAN_ERR_CRTL_TX_WARNING },
+    { "PassiveRX",          CAN_ERR_CRTL_RX_PASSIVE },
+    { "PassiveTX",          CAN_ERR_CRTL_TX_PASSIVE },
+    { "Active",             CAN_ERR_CRTL_ACTIVE },
+};
+
+// error in CAN protocol (type) / data[2]
+static const struct canerr_code canerr_prot_type_codes[] = {
+    { "SingleBit",          CAN_ERR_PROT_BIT },
+    { "FrameFormat",        CAN_ERR_PROT_FORM },
+    { "BitStuffing",        CAN_ERR_PROT_STUFF },
+    { "Bit0",               CAN_ERR_PROT_BIT0 },
+    { "Bit1",               CAN_ERR_PROT_BIT1 },
+    { "BusOverload",        CAN_ERR_PROT_OVERLOAD },
+    { "ActiveAnnouncement", CAN_ERR_PROT_ACTIVE },
+    { "TX",                 CAN_ERR_PROT_TX },
+};
+
+// error in CAN protocol (location) / data[3]
+static const struct canerr_code canerr_prot_loc_codes[] = {
+    { "Unspec",             CAN_ERR_PROT_LOC_UNSPEC },
+    { "SOF",                CAN_ERR_PROT_LOC_SOF },
+    { "ID28_21",            CAN_ERR_PROT_LOC_ID28_21 },
+    { "ID20_18",            CAN_ERR_PROT_LOC_ID20_18 },
+    { "SRTR",               CAN_ERR_PROT_LOC_SRTR },
+    { "IDE",                CAN_ERR_PROT_LOC_IDE },
+    { "ID17_13",            CAN_ERR_PROT_LOC_ID17_13 },
+    { "ID12_05",            CAN_ERR_PROT_LOC_ID12_05 },
+    { "ID04_00",            CAN_ERR_PROT_LOC_ID04_00 },
+    { "RTR",                CAN_ERR_PROT_LOC_RTR },
+    { "RES1",               CAN_ERR_PROT_LOC_RES1 },
+    { "RES0",               CAN_ERR_PROT_LOC_RES0 },
+    { "DLC",                CAN_ERR_PROT_LOC_DLC },
+    { "DATA",               CAN_ERR_PROT_LOC_DATA },
+    { "CRC_SEQ",            CAN_ERR_PROT_LOC_CRC_SEQ },
+    { "CRC_DEL",            CAN_ERR_PROT_LOC_CRC_DEL },
+    { "ACK",                CAN_ERR_PROT_LOC_ACK },
+    { "ACK_DEL",            CAN_ERR_PROT_LOC_ACK_DEL },
+    { "EOF",                CAN_ERR_PROT_LOC_EOF },
+    { "INTERM",             CAN_ERR_PROT_LOC_INTERM },
+};
+
+// error status of CAN transceiver / data[4]
+static const struct canerr_code canerr_trx_codes[] = {
+    { "Unspec",             CAN_ERR_TRX_UNSPEC },
+    { "CanHiNoWire",        CAN_ERR_TRX_CANH_NO_WIRE },
+    { "CanHiShortToBAT",    CAN_ERR_TRX_CANH_SHORT_TO_BAT },
+    { "CanHiShortToVCC",    CAN_ERR_TRX_CANH_SHORT_TO_VCC },
+    { "CanHiShortToGND",    CAN_ERR_TRX_CANH_SHORT_TO_GND },
+    { "CanLoNoWire",        CAN_ERR_TRX_CANL_NO_WIRE },
+    { "CanLoShortToBAT",    CAN_ERR_TRX_CANL_SHORT_TO_BAT },
+    { "CanLoShortToVCC",    CAN_ERR_TRX_CANL_SHORT_TO_VCC },
+    { "CanLoShortToGND",    CAN_ERR_TRX_CANL_SHORT_TO_GND },
+    { "CanLoShortToCanHi",  CAN_ERR_TRX_CANL_SHORT_TO_CANH },
+};
+
+static const struct canerr_subclass canerr_subclasses[] = {
+    { CAN_ERR_CRTL, 1, "CtrlUnspec",  true,  true,  canerr_ctrl_codes,      CANERR_COUNT(canerr_ctrl_codes) },
+    { CAN_ERR_PROT, 2, "ProtUnspec",  true,  false, canerr_prot_type_codes, CANERR_COUNT(canerr_prot_type_codes) },
+    { CAN_ERR_PROT, 3, "LocUnspec",   false, false, canerr_prot_loc_codes,  CANERR_COUNT(canerr_prot_loc_codes) },
+    { CAN_ERR_TRX,  4, "TransUnspec", false, false, canerr_trx_codes,       CANERR_COUNT(canerr_trx_codes) },
+};
+
+#define CANERR_SUB_CTRL     (&canerr_subclasses[0])
+#define CANERR_SUB_PROT     (&canerr_subclasses[1])
+#define CANERR_SUB_LOC      (&canerr_subclasses[2])
+#define CANERR_SUB_TRX      (&canerr_subclasses[3])
+
+// short names of error class bits 0..9 in CAN ID (bit 0 is CAN_ERR_TX_TIMEOUT, bit 9 is CAN_ERR_CNT)
+static const char *const canerr_class_bit_names[] = {
+    "TxTimeout", "LostArBit", "Ctrl", "Prot", "Trans", "NoAck", "BusOff", "BusError", "Restarted", "Count"
+};
+
+// case insensitive compare like strcasecmp(), which plain C99 does not declare
+static inline int canerr_name_cmp(const char *a, const char *b) {
+    while (*a != '\0' && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+        a++, b++;
+    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+static inline void canerr_frame_init(struct can_frame *frame) {
+    memset(frame, 0, sizeof(*frame));
+    frame->can_id  = CAN_ERR_FLAG;
+    frame->can_dlc = CAN_ERR_DLC;
+}
+
+// apply one named option (case insensitive) to frame, returns false if name is unknown
+static inline bool canerr_apply_option(struct can_frame *frame, const char *name) {
+    for (size_t i = 0; i < CANERR_COUNT(canerr_class_codes); i++)
+        if (canerr_name_cmp(name, canerr_class_codes[i].name) == 0) {
+            frame->can_id |= canerr_class_codes[i].value;
+            return true;
+        }
+    for (size_t s = 0; s < CANERR_COUNT(canerr_subclasses); s++) {
+        const struct canerr_subclass *sub = &canerr_subclasses[s];
+        if (canerr_name_cmp(name, sub->unspec_option) == 0) {
+            frame->can_id |= sub->class_mask;
+            frame->data[sub->data_index] = 0;
+            return true;
+        }
+        for (size_t i = 0; i < sub->count; i++) {
+            if (sub->codes[i].value == 0)   // unspecified sub code is reachable only by unspec_option
+                continue;
+            if (canerr_name_cmp(name, sub->codes[i].name) == 0) {
+                frame->can_id |= sub->class_mask;
+                if (sub->build_or)
+                    frame->data[sub->data_index] |= (uint8_t)sub->codes[i].value;
+                else
+                    frame->data[sub->data_index]  = (uint8_t)sub->codes[i].value;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// name of a sub code value, "Unknown" if value is not in the table
+static inline const char *canerr_code_name(const struct canerr_subclass *sub, uint8_t value) {
+    for (size_t i = 0; i < sub->count; i++)
+        if (sub->codes[i].value == value)
+            return sub->codes[i].name;
+    return "Unknown";
+}
+
+static inline void canerr_append(char *str, size_t size, size_t *len, const char *format, ...) {
+    va_list args;
+    int n;
+    if (*len >= size)
+        return;
+    va_start(args, format);
+    n = vsnprintf(str + *len, size - *len, format, args);
+    va_end(args);
+    if (n > 0)
+        *len = (*len + n < size) ? *len + n : size - 1;
+}
+
+// append comma separated names of all bits set in data byte, or "Unspec" if no bit is set
+static inline void canerr_append_bits(char *str, size_t size, size_t *len, const struct canerr_subclass *sub, uint8_t value) {
+    bool first = true;
+    if (value == 0) {
+        canerr_append(str, size, len, "Unspec");
+        return;
+    }
+    for (size_t i = 0; i < sub->count; i++)
+        if (value & sub->codes[i].value) {
+            canerr_append(str, size, len, first ? "%s" : ",%s", sub->codes[i].name);
+            first = false;
+        }
+}
+
+// decode error frame into comma separated error list like "LostArBit09,NoAck,BusOff,Prot(Type(TX),Loc(Unspec))"
+static inline size_t canerr_decode(const struct can_frame *frame, char *str, size_t size) {
+    size_t len = 0;
+    const char *sep = "";
+
+    if (size == 0)
+        return 0;
+    str[0] = '\0';
+
+    if (frame->can_id & CAN_ERR_TX_TIMEOUT) {
+        canerr_append(str, size, &len, "%sTxTimeout", sep);
+        sep = ",";
+    }
+    if (frame->can_id & CAN_ERR_LOSTARB) {
+        canerr_append(str, size, &len, "%sLostArBit%02d", sep, frame->data[0]);
+        sep = ",";
+    }
+    for (size_t i = 1; i < CANERR_COUNT(canerr_class_codes); i++)   // NoAck, BusOff, BusError, Restarted
+        if (frame->can_id & canerr_class_codes[i].value) {
+            canerr_append(str, size, &len, "%s%s", sep, canerr_class_codes[i].name);
+            sep = ",";
+        }
+    if (frame->can_id & CAN_ERR_CNT) {
+        canerr_append(str, size, &len, "%sCount(TX=%d,RX=%d)", sep, frame->data[6], frame->data[7]);
+        sep = ",";
+    }
+    if (frame->can_id & CAN_ERR_CRTL) {
+        canerr_append(str, size, &len, "%sCtrl(", sep);
+        canerr_append_bits(str, size, &len, CANERR_SUB_CTRL, frame->data[1]);
+        canerr_append(str, size, &len, ")");
+        sep = ",";
+    }
+    if (frame->can_id & CAN_ERR_PROT) {
+        canerr_append(str, size, &len, "%sProt(Type(", sep);
+        canerr_append_bits(str, size, &len, CANERR_SUB_PROT, frame->data[2]);
+        canerr_append(str, size, &len, "),Loc(%s))", canerr_code_name(CANERR_SUB_LOC, frame->data[3]));
+        sep = ",";
+    }
+    if (frame->can_id & CAN_ERR_TRX)
+        canerr_append(str, size, &len, "%sTrans(%s)", sep, canerr_code_name(CANERR_SUB_TRX, frame->data[4]));
+
+    return len;
+}
+
+#endif // CANERR_H
@@ -0,0 +1,985 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  canerr_stream.h - SocketCAN error frame receive stream, capture and bridge formats            //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  Error frames from one or more interfaces are received in batches through canerr_stream. Its   //
+//  epoll_fd can be awaited by any event loop (or coroutine framework), canerr_stream_read() then //
+//  returns all decoded records that are ready without blocking. Needs _GNU_SOURCE defined before //
+//  the first system header (recvmmsg, struct ifreq, CLOCK_REALTIME), includes canerr.h itself.   //
+//  canerr_stream_data_frames() adds classic, CAN FD and CAN XL data frames to the same stream.   //
+//  canerr_stream_kmsg() merges kernel log messages of CAN drivers into it by timestamp.          //
+//                                                                                                //
+//  USDT probes (provider "canerr") are compiled in when sys/sdt.h is available, as single nops   //
+//  which cost nothing until bpftrace or perf attaches, for example:                              //
+//  bpftrace -e 'usdt:./canerrdump:canerr:frame_decoded { @lat = hist((arg3 - arg2) / 1000); }'   //
+//  Build with -DCANERR_NO_PROBES to leave them out completely.                                   //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CANERR_STREAM_H
+#define CANERR_STREAM_H
+
+#ifndef _GNU_SOURCE
+#error "canerr_stream.h needs _GNU_SOURCE defined before the first system header"
+#endif
+
+#include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/ptp_clock.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
+
+#include "canerr.h"
+
+// CAN XL definitions for kernel headers older than 6.2, frames then are refused at run time
+#ifndef CANXL_XLF
+#define CANXL_XLF          0x80
+#define CANXL_SEC          0x01
+#define CANXL_PRIO_MASK    CAN_SFF_MASK
+#define CANXL_MIN_DLEN     1
+#define CANXL_MAX_DLEN     2048
+#define CAN_RAW_XL_FRAMES  7
+struct canxl_frame {
+    canid_t prio;
+    uint8_t flags;
+    uint8_t sdt;
+    uint16_t len;
+    uint32_t af;
+    uint8_t data[CANXL_MAX_DLEN];
+};
+#define CANXL_MTU          (sizeof(struct canxl_frame))
+#define CANXL_HDR_SIZE     (offsetof(struct canxl_frame, data))
+#endif
+
+// USDT probe points, arguments are not evaluated at all when probes are not compiled in
+#if !defined(CANERR_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CANERR_HAVE_PROBES 1
+#endif
+#endif
+#ifdef CANERR_HAVE_PROBES
+#define CANERR_PROBE(name, ...) STAP_PROBEV(canerr, name, __VA_ARGS__)
+#else
+#define CANERR_PROBE(name, ...) do { } while (0)
+#endif
+
+static inline uint64_t canerr_timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+// current CLOCK_REALTIME in ns, same clock as kernel receive timestamps
+static inline uint64_t canerr_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return canerr_timespec_ns(&ts);
+}
+
+// Hardware receive timestamps count in the adapter clock. canerr_clockmap maps them to CLOCK_REALTIME
+// with a linear model sys = hw + offset + drift * (hw - base_hw), fitted by exponentially weighted
+// least squares over (hw, sys - hw) samples, so old samples fade out and temperature drift is
+// followed. Samples come from PTP_SYS_OFFSET_EXTENDED when the adapter has a PHC, otherwise from the
+// least delayed frame of every second (its software timestamp minus its hardware timestamp).
+#define CANERR_CLOCK_SAMPLE_NS  1000000000ULL   // one model sample per second and interface
+#define CANERR_CLOCK_DECAY      0.95            // weight kept by older samples per new one, ~20 s memory
+
+struct canerr_clockmap {
+    int      phc_fd;                   // PTP hardware clock of adapter, -1 to use frame timestamp pairs
+    uint64_t base_hw;                  // hardware time of first sample, model origin
+    int64_t  base_offset;              // sys - hw of first sample
+    double   sw, sx, sy, sxx, sxy;     // weighted sums, x seconds since base_hw, y ns offset - base_offset
+    double   offset;                   // fitted offset at base_hw, ns relative to base_offset
+    double   drift;                    // fitted drift in ns per second (ppb)
+    double   residual;                 // last sample minus model before it was added, ns
+    uint64_t samples;
+    uint64_t last_sample;              // pairs: hardware time current window started, PHC: CLOCK_MONOTONIC
+                                       // of last sample
+    uint64_t window_hw;                // pairs: hardware time of least delayed frame in current window
+    int64_t  window_min;               // pairs: its sys - hw, INT64_MAX when window is empty
+};
+
+static inline void canerr_clockmap_init(struct canerr_clockmap *m, int phc_fd) {
+    memset(m, 0, sizeof(*m));
+    m->phc_fd     = phc_fd;
+    m->window_min = INT64_MAX;
+}
+
+// mapped CLOCK_REALTIME ns of a hardware timestamp, 0 while there is no sample yet
+static inline uint64_t canerr_clockmap_map(const struct canerr_clockmap *m, uint64_t hw) {
+    double x = ((double)hw - (double)m->base_hw) / 1e9;
+    if (m->samples == 0)
+        return 0;
+    return hw + m->base_offset + (int64_t)(m->offset + m->drift * x);
+}
+
+static inline void canerr_clockmap_sample(struct canerr_clockmap *m, uint64_t hw, int64_t offset) {
+    double x, y, det;
+
+    if (m->samples == 0) {
+        m->base_hw     = hw;
+        m->base_offset = offset;
+    }
+    x = ((double)hw - (double)m->base_hw) / 1e9;
+    y = (double)(offset - m->base_offset);
+    m->residual = m->samples > 0 ? y - (m->offset + m->drift * x) : 0;
+    m->sw  = m->sw  * CANERR_CLOCK_DECAY + 1;
+    m->sx  = m->sx  * CANERR_CLOCK_DECAY + x;
+    m->sy  = m->sy  * CANERR_CLOCK_DECAY + y;
+    m->sxx = m->sxx * CANERR_CLOCK_DECAY + x * x;
+    m->sxy = m->sxy * CANERR_CLOCK_DECAY + x * y;
+    det = m->sw * m->sxx - m->sx * m->sx;
+    if (det > 1e-9 * m->sw * m->sw)                // samples span some time, drift is measurable
+        m->drift = (m->sw * m->sxy - m->sx * m->sy) / det;
+    m->offset = (m->sy - m->drift * m->sx) / m->sw;
+    m->samples++;
+}
+
+// feed hardware and software timestamp of one received frame, keeps least delayed frame per second
+static inline void canerr_clockmap_pair(struct canerr_clockmap *m, uint64_t hw, uint64_t sys) {
+    int64_t offset = (int64_t)(sys - hw);
+
+    if (m->window_min != INT64_MAX && hw - m->last_sample >= CANERR_CLOCK_SAMPLE_NS) {
+        canerr_clockmap_sample(m, m->window_hw, m->window_min);
+        m->window_min = INT64_MAX;
+    }
+    if (m->window_min == INT64_MAX && m->samples == 0)
+        canerr_clockmap_sample(m, hw, offset);    // first frame gives a usable offset right away
+    if (m->window_min == INT64_MAX)
+        m->last_sample = hw;
+    if (offset < m->window_min) {
+        m->window_min = offset;
+        m->window_hw  = hw;
+    }
+}
+
+// cross timestamp PHC against CLOCK_REALTIME, sample with the shortest system read window wins
+static inline bool canerr_clockmap_phc_sample(struct canerr_clockmap *m) {
+#ifdef PTP_SYS_OFFSET_EXTENDED
+    struct ptp_sys_offset_extended req;
+    int64_t best_window = INT64_MAX, best_offset = 0;
+    uint64_t best_hw = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.n_samples = 5;
+    if (ioctl(m->phc_fd, PTP_SYS_OFFSET_EXTENDED, &req) < 0)
+        return false;
+    for (unsigned i = 0; i < req.n_samples; i++) {
+        int64_t sys1 = req.ts[i][0].sec * 1000000000LL + req.ts[i][0].nsec;
+        int64_t phc  = req.ts[i][1].sec * 1000000000LL + req.ts[i][1].nsec;
+        int64_t sys2 = req.ts[i][2].sec * 1000000000LL + req.ts[i][2].nsec;
+        if (sys2 - sys1 < best_window) {
+            best_window = sys2 - sys1;
+            best_offset = sys1 + (sys2 - sys1) / 2 - phc;
+            best_hw     = phc;
+        }
+    }
+    canerr_clockmap_sample(m, best_hw, best_offset);
+    return true;
+#else
+    (void)m;
+    return false;
+#endif
+}
+
+#define CANERR_MAX_INTERFACES  16    // interfaces in one stream
+#define CANERR_MAX_BATCH       64    // frames received by one recvmmsg() call
+#define CANERR_RXBUF_SIZE      (CANERR_MAX_BATCH * CANXL_MTU)   // data frame buffer of a stream
+#define CANERR_CANCEL_TAG      CANERR_MAX_INTERFACES
+#define CANERR_KMSG_TAG        (CANERR_MAX_INTERFACES + 1)
+#define CANERR_TIMER_TAG       (CANERR_MAX_INTERFACES + 2)
+#define CANERR_RATE_WINDOW_NS  250000000ULL   // receive rate of adaptive mode is measured over 250 ms
+#define CANERR_KMSG_MAX        8     // kernel log messages taken by one canerr_stream_read()
+#define CANERR_KMSG_TEXT       256   // message text kept, longer ones are cut
+
+// kind of received frame, also record type in capture files
+enum canerr_frame_type {
+    CANERR_FRAME_ERROR = 1,            // error frame, struct can_frame
+    CANERR_FRAME_CC,                   // classic data frame, struct can_frame
+    CANERR_FRAME_FD,                   // CAN FD data frame, struct canfd_frame up to its len
+    CANERR_FRAME_XL,                   // CAN XL data frame, struct canxl_frame up to its len
+    CANERR_FRAME_KMSG                  // kernel log message of CAN driver, text of len bytes
+};
+
+// what a driver message of the kernel log reports, in frame.data[0] of CANERR_FRAME_KMSG records
+enum canerr_kmsg_kind {
+    CANERR_KMSG_OTHER,
+    CANERR_KMSG_BUSOFF,
+    CANERR_KMSG_RESTART,
+    CANERR_KMSG_OVERRUN,
+    CANERR_KMSG_PASSIVE,
+    CANERR_KMSG_WARNING
+};
+
+static const char *const canerr_kmsg_kind_names[] = {
+    "Other", "BusOff", "Restart", "Overrun", "Passive", "Warning"
+};
+
+// classify driver message by wording common to SocketCAN drivers ("bus-off", "RX FIFO overflow"...)
+static inline int canerr_kmsg_kind(const uint8_t *text, size_t len) {
+    char str[CANERR_KMSG_TEXT];
+
+    snprintf(str, sizeof(str), "%.*s", (int)len, (const char *)text);
+    if (strcasestr(str, "bus-off") || strcasestr(str, "bus off") || strcasestr(str, "busoff"))
+        return CANERR_KMSG_BUSOFF;
+    if (strcasestr(str, "restart"))
+        return CANERR_KMSG_RESTART;
+    if (strcasestr(str, "overrun") || strcasestr(str, "overflow") || strcasestr(str, "fifo full"))
+        return CANERR_KMSG_OVERRUN;
+    if (strcasestr(str, "passive"))
+        return CANERR_KMSG_PASSIVE;
+    if (strcasestr(str, "warning"))
+        return CANERR_KMSG_WARNING;
+    return CANERR_KMSG_OTHER;
+}
+
+struct canerr_record {
+    struct timespec  timestamp;        // kernel receive time (CLOCK_REALTIME)
+    int              iface;            // index of interface in stream
+    const char      *ifname;           // interface name, owned by stream
+    struct can_frame frame;            // error frame, or ID and first 8 bytes of data frame
+    uint8_t          type;             // canerr_frame_type
+    uint16_t         len;              // bytes at raw
+    const uint8_t   *raw;              // whole data frame or kernel log text in stream or capture buffer,
+                                       // valid until next read, NULL for error frames
+};
+
+// fill record from received bytes of given type, returns false when frame is shorter than it claims
+static inline bool canerr_record_set(struct canerr_record *rec, int type, const uint8_t *raw, size_t len) {
+    rec->type = type;
+    rec->len  = len;
+    rec->raw  = type == CANERR_FRAME_ERROR ? NULL : raw;
+    if (type == CANERR_FRAME_KMSG) {
+        memset(&rec->frame, 0, sizeof(rec->frame));
+        rec->frame.data[0] = canerr_kmsg_kind(raw, len);
+        return true;
+    }
+    if (type == CANERR_FRAME_ERROR || type == CANERR_FRAME_CC) {
+        if (len < sizeof(struct can_frame))
+            return false;
+        if (raw != (const uint8_t *)&rec->frame)
+            memcpy(&rec->frame, raw, sizeof(struct can_frame));
+        return true;
+    }
+    memset(&rec->frame, 0, sizeof(rec->frame));
+    if (type == CANERR_FRAME_FD) {
+        const struct canfd_frame *fd = (const struct canfd_frame *)raw;
+        if (len < offsetof(struct canfd_frame, data) || offsetof(struct canfd_frame, data) + fd->len > len)
+            return false;
+        rec->frame.can_id  = fd->can_id;
+        rec->frame.can_dlc = fd->len < CAN_MAX_DLEN ? fd->len : CAN_MAX_DLEN;
+        memcpy(rec->frame.data, fd->data, rec->frame.can_dlc);
+        return true;
+    }
+    if (type == CANERR_FRAME_XL) {
+        const struct canxl_frame *xl = (const struct canxl_frame *)raw;
+        if (len < CANXL_HDR_SIZE || CANXL_HDR_SIZE + xl->len > len)
+            return false;
+        rec->frame.can_id  = xl->prio & CANXL_PRIO_MASK;
+        rec->frame.can_dlc = xl->len < CAN_MAX_DLEN ? xl->len : CAN_MAX_DLEN;
+        memcpy(rec->frame.data, xl->data, rec->frame.can_dlc);
+        return true;
+    }
+    return false;
+}
+
+// bytes of a received frame worth storing, FD and XL frames without unused payload
+static inline size_t canerr_record_size(const struct canerr_record *rec) {
+    if (rec->type == CANERR_FRAME_KMSG)
+        return rec->len;
+    if (rec->type == CANERR_FRAME_FD)
+        return offsetof(struct canfd_frame, data) + ((const struct canfd_frame *)rec->raw)->len;
+    if (rec->type == CANERR_FRAME_XL)
+        return CANXL_HDR_SIZE + ((const struct canxl_frame *)rec->raw)->len;
+    return sizeof(struct can_frame);
+}
+
+struct canerr_stream {
+    int      epoll_fd;                 // readable when records or cancellation are pending
+    int      cancel_fd;                // eventfd written by canerr_stream_cancel()
+    int      count;                    // number of interfaces
+    int      batch;                    // max frames per recvmmsg() call, 1..CANERR_MAX_BATCH
+    can_err_mask_t errmask;
+    int      socks[CANERR_MAX_INTERFACES];
+    char     ifnames[CANERR_MAX_INTERFACES][IF_NAMESIZE];
+    uint32_t drops[CANERR_MAX_INTERFACES];   // frames dropped by kernel because socket queue was full
+    uint64_t skipped;                  // received data frames, which are not error frames
+    uint8_t *rxbuf;                    // CANXL_MTU per batch slot when data frames are received
+    bool     rxbuf_owned;              // rxbuf was allocated by stream, not given by caller
+    bool     hw_timestamps;            // map adapter timestamps to CLOCK_REALTIME where available
+    const char *phc_path;              // PHC given by user, otherwise found through ethtool
+    struct canerr_clockmap clocks[CANERR_MAX_INTERFACES];
+    struct hwtstamp_config hw_saved[CANERR_MAX_INTERFACES];   // adapter config before receive filter was raised
+    bool     hw_raised[CANERR_MAX_INTERFACES];   // restore hw_saved at close
+    uint64_t incomplete;               // received frames shorter than their type needs
+    int      kmsg_fd;                  // /dev/kmsg when driver messages are merged, -1 otherwise
+    int      ifindexes[CANERR_MAX_INTERFACES];
+    uint64_t kmsg_lost;                // kernel log messages overwritten before they were read
+    char     kmsg_text[CANERR_KMSG_MAX][CANERR_KMSG_TEXT];   // texts of last read, records point here
+    bool     cancelled;
+    int      timer_fd;                 // drains sockets periodically in adaptive mode, -1 otherwise
+    uint64_t coalesce_ns;              // drain period under load, 0 when adaptive mode is off
+    uint32_t coalesce_enter;           // records/s from which sockets are drained periodically
+    uint32_t coalesce_leave;           // records/s below which every frame wakes up again
+    bool     coalescing;
+    bool     backlog;                  // last drain filled whole batch, more records are queued
+    uint64_t window_start_ns, window_records;   // CLOCK_MONOTONIC, rate measurement
+    uint64_t coalesce_since_ns, coalesced_ns;   // time spent draining periodically
+    uint64_t wakeups, woken_records, switches;
+    uint64_t delay_sum_ns, delay_max_ns, delayed;   // receive time to delivery of drained records
+    struct mmsghdr msgs[CANERR_MAX_BATCH];
+    struct iovec   iovs[CANERR_MAX_BATCH];
+    char     cmsgs[CANERR_MAX_BATCH][CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)) +
+                                     CMSG_SPACE(3 * sizeof(struct timespec))];
+};
+
+static inline int canerr_stream_init(struct canerr_stream *s, can_err_mask_t errmask, int batch) {
+    struct epoll_event ev;
+    memset(s, 0, sizeof(*s));
+    s->errmask = errmask;
+    s->batch   = (batch < 1 || batch > CANERR_MAX_BATCH) ? CANERR_MAX_BATCH : batch;
+    s->kmsg_fd = -1;
+    s->timer_fd = -1;
+    if ((s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+    if ((s->cancel_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        close(s->epoll_fd);
+        return -1;
+    }
+    ev.events   = EPOLLIN;
+    ev.data.u32 = CANERR_CANCEL_TAG;
+    return epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->cancel_fd, &ev);
+}
+
+// receive classic, CAN FD and CAN XL data frames too, on interfaces added after this call. Frames
+// then land in a buffer with CANXL_MTU per batch slot instead of directly in records. buf of
+// CANERR_RXBUF_SIZE bytes stays owned by caller, NULL allocates one which canerr_stream_close() frees.
+static inline int canerr_stream_data_frames(struct canerr_stream *s, uint8_t *buf) {
+    if (s->rxbuf != NULL)
+        return 0;
+    if (buf == NULL) {
+        if ((buf = (uint8_t *)malloc(CANERR_RXBUF_SIZE)) == NULL)
+            return -1;
+        s->rxbuf_owned = true;
+    }
+    s->rxbuf = buf;
+    return 0;
+}
+
+// use hardware receive timestamps on interfaces added after this call, mapped to CLOCK_REALTIME.
+// phc_path names the adapter PTP clock (/dev/ptp0), NULL finds it through ethtool or falls back to
+// timestamp pairs of received frames.
+static inline void canerr_stream_hw_timestamps(struct canerr_stream *s, const char *phc_path) {
+    s->hw_timestamps = true;
+    s->phc_path      = phc_path;
+}
+
+// enable hardware timestamps on socket of interface and open its PHC if it has one, returns PHC fd or -1
+static inline int canerr_stream_hw_setup(struct canerr_stream *s, int sock, const char *ifname) {
+    struct hwtstamp_config config;
+    struct ethtool_ts_info info;
+    struct ifreq ifr;
+    char path[32];
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, ifname);
+    memset(&config, 0, sizeof(config));
+    ifr.ifr_data = (char *)&config;
+    ioctl(sock, SIOCGHWTSTAMP, &ifr);                   // config is per adapter, ptp4l and such may share it
+    if (config.rx_filter == HWTSTAMP_FILTER_NONE) {     // keep their tx_type and any filter already set
+        s->hw_saved[s->count] = config;
+        config.rx_filter = HWTSTAMP_FILTER_ALL;         // needs CAP_NET_ADMIN, some drivers always stamp
+        s->hw_raised[s->count] = ioctl(sock, SIOCSHWTSTAMP, &ifr) == 0;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+    if (s->phc_path != NULL)
+        return open(s->phc_path, O_RDONLY | O_CLOEXEC);
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GET_TS_INFO;
+    ifr.ifr_data = (char *)&info;
+    if (ioctl(sock, SIOCETHTOOL, &ifr) < 0 || info.phc_index < 0)
+        return -1;
+    snprintf(path, sizeof(path), "/dev/ptp%d", info.phc_index);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// open, bind and register a socket for one more interface, returns -1 with errno set on failure
+static inline int canerr_stream_add(struct canerr_stream *s, const char *ifname) {
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    struct epoll_event ev;
+    const int on = 1;
+    int sock;
+
+    if (s->count >= CANERR_MAX_INTERFACES || strlen(ifname) >= IF_NAMESIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((sock = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW)) < 0)
+        return -1;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, ifname);
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+        goto fail;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto fail;
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &s->errmask, sizeof(s->errmask));
+    if (s->rxbuf != NULL) {                                         // older kernels refuse XL, FD
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_XL_FRAMES, &on, sizeof(on));
+    } else
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);     // no data frames, only errors
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));    // receive time in cmsg
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL,    &on, sizeof(on));    // kernel drop counter in cmsg
+    ev.events   = EPOLLIN;
+    ev.data.u32 = s->count;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+        goto fail;
+    canerr_clockmap_init(&s->clocks[s->count], s->hw_timestamps ? canerr_stream_hw_setup(s, sock, ifname) : -1);
+    s->socks[s->count] = sock;
+    s->ifindexes[s->count] = ifr.ifr_ifindex;
+    strcpy(s->ifnames[s->count], ifname);
+    s->count++;
+    return 0;
+fail:
+    close(sock);
+    return -1;
+}
+
+// also read kernel log, messages naming an interface of stream come as CANERR_FRAME_KMSG records.
+// Only messages logged after this call, reading /dev/kmsg needs CAP_SYSLOG with dmesg_restrict=1.
+static inline int canerr_stream_kmsg(struct canerr_stream *s) {
+    struct epoll_event ev;
+
+    if ((s->kmsg_fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+        return -1;
+    lseek(s->kmsg_fd, 0, SEEK_END);
+    ev.events   = EPOLLIN;
+    ev.data.u32 = CANERR_KMSG_TAG;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->kmsg_fd, &ev) < 0) {
+        close(s->kmsg_fd);
+        s->kmsg_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// interface name as whole word in text, so can1 does not match can10
+static inline bool canerr_kmsg_names(const char *text, const char *ifname) {
+    size_t len = strlen(ifname);
+    for (const char *p = strstr(text, ifname); p != NULL; p = strstr(p + 1, ifname))
+        if ((p == text || !isalnum((unsigned char)p[-1])) && !isalnum((unsigned char)p[len]))
+            return true;
+    return false;
+}
+
+// driver messages logged since last call, each read() returns one "prio,seq,usec,flags;text\n" record
+// followed by " KEY=value" lines, DEVICE=n<ifindex> of netdev_*() logging or name in text selects interface
+static inline int canerr_stream_kmsg_recv(struct canerr_stream *s, struct canerr_record *recs, int max) {
+    char buf[8192], device[32];                     // kernel refuses reads shorter than a record
+    struct timespec mono, real;
+    int64_t offset;
+    int count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);          // kernel log time is monotonic since boot
+    clock_gettime(CLOCK_REALTIME, &real);
+    offset = (int64_t)canerr_timespec_ns(&real) - (int64_t)canerr_timespec_ns(&mono);
+    if (max > CANERR_KMSG_MAX)
+        max = CANERR_KMSG_MAX;
+    while (count < max) {
+        ssize_t len = read(s->kmsg_fd, buf, sizeof(buf) - 1);
+        unsigned int prio;
+        unsigned long long seq, usec;
+        int text_pos = 0, iface;
+        char *text, *end, *dict;
+        uint64_t ts;
+        if (len < 0) {
+            if (errno == EPIPE) {                   // ring buffer overwrote messages, next read goes on
+                s->kmsg_lost++;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            break;                                  // EAGAIN, all read
+        }
+        buf[len] = '\0';
+        if (sscanf(buf, "%u,%llu,%llu,%*[^;];%n", &prio, &seq, &usec, &text_pos) < 3 || text_pos == 0 ||
+            prio >> 3 != 0)
+            continue;                               // only kernel facility, not lines of user space
+        text = buf + text_pos;
+        if ((end = strchr(text, '\n')) != NULL)
+            *end = '\0';
+        dict = end != NULL ? end + 1 : NULL;
+        for (iface = 0; iface < s->count; iface++) {
+            snprintf(device, sizeof(device), "DEVICE=n%d\n", s->ifindexes[iface]);
+            if ((dict != NULL && strstr(dict, device) != NULL) || canerr_kmsg_names(text, s->ifnames[iface]))
+                break;
+        }
+        if (iface == s->count)
+            continue;
+        snprintf(s->kmsg_text[count], CANERR_KMSG_TEXT, "%s", text);
+        canerr_record_set(&recs[count], CANERR_FRAME_KMSG, (const uint8_t *)s->kmsg_text[count], strlen(s->kmsg_text[count]));
+        ts = usec * 1000 + offset;
+        recs[count].timestamp.tv_sec  = ts / 1000000000ULL;
+        recs[count].timestamp.tv_nsec = ts % 1000000000ULL;
+        recs[count].iface  = iface;
+        recs[count].ifname = s->ifnames[iface];
+        count++;
+    }
+    return count;
+}
+
+// make pending and future canerr_stream_read() calls fail with ECANCELED, async signal safe
+static inline void canerr_stream_cancel(struct canerr_stream *s) {
+    uint64_t one = 1;
+    ssize_t ret = write(s->cancel_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+static inline uint64_t canerr_stream_drops(const struct canerr_stream *s) {
+    uint64_t drops = 0;
+    for (int i = 0; i < s->count; i++)
+        drops += s->drops[i];
+    return drops;
+}
+
+// replace software receive time of record by its mapped hardware timestamp
+static inline void canerr_stream_map_hw(struct canerr_stream *s, int iface, struct canerr_record *rec, uint64_t hw) {
+    struct canerr_clockmap *m = &s->clocks[iface];
+    uint64_t sys;
+
+    if (m->phc_fd >= 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (m->samples == 0 || canerr_timespec_ns(&now) - m->last_sample >= CANERR_CLOCK_SAMPLE_NS) {
+            m->last_sample = canerr_timespec_ns(&now);
+            canerr_clockmap_phc_sample(m);
+        }
+    } else
+        canerr_clockmap_pair(m, hw, canerr_timespec_ns(&rec->timestamp));
+    if ((sys = canerr_clockmap_map(m, hw)) != 0) {
+        rec->timestamp.tv_sec  = sys / 1000000000ULL;
+        rec->timestamp.tv_nsec = sys % 1000000000ULL;
+    }
+}
+
+// receive up to max error frames already queued on one interface socket, without blocking
+static inline int canerr_stream_recv(struct canerr_stream *s, int iface, struct canerr_record *recs, int max) {
+    int n, count = 0;
+
+    if (max > s->batch)
+        max = s->batch;
+    for (int i = 0; i < max; i++) {
+        if (s->rxbuf != NULL) {
+            s->iovs[i].iov_base = s->rxbuf + i * CANXL_MTU;
+            s->iovs[i].iov_len  = CANXL_MTU;
+        } else {
+            s->iovs[i].iov_base = &recs[i].frame;   // error frames land directly in caller records
+            s->iovs[i].iov_len  = sizeof(struct can_frame);
+        }
+        memset(&s->msgs[i].msg_hdr, 0, sizeof(s->msgs[i].msg_hdr));
+        s->msgs[i].msg_hdr.msg_iov        = &s->iovs[i];
+        s->msgs[i].msg_hdr.msg_iovlen     = 1;
+        s->msgs[i].msg_hdr.msg_control    = s->cmsgs[i];
+        s->msgs[i].msg_hdr.msg_controllen = sizeof(s->cmsgs[i]);
+    }
+    n = recvmmsg(s->socks[iface], s->msgs, max, MSG_DONTWAIT, NULL);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    for (int i = 0; i < n; i++) {
+        struct canerr_record *rec = &recs[count];
+        const uint8_t *raw = (const uint8_t *)s->iovs[i].iov_base;
+        size_t len = s->msgs[i].msg_len;
+        struct cmsghdr *cmsg;
+        uint32_t drops = s->drops[iface];
+        bool stamped = false;
+        uint64_t hw = 0;
+        int type;
+
+        for (cmsg = CMSG_FIRSTHDR(&s->msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&s->msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+            if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+                memcpy(&rec->timestamp, CMSG_DATA(cmsg), sizeof(rec->timestamp));
+                stamped = true;
+            } else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+                memcpy(&s->drops[iface], CMSG_DATA(cmsg), sizeof(uint32_t));
+            else if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+                struct timespec ts[3];                  // software, legacy, raw hardware
+                memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+                hw = canerr_timespec_ns(&ts[2]);
+                if (!stamped && (ts[0].tv_sec || ts[0].tv_nsec)) {
+                    rec->timestamp = ts[0];
+                    stamped = true;
+                }
+            }
+        }
+        if (s->drops[iface] != drops)               // frames lost in kernel before this one
+            CANERR_PROBE(frame_dropped, iface, s->drops[iface] - drops, canerr_now_ns());
+        if (len >= CANXL_HDR_SIZE + CANXL_MIN_DLEN && (raw[offsetof(struct canxl_frame, flags)] & CANXL_XLF))
+            type = CANERR_FRAME_XL;                 // FD len byte at this offset never has bit 7 set
+        else if (len == CANFD_MTU)
+            type = CANERR_FRAME_FD;
+        else if (len == sizeof(struct can_frame))
+            type = (((const struct can_frame *)raw)->can_id & CAN_ERR_FLAG) ? CANERR_FRAME_ERROR : CANERR_FRAME_CC;
+        else
+            type = 0;
+        if (type == CANERR_FRAME_CC && s->rxbuf == NULL) {
+            s->skipped++;
+            continue;
+        }
+        if (type == 0 || !canerr_record_set(rec, type, raw, len)) {   // compacts records over skipped
+            s->incomplete++;
+            CANERR_PROBE(frame_dropped, iface, 1, canerr_now_ns());
+            continue;
+        }
+        if (!stamped)
+            clock_gettime(CLOCK_REALTIME, &rec->timestamp);
+        if (hw != 0)
+            canerr_stream_map_hw(s, iface, rec, hw);
+        rec->iface  = iface;
+        rec->ifname = s->ifnames[iface];
+        CANERR_PROBE(frame_received, iface, rec->frame.can_id, canerr_timespec_ns(&rec->timestamp), canerr_now_ns());
+        count++;
+    }
+    return count;
+}
+
+static inline uint64_t canerr_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return canerr_timespec_ns(&ts);
+}
+
+// Adaptive receive: while traffic is sparse, every frame wakes canerr_stream_read() up as usual. From
+// enter records/s on, sockets stay quiet in epoll and a timerfd drains all of them every period_ns with
+// recvmmsg(), socket receive queues buffer frames in between. Below leave records/s it switches back.
+// Wakeups drop from one per frame to one per period, delivery is delayed by up to period_ns.
+static inline int canerr_stream_coalesce(struct canerr_stream *s, uint64_t period_ns, uint32_t enter, uint32_t leave) {
+    struct epoll_event ev;
+
+    if ((s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return -1;
+    ev.events   = EPOLLIN;
+    ev.data.u32 = CANERR_TIMER_TAG;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->timer_fd, &ev) < 0) {
+        close(s->timer_fd);
+        s->timer_fd = -1;
+        return -1;
+    }
+    s->coalesce_ns     = period_ns;
+    s->coalesce_enter  = enter;
+    s->coalesce_leave  = leave < enter ? leave : enter;
+    s->window_start_ns = canerr_monotonic_ns();
+    return 0;
+}
+
+// start or stop periodic draining, sockets without events in epoll do not wake epoll_wait() up
+static inline void canerr_stream_switch(struct canerr_stream *s, bool coalesce, uint64_t now) {
+    struct itimerspec its;
+    struct epoll_event ev;
+
+    memset(&its, 0, sizeof(its));
+    if (coalesce) {
+        its.it_value.tv_sec     = s->coalesce_ns / 1000000000ULL;
+        its.it_value.tv_nsec    = s->coalesce_ns % 1000000000ULL;
+        its.it_interval         = its.it_value;
+        s->coalesce_since_ns    = now;
+    } else
+        s->coalesced_ns += now - s->coalesce_since_ns;
+    timerfd_settime(s->timer_fd, 0, &its, NULL);
+    ev.events = coalesce ? 0 : EPOLLIN;
+    for (int i = 0; i < s->count; i++) {
+        ev.data.u32 = i;
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, s->socks[i], &ev);
+    }
+    s->coalescing = coalesce;
+    s->backlog    = false;
+    s->switches++;
+}
+
+// records queued on all sockets, batch shared fairly, delay from receive to now is accounted
+static inline int canerr_stream_drain(struct canerr_stream *s, struct canerr_record *recs, int max) {
+    uint64_t now = canerr_now_ns();
+    int count = 0, ret;
+
+    for (int i = 0; i < s->count && count < max; i++) {
+        int quota = (max - count) / (s->count - i);
+        if ((ret = canerr_stream_recv(s, i, recs + count, quota < 1 ? max - count : quota)) < 0)
+            return -1;
+        count += ret;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t ts = canerr_timespec_ns(&recs[i].timestamp), delay = now > ts ? now - ts : 0;
+        s->delay_sum_ns += delay;
+        if (delay > s->delay_max_ns)
+            s->delay_max_ns = delay;
+    }
+    s->delayed += count;
+    s->backlog  = count == max;                     // next read drains again without waiting
+    return count;
+}
+
+// measure receive rate over CANERR_RATE_WINDOW_NS and switch mode with hysteresis
+static inline void canerr_stream_adapt(struct canerr_stream *s, int count) {
+    uint64_t now, elapsed;
+    double rate;
+
+    s->window_records += count;
+    if ((elapsed = (now = canerr_monotonic_ns()) - s->window_start_ns) < CANERR_RATE_WINDOW_NS)
+        return;
+    rate = s->window_records * 1e9 / elapsed;
+    if (!s->coalescing && rate >= s->coalesce_enter)
+        canerr_stream_switch(s, true, now);
+    else if (s->coalescing && rate < s->coalesce_leave)
+        canerr_stream_switch(s, false, now);
+    s->window_start_ns = now;
+    s->window_records  = 0;
+}
+
+// wait up to timeout_ms (-1 forever, 0 poll) and return up to max ready records from all interfaces,
+// 0 on timeout or when a periodic drain found nothing, -1 with errno set on error or ECANCELED after
+// canerr_stream_cancel()
+static inline int canerr_stream_read(struct canerr_stream *s, struct canerr_record *recs, int max, int timeout_ms) {
+    struct epoll_event events[CANERR_MAX_INTERFACES + 3];
+    int n = 0, count = 0, kmsgs = 0;
+    bool drain = s->coalescing && s->backlog;
+
+    if (s->cancelled) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (!drain && (n = epoll_wait(s->epoll_fd, events, CANERR_MAX_INTERFACES + 3, timeout_ms)) < 0)
+        return errno == EINTR ? 0 : -1;
+    if (n > 0)
+        s->wakeups++;
+    for (int i = 0; i < n; i++) {
+        int iface = events[i].data.u32, ret, quota;
+        if (iface == CANERR_CANCEL_TAG) {
+            s->cancelled = true;
+            continue;
+        }
+        if (iface == CANERR_TIMER_TAG) {
+            uint64_t expirations;
+            if (read(s->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                return -1;
+            drain = s->coalescing;                  // tick may still be pending after switching back
+            continue;
+        }
+        quota = (max - count) / (n - i);            // share batch fairly between ready interfaces
+        if (quota < 1)
+            quota = max - count;
+        if (quota <= 0)
+            break;
+        if (iface == CANERR_KMSG_TAG) {
+            kmsgs = canerr_stream_kmsg_recv(s, recs + count, quota);
+            count += kmsgs;
+            continue;
+        }
+        if ((ret = canerr_stream_recv(s, iface, recs + count, quota)) < 0)
+            return -1;
+        count += ret;
+    }
+    if (drain && count < max) {
+        int ret = canerr_stream_drain(s, recs + count, max - count);
+        if (ret < 0)
+            return -1;
+        count += ret;
+    }
+    s->woken_records += count;
+    if (s->coalesce_ns > 0)
+        canerr_stream_adapt(s, count);
+    for (int i = 1; kmsgs > 0 && i < count; i++) {  // merge driver messages into frames by time
+        struct canerr_record rec = recs[i];
+        int j = i;
+        for (; j > 0 && canerr_timespec_ns(&recs[j - 1].timestamp) > canerr_timespec_ns(&rec.timestamp); j--)
+            recs[j] = recs[j - 1];
+        recs[j] = rec;
+    }
+    if (count == 0 && s->cancelled) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return count;
+}
+
+// Binary capture file: CANERR_CAP_HEADER_SIZE bytes of header, then blocks of block_size bytes. Every
+// block starts with canerr_cap_block and holds only whole records, rest of block is zero padding, so
+// readers recover at next block boundary after a torn write. Sizes keep blocks aligned for O_DIRECT.
+// While capture is written, writer keeps header page mapped and publishes there how far records are
+// complete, so followers can decode a growing file without ever reading a half written record.
+#define CANERR_CAP_MAGIC        "CANERRCP"
+#define CANERR_CAP_VERSION      1
+#define CANERR_CAP_HEADER_SIZE  4096
+#define CANERR_CAP_BLOCK_MAGIC  0x4B4C4243U     // "CBLK"
+#define CANERR_CAP_FRAME        CANERR_FRAME_ERROR   // record type is canerr_frame_type, payload is
+                                                     // canerr_record_size() bytes of the frame
+#define CANERR_CAP_LIVE         0x1U            // header flag: writer is active, committed still grows
+#define CANERR_CAP_INCIDENT     0x2U            // header flag: incident snapshot, trigger_ns and note are set
+#define CANERR_CAP_NOTE_SIZE    1024
+
+struct canerr_cap_header {
+    char     magic[8];                 // CANERR_CAP_MAGIC, not zero terminated
+    uint32_t version;
+    uint32_t block_size;               // bytes per block including canerr_cap_block
+    uint64_t start_ns;                 // capture start, CLOCK_REALTIME
+    uint32_t if_count;
+    uint32_t flags;                    // CANERR_CAP_LIVE, CANERR_CAP_INCIDENT, zero in files of older writers
+    char     ifnames[CANERR_MAX_INTERFACES][IF_NAMESIZE];   // record iface indexes this table
+    uint64_t committed;                // file offset up to which records are complete, zero if unknown
+    uint64_t trigger_ns;               // incident snapshots: time of trigger, CLOCK_REALTIME
+    char     note[CANERR_CAP_NOTE_SIZE];   // incident snapshots: trigger and counters, zero terminated
+};
+
+struct canerr_cap_block {
+    uint32_t magic;                    // CANERR_CAP_BLOCK_MAGIC, zero if block was never written
+    uint32_t used;                     // bytes of records following this header
+    uint64_t seq;                      // block number, 0 is first block after file header
+};
+
+struct canerr_cap_record {
+    uint64_t timestamp_ns;             // receive time, CLOCK_REALTIME
+    uint16_t size;                     // whole record including this header, multiple of 8
+    uint8_t  iface;
+    uint8_t  type;                     // canerr_frame_type
+    uint32_t len;                      // payload bytes following this header
+};
+
+// followers: flags first, so committed read afterwards is final once CANERR_CAP_LIVE is gone
+static inline uint32_t canerr_cap_flags(const struct canerr_cap_header *hdr) {
+    return __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t canerr_cap_committed(const struct canerr_cap_header *hdr) {
+    return __atomic_load_n(&hdr->committed, __ATOMIC_ACQUIRE);
+}
+
+// record at *pos of records ending at end, NULL at end or on corrupted record
+static inline const struct canerr_cap_record *canerr_cap_record_at(const char *buf, size_t end, size_t *pos) {
+    const struct canerr_cap_record *rec;
+
+    if (*pos + sizeof(*rec) > end)
+        return NULL;
+    rec = (const struct canerr_cap_record *)(buf + *pos);
+    if (rec->size < sizeof(*rec) + rec->len || rec->size % 8 != 0 || *pos + rec->size > end)
+        return NULL;
+    *pos += rec->size;
+    return rec;
+}
+
+// next record of a block read from capture file, NULL at end of block or on corrupted record
+static inline const struct canerr_cap_record *canerr_cap_next(const char *block, size_t block_size, size_t *pos) {
+    const struct canerr_cap_block *hdr = (const struct canerr_cap_block *)block;
+    size_t end;
+
+    if (hdr->magic != CANERR_CAP_BLOCK_MAGIC || hdr->used > block_size - sizeof(*hdr))
+        return NULL;
+    end = sizeof(*hdr) + hdr->used;
+    if (*pos < sizeof(*hdr))
+        *pos = sizeof(*hdr);
+    return canerr_cap_record_at(block, end, pos);
+}
+
+// bytes one record takes in capture format, payload padded to multiple of 8
+static inline size_t canerr_cap_record_bytes(const struct canerr_record *rec) {
+    return (sizeof(struct canerr_cap_record) + canerr_record_size(rec) + 7) & ~(size_t)7;
+}
+
+// write record in capture format to out, which has canerr_cap_record_bytes() bytes, returns them
+static inline size_t canerr_cap_put(char *out, const struct canerr_record *rec) {
+    struct canerr_cap_record *hdr = (struct canerr_cap_record *)out;
+    size_t len = canerr_record_size(rec);           // FD and XL frames without unused payload
+    size_t size = canerr_cap_record_bytes(rec);
+
+    hdr->timestamp_ns = canerr_timespec_ns(&rec->timestamp);
+    hdr->size  = size;
+    hdr->iface = rec->iface;
+    hdr->type  = rec->type;
+    hdr->len   = len;
+    memcpy(hdr + 1, rec->raw != NULL ? rec->raw : (const uint8_t *)&rec->frame, len);
+    memset(out + sizeof(*hdr) + len, 0, size - sizeof(*hdr) - len);
+    return size;
+}
+
+// UDP bridge: canerrdump Bridge= sends received records in datagrams of canerr_bridge_header followed
+// by count records in capture record format (native byte order like capture files), canerrsim Bridge=
+// injects them into a local interface with their original spacing.
+#define CANERR_BRIDGE_MAGIC     0x47445242U     // "BRDG"
+#define CANERR_BRIDGE_VERSION   1
+#define CANERR_BRIDGE_PORT      "29537"
+#define CANERR_BRIDGE_PAYLOAD   1400            // records are packed up to this, fits Ethernet MTU
+
+struct canerr_bridge_header {
+    uint32_t magic;                    // CANERR_BRIDGE_MAGIC
+    uint16_t version;                  // CANERR_BRIDGE_VERSION
+    uint16_t count;                    // records following this header
+    uint64_t seq;                      // datagram number, gaps tell receiver about lost datagrams
+    uint64_t sent_ns;                  // CLOCK_REALTIME of sender
+};
+
+// biggest datagram: header and one CAN XL record with full payload
+#define CANERR_BRIDGE_DGRAM_MAX (sizeof(struct canerr_bridge_header) + \
+                                 ((sizeof(struct canerr_cap_record) + CANXL_MTU + 7) & ~(size_t)7))
+
+// next record of a received datagram, NULL at end or on corrupted datagram
+static inline const struct canerr_cap_record *canerr_bridge_next(const char *dgram, size_t len, size_t *pos) {
+    const struct canerr_bridge_header *hdr = (const struct canerr_bridge_header *)dgram;
+
+    if (len < sizeof(*hdr) || hdr->magic != CANERR_BRIDGE_MAGIC || hdr->version != CANERR_BRIDGE_VERSION)
+        return NULL;
+    if (*pos < sizeof(*hdr))
+        *pos = sizeof(*hdr);
+    return canerr_cap_record_at(dgram, len, pos);
+}
+
+static inline void canerr_stream_close(struct canerr_stream *s) {
+    struct ifreq ifr;
+
+    for (int i = 0; i < s->count; i++) {
+        if (s->hw_raised[i]) {                          // adapter config as it was before canerr_stream_add()
+            memset(&ifr, 0, sizeof(ifr));
+            strcpy(ifr.ifr_name, s->ifnames[i]);
+            ifr.ifr_data = (char *)&s->hw_saved[i];
+            ioctl(s->socks[i], SIOCSHWTSTAMP, &ifr);
+            s->hw_raised[i] = false;
+        }
+        close(s->socks[i]);
+        if (s->clocks[i].phc_fd >= 0)
+            close(s->clocks[i].phc_fd);
+    }
+    if (s->kmsg_fd >= 0)
+        close(s->kmsg_fd);
+    s->kmsg_fd = -1;
+    if (s->timer_fd >= 0)
+        close(s->timer_fd);
+    s->timer_fd = -1;
+    close(s->cancel_fd);
+    close(s->epoll_fd);
+    if (s->rxbuf_owned)
+        free(s->rxbuf);
+    s->rxbuf = NULL;
+    s->rxbuf_owned = false;
+    s->count = 0;
+}
+
+#endif // CANERR_STREAM_H
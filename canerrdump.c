@@ -21,28 +21,109 @@
 //                                                                                                //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/ioctl.h>
+#include <sys/un.h>
 #include <net/if.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <linux/can/error.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/can/netlink.h>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dlfcn.h>
+#include "canerr_stream.h"
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define FOOTPRINT_HEAP_CHECK        // mallinfo2() shows allocations after start
+#endif
 
 #define can_interface_name argv[1]
 #define STR_EQUAL 0
 
+#define FORMAT_MAX_OPS 64           // fields and literal texts in one output template
+#define SHARD_RING_SIZE (1 << 20)   // bytes buffered for each interface writer thread, power of 2
+#define CAPTURE_FLUSH_MS 1000      // partially filled capture block is written after 1 s
+#define FOLLOW_POLL_MS 100          // Follow mode checks committed offset at least this often
+#define FOLLOW_MAP_STEP (64UL << 20)    // Follow mode mapping grows in these steps
+#define DATA_PRINT_MAX 64           // payload bytes printed for FD and XL data frames
+#define JOURNAL_ENTRY_SIZE 2048     // bytes of one journald native protocol entry
+#define JOURNAL_SOCKET "/run/systemd/journal/socket"
+#define MQTT_TOPIC_SIZE 128
+#define MQTT_PAYLOAD_SIZE 1024
+#define MQTT_RX_SIZE 256            // broker only sends CONNACK, PUBACK and PINGRESP
+#define MQTT_KEEPALIVE_S 60
+#define MQTT_TIMEOUT_S 5            // connect, CONNACK and final queue delivery at exit
+#define MQTT_MAX_BACKOFF_S 30       // reconnect delay doubles up to this
+#define MQTT_MAX_INFLIGHT 32        // QoS 1 messages sent before PUBACK
+#define SQLITE_LIBRARY "libsqlite3.so.0"
+#define SQLITE_QUEUE_ROWS 65536     // errors waiting for SQLite writer thread
+#define SQLITE_BATCH 10000          // rows in one transaction
+#define SQLITE_FLUSH_MS 1000        // open transaction is committed after 1 s
+#define SQLITE_BUSY_MS 5000         // wait for other writers of same database
+#define SQLITE_HEAP_LIMIT (8 << 20) // SQLite heap in footprint profile, half of it page cache
+#define DASH_PORT "29538"
+#define DASH_MAX_CLIENTS 16         // browsers connected to dashboard at once
+#define DASH_SIGNATURES 256         // distinct error frames counted, power of 2
+#define DASH_SIGNATURE_SIZE 160
+#define DASH_TOP 10                 // signatures shown on dashboard
+#define DASH_TRANSITIONS 64         // state transitions kept for new browsers
+#define DASH_REQUEST_SIZE 2048      // HTTP request header or WebSocket frames from browser
+#define DASH_MESSAGE_SIZE 32768     // one push, JSON
+#define DASH_QUEUE_SIZE (2 * DASH_MESSAGE_SIZE + 64)   // unsent bytes kept per browser, one behind more is dropped
+#define LOAD_NETLINK_SIZE 16384     // one RTM_NEWLINK answer with statistics and link info
+#define LOAD_FRAME_BITS 47          // SOF, 11 bit identifier, control, CRC, ACK, EOF and intermission
+#define LOAD_STUFF_PERCENT 10       // bit stuffing of average traffic, worst case is 20
+#define EXPECT_MAX_STATES 64        // automaton states of Expect pattern, one bit each
+#define EXPECT_ITEM_SIZE 64
+#define INCIDENT_BLOCK_SIZE (64 * 1024)  // blocks of incident files, records are copied, no O_DIRECT
+#define BPF_SLOTS     96            // in-kernel counters per interface
+#define BPF_MAX_INSNS 2048
+#define FOOTPRINT_RESERVE (256UL << 20)   // address space reserved for arena, unused part is given back
+#define FOOTPRINT_STACK_SIZE (256 * 1024) // stack of every helper thread in footprint profile
+#define FOOTPRINT_MAX_PARTS 16
+#ifndef FOOTPRINT_DEFAULT
+#define FOOTPRINT_DEFAULT false     // build with -DFOOTPRINT_DEFAULT=true for gateways
+#endif
+
+struct canerr_stream stream;                                // global, so signal handler can cancel it
+struct canerr_record records[CANERR_MAX_BATCH];
+char out_buf[CANERR_MAX_BATCH * 1200];                       // one batch of formatted lines
+
 void show_help_and_exit() {
     printf("\n");
     printf("Usage: canerrdump <CAN interface> [Options]\n");
+    printf("       canerrdump Read=<capture file> [Options]\n");
+    printf("       canerrdump Follow=<capture file> [Options]\n");
     printf("\n");
     printf("CAN interface:           ( CAN interface is case sensitive )\n");
     printf("    can0                 ( or can1, can2 or virtual ones like vcan0, vcan1...\n");
+    printf("    can0,can1            ( comma separated list monitors several interfaces at once )\n");
     printf("\n");
     printf("Options:                 ( options are not case sensitive )\n");
     printf("                         ( ERROR CLASS (MASK) IN CAN ID: )\n");
@@ -56,6 +137,88 @@ void show_help_and_exit() {
     printf("    IgnoreBusError       ( filter bus error messages )\n");
     printf("    IgnoreRestarted      ( filter controller restarted messages )\n");
     printf("    IgnoreCounters       ( filter TX and RX error counter messages )\n");
+    printf("                         ( RECEIVING: )\n");
+    printf("    Batch=<1..64>        ( max frames fetched by one receive call, default 64 )\n");
+    printf("    HwTimestamps         ( use adapter receive timestamps, mapped to system time by a drift model )\n");
+    printf("                         ( fitted to PHC cross timestamps or to least delayed frame of each second )\n");
+    printf("    HwTimestamps=<ptp>   ( same with PTP clock of adapter given, like HwTimestamps=/dev/ptp1 )\n");
+    printf("    DataFrames           ( also receive classic, CAN FD and CAN XL data frames, printed and )\n");
+    printf("                         ( captured with their real length, CAN XL needs interface mtu 2060 )\n");
+    printf("    KernelLog            ( also read driver messages of kernel log naming the interfaces, like )\n");
+    printf("                         ( bus-off, restart or FIFO overrun, merged into errors by time )\n");
+    printf("                         ( OUTPUT: )\n");
+    printf("                         ( OutputDir, Journal, Mqtt, Sqlite and Bridge replace stdout, lines are )\n");
+    printf("                         ( printed only without all of them, Capture, Dashboard, Load, Expect )\n");
+    printf("                         ( and Incident work next to stdout or any of them )\n");
+    printf("    Format=<template>    ( print only chosen fields, for example Format=\"%%ts %%if %%id %%class %%loc %%tec/%%rec\" )\n");
+    printf("                         ( %%ts time, %%if interface, %%id CAN ID, %%dlc length, %%data bytes, %%err all errors, )\n");
+    printf("                         ( %%class error classes, %%ctrl controller, %%prot protocol type, %%loc location, )\n");
+    printf("                         ( %%trx transceiver, %%arb lost arbitration bit, %%tec/%%rec error counters, %%%% for %% )\n");
+    printf("    OutputDir=<dir>      ( write errors of each interface to <dir>/<interface>.log instead of stdout, )\n");
+    printf("                         ( every file has its own writer thread, when a file falls behind its )\n");
+    printf("                         ( lines are dropped and counted instead of stalling other interfaces )\n");
+    printf("    OutputRing=<4..1024> ( KiB buffered for each OutputDir writer, power of 2, default %d )\n",
+           SHARD_RING_SIZE / 1024);
+    printf("    Journal              ( send structured entries to systemd journal instead of stdout, fields )\n");
+    printf("                         ( CAN_IFACE, CAN_ERR_CLASS, CAN_ERR_LOC, CAN_TEC... can be queried )\n");
+    printf("    JournalRate=<0..100000> ( max journal entries per second, 0 is unlimited, default 1000 )\n");
+    printf("    JournalSocket=<path> ( journald native socket, default %s )\n", JOURNAL_SOCKET);
+    printf("    Mqtt=<host>[:<port>] ( publish BusOff and Trans errors at once to <topic>/<interface>/event, )\n");
+    printf("                         ( others as JSON summary per interval to <topic>/<interface>/summary, )\n");
+    printf("                         ( instead of stdout )\n");
+    printf("    MqttTopic=<prefix>   ( MQTT topic prefix, default canerr )\n");
+    printf("    MqttQos=<0..1>       ( MQTT quality of service, 1 keeps messages until broker acknowledges )\n");
+    printf("    MqttInterval=<1..3600> ( MQTT summary interval in seconds, default 10 )\n");
+    printf("    MqttQueue=<1..100000> ( MQTT messages kept while broker is offline, default 1000 )\n");
+    printf("    Sqlite=<file>        ( store decoded errors in table errors of SQLite database in WAL mode )\n");
+    printf("                         ( instead of printing them to stdout, )\n");
+    printf("                         ( query it while canerrdump runs, needs libsqlite3 )\n");
+    printf("    SqliteBatch=<1..1000000> ( rows per transaction, default %d )\n", SQLITE_BATCH);
+    printf("    SqliteFlush=<10..60000> ( ms after which transaction is committed anyway, default %d )\n", SQLITE_FLUSH_MS);
+    printf("    Dashboard=[<host>:]<port> ( serve live dashboard page, browsers get per class rates, error )\n");
+    printf("                         ( states and top error signatures, only changes are pushed, host )\n");
+    printf("                         ( is localhost if not given, 0.0.0.0 opens it to the network )\n");
+    printf("    DashboardInterval=<100..60000> ( ms between dashboard pushes, default 1000 )\n");
+    printf("    Bridge=<host>[:<port>] ( forward errors, and data frames with DataFrames, in batched UDP )\n");
+    printf("                         ( datagrams to canerrsim Bridge= on host instead of stdout, default )\n");
+    printf("                         ( port %s )\n", CANERR_BRIDGE_PORT);
+    printf("    Capture=<file>       ( also write binary capture with O_DIRECT, bypassing page cache, )\n");
+    printf("                         ( decode it later with: canerrdump Read=<file> )\n");
+    printf("    CaptureBlock=<64..256> ( capture block size in KiB, multiple of 4, default 128 )\n");
+    printf("    CaptureFlush=<10..60000> ( ms after which partially filled block is written, so Follow= )\n");
+    printf("                         ( readers see records, default %d )\n", CAPTURE_FLUSH_MS);
+    printf("                         ( STATISTICS: )\n");
+    printf("    BpfStats=<1..3600>   ( count errors per class and sub code in kernel with eBPF, no frames are )\n");
+    printf("                         ( copied to canerrdump, print counters every given seconds, needs root )\n");
+    printf("    Load=<1..3600>       ( every given seconds print frames/s, estimated bus load and errors per )\n");
+    printf("                         ( 1000 frames of each interface from netdev and CAN core counters, no )\n");
+    printf("                         ( data frames are received, with BpfStats it uses that interval )\n");
+    printf("                         ( SEQUENCE ASSERTIONS: )\n");
+    printf("    Expect=<pattern>     ( match error sequence on each interface, items are error names like )\n");
+    printf("                         ( BusOff, WarningTX, Prot(Bit0,DATA) or Any, each optionally followed )\n");
+    printf("                         ( by {n}, {n,}, {n,m}, ?, * or +, pattern may end with within <n>ms, )\n");
+    printf("                         ( prints EXPECT match, violated (with first wrong frame) or timeout, )\n");
+    printf("                         ( exit code is 0 only if something matched and nothing failed, )\n");
+    printf("                         ( not with BpfStats which receives no frames )\n");
+    printf("    ExpectOnce           ( stop after first verdict of Expect, exit code 0 on match )\n");
+    printf("                         ( INCIDENTS: )\n");
+    printf("    Incident=<dir>       ( keep received errors, data frames and kernel messages of last seconds )\n");
+    printf("                         ( in RAM, on a trigger error write what happened before and after it )\n");
+    printf("                         ( to <dir>/incident-<time>-<interface>.cap, decode with Read=, its )\n");
+    printf("                         ( header note tells trigger, TEC/REC and kernel drops )\n");
+    printf("    IncidentPre=<1..3600> ( seconds kept before trigger, default 10 )\n");
+    printf("    IncidentPost=<0..3600> ( seconds recorded after trigger, default 5 )\n");
+    printf("    IncidentTrigger=<names> ( error names as in Expect, any of them triggers, default \"BusOff Trans\" )\n");
+    printf("    IncidentRing=<64..1048576> ( RAM ring in KiB, default 8192, oldest records go first )\n");
+    printf("                         ( POWER: )\n");
+    printf("    Coalesce=<1..1000>   ( adaptive receive: block per frame while traffic is sparse, under load )\n");
+    printf("                         ( drain all sockets every given ms instead, kernel queues buffer frames )\n");
+    printf("                         ( meanwhile, fewer wakeups for up to that much delay, reported at exit )\n");
+    printf("    CoalesceEnter=<1..1000000> ( records/s from which draining starts, default 200 )\n");
+    printf("    CoalesceLeave=<1..1000000> ( records/s below which every frame wakes up again, default 50 )\n");
+    printf("                         ( MEMORY: )\n");
+    printf("    Footprint            ( size every ring, queue and block buffer at start from options, never )\n");
+    printf("                         ( allocate after start, lock buffers in RAM and print exact footprint )\n");
     printf("                         ( DEBUG HELPERS: )\n");
     printf("    ShowBits             ( display all error filtering bits )\n");
     printf("\n");
@@ -67,6 +230,51 @@ void show_help_and_exit() {
     printf("    ./canerrdump vcan0 IgnoreNoAck IgnoreBusOff\n");
     printf("    ( dump all CAN error messages from virtual CAN interface vcan0 except NoACk and BusOff)\n");
     printf("\n");
+    printf("    ./canerrdump can0,can1,can2\n");
+    printf("    ( dump all CAN error messages from three CAN interfaces, each line starts with interface name )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 KernelLog\n");
+    printf("    ( errors and driver messages of can0 in one timeline, no need to align dmesg separately )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Capture=can0.cap\n");
+    printf("    ( dump all CAN error messages from can0 and capture them to binary file can0.cap )\n");
+    printf("\n");
+    printf("    ./canerrdump Follow=can0.cap IgnoreCounters\n");
+    printf("    ( decode can0.cap while canerrdump still captures to it, without opening a CAN socket )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Journal\n");
+    printf("    ( send CAN errors to systemd journal, then: journalctl CAN_IFACE=can0 CAN_ERR_CLASS=BusOff )\n");
+    printf("\n");
+    printf("    ./canerrdump can0,can1 Mqtt=localhost MqttQos=1 MqttInterval=60\n");
+    printf("    ( publish errors to local broker, then: mosquitto_sub -t 'canerr/#' -v )\n");
+    printf("\n");
+    printf("    ./canerrdump can0,can1 Sqlite=canerr.db\n");
+    printf("    ( store errors, then: sqlite3 canerr.db \"SELECT iface, class, count(*) FROM errors GROUP BY 1, 2\" )\n");
+    printf("\n");
+    printf("    ./canerrdump can0,can1 Dashboard=%s\n", DASH_PORT);
+    printf("    ( print errors and serve dashboard, then open http://localhost:%s/ in browser )\n", DASH_PORT);
+    printf("\n");
+    printf("    ./canerrdump can0 Coalesce=50 Journal\n");
+    printf("    ( battery powered gateway: during error storms wake up 20 times per second, not per frame )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Footprint MqttQueue=100 Mqtt=localhost\n");
+    printf("    ( monitor on small gateway, memory fixed at start and reported )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Bridge=labpc DataFrames\n");
+    printf("    ( forward errors and data frames of can0 to labpc, there: ./canerrsim vcan0 Bridge=%s )\n", CANERR_BRIDGE_PORT);
+    printf("\n");
+    printf("    ./canerrdump can0,can1 BpfStats=10\n");
+    printf("    ( count all CAN errors of two interfaces in kernel and show new ones every 10 seconds )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Expect=\"WarningTX Prot(Bit0,DATA){3,} PassiveTX BusOff within 500ms\" ExpectOnce\n");
+    printf("    ( HIL test step: exit code 0 if bus off followed the expected escalation in time )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 DataFrames KernelLog Incident=/var/log/can IncidentPre=30\n");
+    printf("    ( field vehicle: on bus off or transceiver fault store last 30 s and next 5 s of can0 )\n");
+    printf("\n");
+    printf("    ./canerrdump can0 Load=5\n");
+    printf("    ( print errors and every 5 seconds the traffic they happened in, like 3.1 per 1000 frames )\n");
+    printf("\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -83,216 +291,4179 @@ void print_binary(uint32_t number) {
     }
 }
 
-void remove_trailing_comma(char *str) {
-    size_t len = strlen(str);
-    if (len > 0 && str[len - 1] == ',')
-        str[len - 1] = '\0';   // replace the last character with the null terminator to shorten the string
+// parse "Name=<number>" option, returns false if arg is some other option
+bool parse_number_option(const char *arg, const char *name, long min, long max, long *value) {
+    size_t len = strlen(name);
+    char *end;
+    if (strncasecmp(arg, name, len) != STR_EQUAL || arg[len] != '=')
+        return false;
+    *value = strtol(arg + len + 1, &end, 0);
+    if (end == arg + len + 1 || *end != '\0' || *value < min || *value > max) {
+        printf("Error: Invalid value in option %s ( allowed %ld..%ld )\n", arg, min, max);
+        exit(EXIT_FAILURE);
+    }
+    return true;
 }
 
+// "host", "host:port", "[ipv6]:port" or plain ipv6 address, splits address in place
+void split_host_port(char *address, const char **host, const char **port, const char *default_port) {
+    char *colon;
 
+    if (address[0] == '[' && (colon = strchr(address, ']')) != NULL) {
+        *host = address + 1;
+        *colon++ = '\0';
+        *port = *colon == ':' ? colon + 1 : default_port;
+    } else if ((colon = strrchr(address, ':')) != NULL && strchr(address, ':') == colon) {
+        *colon = '\0';
+        *host = address;
+        *port = colon + 1;
+    } else {
+        *host = address;
+        *port = default_port;
+    }
+}
 
-int main(int argc, char *argv[]) {
-    int sock;
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_frame frame;
-    // struct can_filter filter;
-    can_err_mask_t errmask;
-    bool show_bits = false;
-    char err_str[1024];
-    char buf[256];
+// HwTimestamps: state of clock model of every interface
+void clock_report(const struct canerr_stream *s) {
+    for (int i = 0; i < s->count; i++) {
+        const struct canerr_clockmap *m = &s->clocks[i];
+        if (m->samples == 0)
+            fprintf(stderr, "%s: no hardware timestamps received\n", s->ifnames[i]);
+        else
+            fprintf(stderr, "%s: hardware clock mapped by %s, %llu samples, drift %.3f ppm, last residual %.0f ns\n",
+                    s->ifnames[i], m->phc_fd >= 0 ? "PHC" : "frame timestamps", (unsigned long long)m->samples,
+                    m->drift / 1000, m->residual);
+    }
+}
 
-    printf("CAN Sockets Error Messages Dumper\n");
-    if (argc < 2)
-        show_help_and_exit();
+// Coalesce: wakeups saved and delivery delay paid for them
+void coalesce_report(struct canerr_stream *s, uint64_t run_ns) {
+    if (s->coalescing)                              // count periodic draining up to now
+        s->coalesced_ns += canerr_monotonic_ns() - s->coalesce_since_ns;
+    fprintf(stderr, "Adaptive receive: %llu records in %llu wakeups (%.1f per wakeup), drained periodically "
+            "%.1f of %.1f s, %llu switches\n", (unsigned long long)s->woken_records, (unsigned long long)s->wakeups,
+            s->wakeups ? (double)s->woken_records / s->wakeups : 0, (double)s->coalesced_ns / 1e9, (double)run_ns / 1e9,
+            (unsigned long long)s->switches);
+    if (s->delayed > 0)
+        fprintf(stderr, "Delay of periodically drained records: average %.3f ms, maximum %.3f ms\n",
+                (double)s->delay_sum_ns / s->delayed / 1e6, (double)s->delay_max_ns / 1e6);
+}
 
-    //filter.can_id = CAN_INV_FILTER;
+void stop_handler(int sig) {
+    (void)sig;
+    canerr_stream_cancel(&stream);                          // main loop ends after current batch
+}
 
-    errmask       = CAN_ERR_FLAG   // include only error frames
-                  | CAN_ERR_MASK;  // show all possible error frames
+// format one record as "0x040 [8] 00 00 00 00 00 00 00 00  ERR=..." line, returns its length
+size_t format_record(const struct canerr_record *rec, bool show_ifname, char *out, size_t size) {
+    const struct can_frame *frame = &rec->frame;
+    size_t len = 0;
+    int dlc = frame->can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->can_dlc;
 
-    if (argc >= 3) {               // Parse command line parameters
-        for (size_t i = 2; i < argc; i++) {
-            // str_to_upper(argv[i]);
-            if (strcasecmp(argv[i], "IgnoreTxTimeout")        == STR_EQUAL)
-                errmask &= ~CAN_ERR_TX_TIMEOUT; // Exclude TxTimeout errors
-            else if (strcasecmp(argv[i], "IgnoreLostArbit")   == STR_EQUAL)
-                errmask &= ~CAN_ERR_LOSTARB;   // Exclude LostArbitration errors
-            else if (strcasecmp(argv[i], "IgnoreController")  == STR_EQUAL)
-                errmask &= ~CAN_ERR_CRTL;      // Exclude Controller errors
-            else if (strcasecmp(argv[i], "IgnoreProtocol")    == STR_EQUAL)
-                errmask &= ~CAN_ERR_PROT;      // Exclude Protocol errors
-            else if (strcasecmp(argv[i], "IgnoreTransveiver") == STR_EQUAL)
-                errmask &= ~CAN_ERR_TRX;       // Exclude Transceiver errors
-            else if (strcasecmp(argv[i], "IgnoreNoAck")       == STR_EQUAL)
-                errmask &= ~CAN_ERR_ACK;       // Exclude NoAck errors
-            else if (strcasecmp(argv[i], "IgnoreBusOff")      == STR_EQUAL)
-                errmask &= ~CAN_ERR_BUSOFF;    // Exclude BusOff errors
-            else if (strcasecmp(argv[i], "IgnoreBusError")    == STR_EQUAL)
-                errmask &= ~CAN_ERR_BUSERROR;  // Exclude BusError errors
-            else if (strcasecmp(argv[i], "IgnoreRestarted")   == STR_EQUAL)
-                errmask &= ~CAN_ERR_RESTARTED; // Exclude Restarted errors
-            else if (strcasecmp(argv[i], "IgnoreCounters")    == STR_EQUAL)
-                errmask &= ~CAN_ERR_CNT;       // Exclude TX and RX counter errors
-            else if (strcasecmp(argv[i], "ShowBits")          == STR_EQUAL)
-                show_bits = true;              // Display all error mask filtering bits
-            else {
-                printf("Error: Invalid option: %s\n", argv[i]);
-                //show_help_and_exit();
-                exit(EXIT_SUCCESS);
+    if (show_ifname)
+        canerr_append(out, size, &len, "%s ", rec->ifname);
+    if (frame->can_id & CAN_EFF_FLAG) // extended or standard frame
+        canerr_append(out, size, &len, "0x%08X [%d] ", frame->can_id & CAN_ERR_MASK, frame->can_dlc);
+    else
+        canerr_append(out, size, &len, "0x%03X [%d] ", frame->can_id & CAN_ERR_MASK, frame->can_dlc);
+    for (int i = 0; i < dlc; i++)
+        canerr_append(out, size, &len, "%02X ", frame->data[i]);
+    canerr_append(out, size, &len, " ERR=");
+    if (len < size)
+        len += canerr_decode(frame, out + len, size - len);
+    canerr_append(out, size, &len, "\n");
+    return len;
+}
+
+// DataFrames: "0x123 [8] 11 22..", "0x123 [64] FD 11 22.." or "0x123 [2048] XL SDT=03 AF=00000000 11 22.."
+size_t format_data_record(const struct canerr_record *rec, bool show_ifname, char *out, size_t size) {
+    const uint8_t *data = rec->frame.data;
+    size_t len = 0;
+    int dlen = rec->frame.can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : rec->frame.can_dlc;
+
+    if (show_ifname)
+        canerr_append(out, size, &len, "%s ", rec->ifname);
+    if (rec->type == CANERR_FRAME_XL) {
+        const struct canxl_frame *xl = (const struct canxl_frame *)rec->raw;
+        canerr_append(out, size, &len, "0x%03X [%d] XL SDT=%02X AF=%08X%s ", xl->prio & CANXL_PRIO_MASK,
+                      xl->len, xl->sdt, xl->af, (xl->flags & CANXL_SEC) ? " SEC" : "");
+        data = xl->data;
+        dlen = xl->len;
+    } else {
+        canid_t id = rec->frame.can_id;
+        if (rec->type == CANERR_FRAME_FD) {
+            data = ((const struct canfd_frame *)rec->raw)->data;
+            dlen = ((const struct canfd_frame *)rec->raw)->len;
+        }
+        canerr_append(out, size, &len, (id & CAN_EFF_FLAG) ? "0x%08X [%d] %s" : "0x%03X [%d] %s",
+                      id & CAN_EFF_MASK, dlen, rec->type == CANERR_FRAME_FD ? "FD " : "");
+    }
+    for (int i = 0; i < dlen && i < DATA_PRINT_MAX; i++)
+        canerr_append(out, size, &len, "%02X ", data[i]);
+    if (dlen > DATA_PRINT_MAX)
+        canerr_append(out, size, &len, "..");
+    canerr_append(out, size, &len, "\n");
+    return len;
+}
+
+// KernelLog: "KMSG BusOff   mcp251x spi0.0 can0: bus-off" line of a driver message
+size_t format_kmsg_record(const struct canerr_record *rec, bool show_ifname, char *out, size_t size) {
+    int kind = rec->frame.data[0] < CANERR_COUNT(canerr_kmsg_kind_names) ? rec->frame.data[0] : CANERR_KMSG_OTHER;
+    size_t len = 0;
+
+    if (show_ifname)
+        canerr_append(out, size, &len, "%s ", rec->ifname);
+    canerr_append(out, size, &len, "KMSG %-8s %.*s\n", canerr_kmsg_kind_names[kind], (int)rec->len, (const char *)rec->raw);
+    return len;
+}
+
+// Output template (Format=...) is compiled once into a list of ops, executed for every record
+enum format_op_type {
+    FMT_LITERAL, FMT_TS, FMT_IF, FMT_ID, FMT_DLC, FMT_DATA, FMT_ERR, FMT_CLASS,
+    FMT_CTRL, FMT_PROT, FMT_LOC, FMT_TRX, FMT_ARB, FMT_TEC, FMT_REC
+};
+
+struct format_op {
+    enum format_op_type type;
+    const char *text;                               // FMT_LITERAL only
+    int len;
+};
+
+struct format_field {
+    const char *name;
+    enum format_op_type type;
+};
+
+const struct format_field format_fields[] = {
+    { "ts",    FMT_TS },    { "if",    FMT_IF },    { "id",    FMT_ID },    { "dlc",   FMT_DLC },
+    { "data",  FMT_DATA },  { "err",   FMT_ERR },   { "class", FMT_CLASS }, { "ctrl",  FMT_CTRL },
+    { "prot",  FMT_PROT },  { "loc",   FMT_LOC },   { "trx",   FMT_TRX },   { "arb",   FMT_ARB },
+    { "tec",   FMT_TEC },   { "rec",   FMT_REC },
+};
+
+struct format_op format_ops[FORMAT_MAX_OPS];
+int format_op_count = 0;                            // 0 means default line format
+
+void add_format_op(enum format_op_type type, const char *text, int len) {
+    if (format_op_count >= FORMAT_MAX_OPS) {
+        printf("Error: Format has more than %d fields and texts\n", FORMAT_MAX_OPS);
+        exit(EXIT_FAILURE);
+    }
+    format_ops[format_op_count].type = type;
+    format_ops[format_op_count].text = text;
+    format_ops[format_op_count].len  = len;
+    format_op_count++;
+}
+
+// compile template like "%ts %if %id %class %loc %tec/%rec", literal ops point into template itself
+void compile_format(const char *template) {
+    const char *p = template;
+    format_op_count = 0;
+    while (*p) {
+        const struct format_field *field = NULL;
+        const char *start = p;
+        while (*p && *p != '%')
+            p++;
+        if (p > start)
+            add_format_op(FMT_LITERAL, start, p - start);
+        if (*p == '\0')
+            break;
+        if (p[1] == '%') {                          // "%%" is a literal percent sign
+            add_format_op(FMT_LITERAL, p, 1);
+            p += 2;
+            continue;
+        }
+        for (size_t i = 0; i < CANERR_COUNT(format_fields); i++)   // longest matching field name wins
+            if (strncasecmp(p + 1, format_fields[i].name, strlen(format_fields[i].name)) == STR_EQUAL &&
+                (field == NULL || strlen(format_fields[i].name) > strlen(field->name)))
+                field = &format_fields[i];
+        if (field == NULL) {
+            printf("Error: Unknown field in Format at: %s\n", p);
+            exit(EXIT_FAILURE);
+        }
+        add_format_op(field->type, NULL, 0);
+        p += 1 + strlen(field->name);
+    }
+    if (format_op_count == 0)
+        add_format_op(FMT_LITERAL, "", 0);           // empty template still prints one line per record
+}
+
+// run compiled template for one record, returns length of line
+size_t format_template(const struct canerr_record *rec, char *out, size_t size) {
+    const struct can_frame *frame = &rec->frame;
+    int dlc = frame->can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->can_dlc;
+    size_t len = 0;
+
+    for (int i = 0; i < format_op_count; i++) {
+        const struct format_op *op = &format_ops[i];
+        switch (op->type) {
+        case FMT_LITERAL:
+            canerr_append(out, size, &len, "%.*s", op->len, op->text);
+            break;
+        case FMT_TS:
+            canerr_append(out, size, &len, "%lld.%06ld", (long long)rec->timestamp.tv_sec, rec->timestamp.tv_nsec / 1000);
+            break;
+        case FMT_IF:
+            canerr_append(out, size, &len, "%s", rec->ifname);
+            break;
+        case FMT_ID:
+            canerr_append(out, size, &len, (frame->can_id & CAN_EFF_FLAG) ? "0x%08X" : "0x%03X", frame->can_id & CAN_ERR_MASK);
+            break;
+        case FMT_DLC:
+            canerr_append(out, size, &len, "%d", frame->can_dlc);
+            break;
+        case FMT_DATA:
+            for (int b = 0; b < dlc; b++)
+                canerr_append(out, size, &len, b ? " %02X" : "%02X", frame->data[b]);
+            break;
+        case FMT_ERR:
+            if (len < size)
+                len += canerr_decode(frame, out + len, size - len);
+            break;
+        case FMT_CLASS: {
+            const char *sep = "";
+            for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+                if (frame->can_id & (1U << bit)) {
+                    canerr_append(out, size, &len, "%s%s", sep, canerr_class_bit_names[bit]);
+                    sep = ",";
+                }
+            if (*sep == '\0')
+                canerr_append(out, size, &len, "-");
+            break;
+        }
+        case FMT_CTRL:
+            if (frame->can_id & CAN_ERR_CRTL)
+                canerr_append_bits(out, size, &len, CANERR_SUB_CTRL, frame->data[1]);
+            else
+                canerr_append(out, size, &len, "-");
+            break;
+        case FMT_PROT:
+            if (frame->can_id & CAN_ERR_PROT)
+                canerr_append_bits(out, size, &len, CANERR_SUB_PROT, frame->data[2]);
+            else
+                canerr_append(out, size, &len, "-");
+            break;
+        case FMT_LOC:
+            canerr_append(out, size, &len, "%s", (frame->can_id & CAN_ERR_PROT) ? canerr_code_name(CANERR_SUB_LOC, frame->data[3]) : "-");
+            break;
+        case FMT_TRX:
+            canerr_append(out, size, &len, "%s", (frame->can_id & CAN_ERR_TRX) ? canerr_code_name(CANERR_SUB_TRX, frame->data[4]) : "-");
+            break;
+        case FMT_ARB:
+            canerr_append(out, size, &len, (frame->can_id & CAN_ERR_LOSTARB) ? "%d" : "-", frame->data[0]);
+            break;
+        case FMT_TEC:
+            canerr_append(out, size, &len, (frame->can_id & CAN_ERR_CNT) ? "%d" : "-", frame->data[6]);
+            break;
+        case FMT_REC:
+            canerr_append(out, size, &len, (frame->can_id & CAN_ERR_CNT) ? "%d" : "-", frame->data[7]);
+            break;
+        }
+    }
+    canerr_append(out, size, &len, "\n");
+    return len;
+}
+
+// format one record with Format template if given, otherwise with default line format
+size_t format_line(const struct canerr_record *rec, bool show_ifname, char *out, size_t size) {
+    if (rec->type == CANERR_FRAME_KMSG)
+        return format_kmsg_record(rec, show_ifname, out, size);
+    if (rec->type != CANERR_FRAME_ERROR)
+        return format_data_record(rec, show_ifname, out, size);
+    if (format_op_count > 0)
+        return format_template(rec, out, size);
+    return format_record(rec, show_ifname, out, size);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Footprint profile for small gateways: every ring, queue and block buffer comes from one       //
+//  arena, reserved at start, filled while options are applied, then trimmed to the used part,    //
+//  touched and locked. Helper threads get fixed stacks. After start nothing is allocated any     //
+//  more, so memory of canerrdump stays exactly what the startup report shows.                    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct footprint_part {
+    const char *what;
+    size_t size;
+};
+
+struct footprint {
+    bool active;
+    bool sealed;                                    // start finished, allocating is a bug now
+    bool locked;                                    // arena is mlock()ed
+    char *arena;
+    size_t used;
+    int threads;
+    int part_count;
+    struct footprint_part parts[FOOTPRINT_MAX_PARTS];
+    size_t heap_at_seal;                            // libc heap in use when start finished
+};
+
+struct footprint footprint;
+
+void footprint_open(struct footprint *f) {
+    f->arena = mmap(NULL, FOOTPRINT_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (f->arena == MAP_FAILED)
+        err_exit("Error reserving footprint arena");
+    f->active = true;
+}
+
+// zeroed buffer for whole run time, aligned to power of 2, from arena in footprint profile
+void *footprint_alloc(size_t size, size_t align, const char *what) {
+    struct footprint *f = &footprint;
+    size_t offset = (f->used + align - 1) & ~(align - 1);
+    void *ptr;
+    int i;
+
+    if (!f->active) {
+        if (posix_memalign(&ptr, align < sizeof(void *) ? sizeof(void *) : align, size) != 0)
+            return NULL;
+        return memset(ptr, 0, size);
+    }
+    if (f->sealed) {
+        fprintf(stderr, "Error: %s allocated after start in footprint profile\n", what);
+        abort();
+    }
+    if (offset + size > FOOTPRINT_RESERVE)
+        return NULL;
+    for (i = 0; i < f->part_count && f->parts[i].what != what; i++)
+        ;                                           // same kind of buffer, like rings of all interfaces
+    if (i == f->part_count && f->part_count < FOOTPRINT_MAX_PARTS)
+        f->parts[f->part_count++].what = what;
+    if (i < FOOTPRINT_MAX_PARTS)
+        f->parts[i].size += size;
+    f->used = offset + size;
+    return memset(f->arena + offset, 0, size);      // touch pages, so they count as resident now
+}
+
+void footprint_free(void *ptr) {
+    if (!footprint.active)
+        free(ptr);
+}
+
+// helper thread, with fixed stack in footprint profile
+int footprint_thread(pthread_t *thread, void *(*start)(void *), void *arg) {
+    pthread_attr_t attr;
+    int ret;
+
+    if (!footprint.active)
+        return pthread_create(thread, NULL, start, arg);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, FOOTPRINT_STACK_SIZE);
+    if ((ret = pthread_create(thread, &attr, start, arg)) == 0)
+        footprint.threads++;
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  OutputDir mode: every interface has its own file and writer thread. Main thread formats lines //
+//  into a single producer / single consumer lock free byte ring per interface and wakes writer   //
+//  once per batch, so interfaces never contend for one fd or lock. A full ring never blocks the  //
+//  main thread: lines of that interface are dropped and counted, a marker line in its file tells //
+//  how many once there is room again.                                                            //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct shard {
+    int fd;                                         // output file of one interface
+    int wake_fd;                                    // eventfd, written by main thread after each batch
+    pthread_t thread;
+    _Atomic uint64_t head;                          // bytes ever written to ring, only main thread stores
+    _Atomic uint64_t tail;                          // bytes ever written to file, only writer thread stores
+    _Atomic bool stopping;
+    bool pending;                                   // main thread pushed data since last wake up
+    uint64_t bytes;                                 // total bytes written, for final report
+    uint64_t dropped;                               // lines dropped because ring was full, not marked yet
+    uint64_t dropped_total;
+    char ifname[IF_NAMESIZE];
+    char *ring;                                     // shard_ring_size bytes
+};
+
+struct shard *shards[CANERR_MAX_INTERFACES];
+int shard_count = 0;
+size_t shard_ring_size = SHARD_RING_SIZE;
+
+void *shard_writer(void *arg) {
+    struct shard *sh = arg;
+    uint64_t wakeups;
+
+    while (1) {
+        uint64_t tail = atomic_load_explicit(&sh->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&sh->head, memory_order_acquire);
+        if (head == tail) {
+            if (atomic_load_explicit(&sh->stopping, memory_order_acquire) &&
+                head == atomic_load_explicit(&sh->head, memory_order_acquire))
+                break;
+            if (read(sh->wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR)
+                break;
+            continue;
+        }
+        while (tail != head) {                      // write contiguous chunk up to ring end or head
+            size_t offset = tail & (shard_ring_size - 1);
+            size_t chunk  = shard_ring_size - offset;
+            ssize_t written;
+            if (chunk > head - tail)
+                chunk = head - tail;
+            if ((written = write(sh->fd, sh->ring + offset, chunk)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("Error writing output file");
+                written = chunk;                    // drop chunk, keep draining so main never blocks forever
             }
+            tail += written;
+            sh->bytes += written;
+            atomic_store_explicit(&sh->tail, tail, memory_order_release);
         }
     }
+    return NULL;
+}
 
-    if (show_bits == true) {
-        //printf("filter.can_id = ");
-        //print_binary(filter.can_id);
-        //printf("\n");
-        printf("Error Mask = ");
-        print_binary(errmask);        
-        printf("\n");
+// copy bytes to ring at head, caller checked space
+void shard_copy(struct shard *sh, uint64_t head, const char *data, size_t len) {
+    size_t offset = head & (shard_ring_size - 1);
+    size_t first  = shard_ring_size - offset < len ? shard_ring_size - offset : len;
+
+    memcpy(sh->ring + offset, data, first);
+    memcpy(sh->ring, data + first, len - first);
+}
+
+// copy one line to ring of shard, drops it when ring is full, so one slow file never stalls the
+// receive loop of all interfaces
+void shard_push(struct shard *sh, const char *line, size_t len) {
+    uint64_t head = atomic_load_explicit(&sh->head, memory_order_relaxed);
+    uint64_t used = head - atomic_load_explicit(&sh->tail, memory_order_acquire);
+    char mark[96];
+    int mark_len = 0;
+
+    if (sh->dropped > 0)
+        mark_len = snprintf(mark, sizeof(mark), "# %llu lines dropped, output file was slower than bus\n",
+                            (unsigned long long)sh->dropped);
+    if (used + mark_len + len > shard_ring_size) {
+        sh->dropped++;
+        sh->dropped_total++;
+        sh->pending = true;                         // writer may still sleep, wake it with this batch
+        return;
     }
-    
-    // create socket
-    if ((sock = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) 
-        err_exit("Error while opening socket");
-
-    // set interface name
-    strcpy(ifr.ifr_name, can_interface_name); // can0, vcan0...
-    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
-        sprintf(buf, "Error setting CAN interface name %s", can_interface_name);        
+    if (mark_len > 0) {
+        shard_copy(sh, head, mark, mark_len);
+        head += mark_len;
+        sh->dropped = 0;
+    }
+    shard_copy(sh, head, line, len);
+    atomic_store_explicit(&sh->head, head + len, memory_order_release);
+    sh->pending = true;
+}
+
+// wake writer threads which got new lines in this batch, one eventfd write per shard and batch
+void shard_wake_all(void) {
+    uint64_t one = 1;
+    for (int i = 0; i < shard_count; i++)
+        if (shards[i]->pending) {
+            shards[i]->pending = false;
+            if (write(shards[i]->wake_fd, &one, sizeof(one)) < 0)
+                perror("Error waking output writer");
+        }
+}
+
+// open <dir>/<interface>.log for every interface of stream and start its writer thread
+void shard_open_all(const char *dir, struct canerr_stream *s) {
+    char path[PATH_MAX];
+
+    for (int i = 0; i < s->count; i++) {
+        struct shard *sh = footprint_alloc(sizeof(struct shard), 64, "output writers");
+        if (sh == NULL || (sh->ring = footprint_alloc(shard_ring_size, 64, "output rings")) == NULL)
+            err_exit("Error allocating output ring");
+        snprintf(path, sizeof(path), "%s/%s.log", dir, s->ifnames[i]);
+        memcpy(sh->ifname, s->ifnames[i], IF_NAMESIZE);
+        if ((sh->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+            char buf[PATH_MAX + 64];
+            snprintf(buf, sizeof(buf), "Error opening output file %s", path);
+            err_exit(buf);
+        }
+        if ((sh->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+            err_exit("Error creating output writer eventfd");
+        if ((errno = footprint_thread(&sh->thread, shard_writer, sh)) != 0)
+            err_exit("Error starting output writer thread");
+        shards[shard_count++] = sh;
+    }
+}
+
+// let writers drain their rings, then join them and close files
+void shard_close_all(void) {
+    uint64_t one = 1;
+    for (int i = 0; i < shard_count; i++) {
+        atomic_store_explicit(&shards[i]->stopping, true, memory_order_release);
+        if (write(shards[i]->wake_fd, &one, sizeof(one)) < 0)
+            perror("Error waking output writer");
+    }
+    for (int i = 0; i < shard_count; i++) {
+        pthread_join(shards[i]->thread, NULL);
+        if (shards[i]->dropped_total > 0)
+            fprintf(stderr, "Output file of %s dropped %llu lines, it was slower than bus (raise OutputRing)\n",
+                    shards[i]->ifname, (unsigned long long)shards[i]->dropped_total);
+        close(shards[i]->wake_fd);
+        close(shards[i]->fd);
+        footprint_free(shards[i]->ring);
+        footprint_free(shards[i]);
+    }
+    shard_count = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Journal mode: structured entries sent over journald native protocol (KEY=value lines in one    //
+//  datagram per entry), all entries of a batch with one sendmmsg() call. CAN_IFACE, CAN_ERR_CLASS, //
+//  CAN_ERR_LOC, CAN_TEC... are indexed by journald, so journalctl CAN_ERR_CLASS=BusOff is fast.    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct journal {
+    int fd;                                         // datagram socket connected to journald
+    long rate;                                      // entries per second, 0 means unlimited
+    int send_flags;                                 // MSG_DONTWAIT while receiving live
+    double tokens;                                  // token bucket, burst of one second
+    uint64_t refill_ns;
+    uint64_t suppressed;                            // entries dropped by rate limit, not reported yet
+    uint64_t sent;
+    uint64_t suppressed_total;
+    char entries[CANERR_MAX_BATCH + 1][JOURNAL_ENTRY_SIZE];
+    struct iovec iovs[CANERR_MAX_BATCH + 1];
+    struct mmsghdr msgs[CANERR_MAX_BATCH + 1];
+};
+
+struct journal journal = { .fd = -1 };
+
+// connect to journald, wait selects blocking sends (replaying capture) over dropping (live bus)
+void journal_open(struct journal *j, const char *path, long rate, bool wait) {
+    struct sockaddr_un addr;
+    char buf[PATH_MAX + 64];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Journal socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    if ((j->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        err_exit("Error while opening journal socket");
+    if (connect(j->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        snprintf(buf, sizeof(buf), "Error connecting to journal socket %s", path);
         err_exit(buf);
     }
+    j->rate       = rate;
+    j->send_flags = wait ? 0 : MSG_DONTWAIT;
+    j->tokens     = rate;
+    j->refill_ns  = canerr_now_ns();
+}
 
-    // bind socket to the CAN interface
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-        err_exit("Error in socket bind");
-    
-    //setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER,     &filter,  sizeof(filter));
-    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errmask, sizeof(errmask));
+// syslog priority: bus off and transceiver faults are errors, degraded controller states warnings
+int journal_priority(const struct can_frame *frame) {
+    if (frame->can_id & (CAN_ERR_BUSOFF | CAN_ERR_TRX))
+        return 3;
+    if (frame->can_id & (CAN_ERR_CRTL | CAN_ERR_TX_TIMEOUT | CAN_ERR_ACK))
+        return 4;
+    return 5;
+}
 
-    printf("Listening CAN bus %s for errors...\n", can_interface_name);
+// build one native protocol entry, returns its length
+size_t journal_entry(const struct canerr_record *rec, char *out, size_t size) {
+    const struct can_frame *frame = &rec->frame;
+    char line[1200];
+    size_t len = 0, line_len = format_line(rec, false, line, sizeof(line));
+    const char *sep = "";
 
-    while (1) {
-        ssize_t nbytes = read(sock, &frame, sizeof(frame));
-        if (nbytes < 0) {
-            perror("Error reading CAN frame");
-            return 1;
-        } else if (nbytes < sizeof(struct can_frame)) {
-            fprintf(stderr, "Incomplete CAN frame\n");
+    if (line_len > 0 && line[line_len - 1] == '\n')
+        line_len--;
+    canerr_append(out, size, &len, "MESSAGE=%.*s\nPRIORITY=%d\nSYSLOG_IDENTIFIER=canerrdump\n",
+                  (int)line_len, line, journal_priority(frame));
+    canerr_append(out, size, &len, "CAN_IFACE=%s\nCAN_ID=0x%03X\nCAN_RX_TIMESTAMP_USEC=%llu\nCAN_ERR_CLASS=",
+                  rec->ifname, frame->can_id & CAN_ERR_MASK,
+                  (unsigned long long)(canerr_timespec_ns(&rec->timestamp) / 1000));
+    for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+        if (frame->can_id & (1U << bit)) {
+            canerr_append(out, size, &len, "%s%s", sep, canerr_class_bit_names[bit]);
+            sep = ",";
+        }
+    canerr_append(out, size, &len, "\n");
+    if (frame->can_id & CAN_ERR_LOSTARB)
+        canerr_append(out, size, &len, "CAN_ERR_ARB=%d\n", frame->data[0]);
+    if (frame->can_id & CAN_ERR_CRTL) {
+        canerr_append(out, size, &len, "CAN_ERR_CTRL=");
+        canerr_append_bits(out, size, &len, CANERR_SUB_CTRL, frame->data[1]);
+        canerr_append(out, size, &len, "\n");
+    }
+    if (frame->can_id & CAN_ERR_PROT) {
+        canerr_append(out, size, &len, "CAN_ERR_PROT=");
+        canerr_append_bits(out, size, &len, CANERR_SUB_PROT, frame->data[2]);
+        canerr_append(out, size, &len, "\nCAN_ERR_LOC=%s\n", canerr_code_name(CANERR_SUB_LOC, frame->data[3]));
+    }
+    if (frame->can_id & CAN_ERR_TRX)
+        canerr_append(out, size, &len, "CAN_ERR_TRX=%s\n", canerr_code_name(CANERR_SUB_TRX, frame->data[4]));
+    if (frame->can_id & CAN_ERR_CNT)
+        canerr_append(out, size, &len, "CAN_TEC=%d\nCAN_REC=%d\n", frame->data[6], frame->data[7]);
+    return len;
+}
+
+// entry reporting suppressed entries, stored at index of batch
+void journal_summary(struct journal *j, int index) {
+    size_t len = 0;
+
+    canerr_append(j->entries[index], JOURNAL_ENTRY_SIZE, &len,
+                  "MESSAGE=Suppressed %llu CAN error messages because of JournalRate=%ld\n"
+                  "PRIORITY=4\nSYSLOG_IDENTIFIER=canerrdump\nCAN_SUPPRESSED=%llu\n",
+                  (unsigned long long)j->suppressed, j->rate, (unsigned long long)j->suppressed);
+    j->iovs[index].iov_len = len;
+    j->suppressed = 0;
+}
+
+// take one token from bucket, refilled continuously at rate per second
+bool journal_allow(struct journal *j, uint64_t now) {
+    if (j->rate == 0)
+        return true;
+    j->tokens += (double)(now - j->refill_ns) * j->rate / 1e9;
+    if (j->tokens > j->rate)
+        j->tokens = j->rate;
+    j->refill_ns = now;
+    if (j->tokens < 1.0)
+        return false;
+    j->tokens -= 1.0;
+    return true;
+}
+
+void journal_send_batch(struct journal *j, const struct canerr_record *recs, int n) {
+    uint64_t now = canerr_now_ns();
+    int count = 0, sent;
+
+    if (j->suppressed > 0 && journal_allow(j, now))     // report what rate limit swallowed
+        journal_summary(j, count++);
+    for (int i = 0; i < n; i++) {
+        if (recs[i].type != CANERR_FRAME_ERROR)
+            continue;                               // data frames are not journal material, kernel
+                                                    // messages are in journal already
+        if (!journal_allow(j, now)) {
+            j->suppressed++;
+            j->suppressed_total++;
+            continue;
+        }
+        j->iovs[count].iov_len = journal_entry(&recs[i], j->entries[count], JOURNAL_ENTRY_SIZE);
+        count++;
+    }
+    for (int i = 0; i < count; i++) {
+        j->iovs[i].iov_base = j->entries[i];
+        memset(&j->msgs[i], 0, sizeof(j->msgs[i]));
+        j->msgs[i].msg_hdr.msg_iov    = &j->iovs[i];
+        j->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int done = 0; done < count; done += sent) {
+        sent = sendmmsg(j->fd, j->msgs + done, count - done, j->send_flags);
+        if (sent < 0 && errno == EINTR && j->send_flags == 0) {
+            sent = 0;
             continue;
         }
+        if (sent <= 0) {                            // journald is behind, do not stall receiving
+            j->suppressed       += count - done;
+            j->suppressed_total += count - done;
+            break;
+        }
+        j->sent += sent;
+    }
+}
 
-        if (frame.can_id & CAN_ERR_FLAG) {   // check if it's an error frame
-            // 0x040 [8] 00 00 00 00 00 00 00 00
-            if (frame.can_id & CAN_EFF_FLAG) // extended or standard frame
-                printf("0x%08X [%d] ", frame.can_id & CAN_ERR_MASK, frame.can_dlc);
-            else
-                printf("0x%03X [%d] ", frame.can_id & CAN_ERR_MASK, frame.can_dlc);
-            for (size_t i = 0; i < frame.can_dlc; i++)
-                 printf("%02X ", frame.data[i]);
-            printf(" ERR=");
-            sprintf(err_str, "");
+void journal_close(struct journal *j) {
+    if (j->fd < 0)
+        return;
+    if (j->suppressed > 0) {                        // final summary is sent regardless of rate
+        journal_summary(j, 0);
+        if (send(j->fd, j->entries[0], j->iovs[0].iov_len, 0) < 0)
+            perror("Error sending journal summary");
+    }
+    close(j->fd);
+    j->fd = -1;
+    fprintf(stderr, "Sent %llu journal entries, %llu suppressed\n",
+            (unsigned long long)j->sent, (unsigned long long)j->suppressed_total);
+}
 
-            if (frame.can_id & CAN_ERR_TX_TIMEOUT)
-                strcat(err_str, "TxTimeout,");
 
-            if (frame.can_id & CAN_ERR_LOSTARB) {
-                sprintf(buf, "LostArBit%02d,", frame.data[0]);
-                strcat(err_str, buf);
-            }   
 
-            if (frame.can_id & CAN_ERR_ACK)
-                strcat(err_str, "NoAck,");
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Mqtt mode: minimal MQTT 3.1.1 publisher. BusOff and transceiver faults are published at once  //
+//  to <topic>/<interface>/event, all other errors are counted and published as one summary per   //
+//  interface and interval to <topic>/<interface>/summary. Publisher thread owns the connection,  //
+//  main thread only appends to a bounded queue, so a dead broker never stalls receiving. Queue   //
+//  keeps messages while broker is offline, QoS 1 messages stay queued until PUBACK arrives.      //
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-            if (frame.can_id & CAN_ERR_BUSOFF)
-                strcat(err_str, "BusOff,");
+struct mqtt_message {
+    uint16_t id;                                    // packet identifier, QoS 1 only
+    bool dup;                                       // sent before, resent after reconnect
+    uint16_t topic_len;
+    uint16_t payload_len;
+    char topic[MQTT_TOPIC_SIZE];
+    char payload[MQTT_PAYLOAD_SIZE];
+};
 
-            if (frame.can_id & CAN_ERR_BUSERROR)
-                strcat(err_str, "BusError,");
+struct mqtt_summary {
+    uint64_t start_ns;                              // first and last error of interval
+    uint64_t end_ns;
+    uint64_t frames;
+    uint64_t classes[CANERR_COUNT(canerr_class_bit_names)];
+    int tec, rec;                                   // highest error counters of interval, -1 if none
+};
 
-            if (frame.can_id & CAN_ERR_RESTARTED)
-                strcat(err_str, "Restarted,");
+struct mqtt {
+    int fd;                                         // broker connection, -1 while offline
+    int wake_fd;                                    // eventfd, written by main thread after push
+    bool active;
+    const char *host;
+    const char *port;
+    struct addrinfo *addrs;                         // resolved once at start in footprint profile
+    const char *topic;
+    char client_id[32];
+    int qos;
+    uint64_t interval_ns;
+    uint64_t next_summary_ns;
+    struct mqtt_summary summaries[CANERR_MAX_INTERFACES];
+    pthread_t thread;
+    pthread_mutex_t lock;                           // protects queue below
+    struct mqtt_message *queue;                     // ring of queue_size messages
+    size_t queue_size;
+    size_t tail;                                    // oldest message, index never wraps
+    size_t head;                                    // next free message
+    size_t inflight;                                // messages from tail sent but not acknowledged
+    uint16_t next_id;
+    bool stopping;
+    char rx[MQTT_RX_SIZE];                          // partially received packets from broker
+    size_t rx_len;
+    uint64_t published;
+    uint64_t dropped;
+    uint64_t connects;
+};
 
-            if (frame.can_id & CAN_ERR_CNT) {
-                sprintf(buf, "Count(TX=%d,RX=%d),", frame.data[6], frame.data[7]);
-                strcat(err_str, buf);
-            }
+struct mqtt mqtt = { .fd = -1, .wake_fd = -1 };
+
+// MQTT remaining length, 7 bits per byte, returns bytes used
+size_t mqtt_put_length(uint8_t *out, size_t value) {
+    size_t len = 0;
+    do {
+        out[len] = value & 0x7F;
+        value >>= 7;
+        if (value > 0)
+            out[len] |= 0x80;
+        len++;
+    } while (value > 0);
+    return len;
+}
+
+size_t mqtt_put_string(uint8_t *out, const char *str, size_t len) {
+    out[0] = len >> 8;
+    out[1] = len & 0xFF;
+    memcpy(out + 2, str, len);
+    return len + 2;
+}
+
+bool mqtt_send_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+bool mqtt_send_publish(struct mqtt *m, const struct mqtt_message *msg) {
+    uint8_t packet[MQTT_TOPIC_SIZE + MQTT_PAYLOAD_SIZE + 16];
+    size_t body = 2 + msg->topic_len + (m->qos > 0 ? 2 : 0) + msg->payload_len;
+    size_t len = 0;
+
+    packet[len++] = 0x30 | (msg->dup ? 0x08 : 0) | (m->qos << 1);
+    len += mqtt_put_length(packet + len, body);
+    len += mqtt_put_string(packet + len, msg->topic, msg->topic_len);
+    if (m->qos > 0) {
+        packet[len++] = msg->id >> 8;
+        packet[len++] = msg->id & 0xFF;
+    }
+    memcpy(packet + len, msg->payload, msg->payload_len);
+    return mqtt_send_all(m->fd, packet, len + msg->payload_len);
+}
+
+void mqtt_disconnect(struct mqtt *m) {
+    if (m->fd < 0)
+        return;
+    close(m->fd);
+    m->fd = -1;
+    m->rx_len = 0;
+    pthread_mutex_lock(&m->lock);
+    for (size_t i = 0; i < m->inflight; i++)        // unacknowledged messages are resent as duplicates,
+        m->queue[(m->tail + i) % m->queue_size].dup = m->qos > 0;   // DUP is not allowed with QoS 0
+    m->inflight = 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+// TCP connect, CONNECT with clean session, wait for CONNACK
+bool mqtt_connect(struct mqtt *m) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+    struct timeval timeout = { .tv_sec = MQTT_TIMEOUT_S };
+    struct pollfd pfd;
+    uint8_t packet[64 + sizeof(m->client_id)], ack[4];
+    size_t len = 0, body, got = 0;
+    int one = 1;
+
+    if ((res = m->addrs) == NULL && getaddrinfo(m->host, m->port, &hints, &res) != 0)
+        return false;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        if ((m->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+            continue;
+        setsockopt(m->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));   // bounds connect too
+        if (connect(m->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(m->fd);
+        m->fd = -1;
+    }
+    if (res != m->addrs)
+        freeaddrinfo(res);
+    if (m->fd < 0)
+        return false;
+    setsockopt(m->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    body = 10 + 2 + strlen(m->client_id);
+    packet[len++] = 0x10;
+    len += mqtt_put_length(packet + len, body);
+    len += mqtt_put_string(packet + len, "MQTT", 4);
+    packet[len++] = 4;                              // protocol level 3.1.1
+    packet[len++] = 0x02;                           // clean session, queue lives in this process
+    packet[len++] = MQTT_KEEPALIVE_S >> 8;
+    packet[len++] = MQTT_KEEPALIVE_S & 0xFF;
+    len += mqtt_put_string(packet + len, m->client_id, strlen(m->client_id));
+
+    pfd.fd = m->fd;
+    pfd.events = POLLIN;
+    if (mqtt_send_all(m->fd, packet, len))
+        while (got < sizeof(ack) && poll(&pfd, 1, MQTT_TIMEOUT_S * 1000) > 0) {
+            ssize_t ret = recv(m->fd, ack + got, sizeof(ack) - got, 0);
+            if (ret <= 0)
+                break;
+            got += ret;
+        }
+    if (got < sizeof(ack) || ack[0] != 0x20 || ack[3] != 0) {
+        if (got == sizeof(ack) && ack[0] == 0x20)
+            fprintf(stderr, "MQTT broker refused connection, return code %d\n", ack[3]);
+        close(m->fd);
+        m->fd = -1;
+        return false;
+    }
+    m->connects++;
+    return true;
+}
+
+// handle packets received from broker, PUBACK of oldest in flight message releases it
+bool mqtt_receive(struct mqtt *m) {
+    ssize_t ret = recv(m->fd, m->rx + m->rx_len, sizeof(m->rx) - m->rx_len, MSG_DONTWAIT);
+    size_t pos = 0;
 
-            if (frame.can_id & CAN_ERR_CRTL) {                 // error status of CAN-controller               / data[1]
-                sprintf(buf, "Ctrl(%s%s%s%s%s%s%s%s",
-                        frame.data[1] & CAN_ERR_CRTL_RX_OVERFLOW ? "OverflowRX," : "",
-                        frame.data[1] & CAN_ERR_CRTL_TX_OVERFLOW ? "OverflowTX," : "",
-                        frame.data[1] & CAN_ERR_CRTL_RX_WARNING  ? "WarningRX,"  : "",
-                        frame.data[1] & CAN_ERR_CRTL_TX_WARNING  ? "WarningTX,"  : "",
-                        frame.data[1] & CAN_ERR_CRTL_RX_PASSIVE  ? "PassiveRX,"  : "",
-                        frame.data[1] & CAN_ERR_CRTL_TX_PASSIVE  ? "PassiveTX,"  : "",
-                        frame.data[1] & CAN_ERR_CRTL_ACTIVE      ? "Active"      : "",
-                        frame.data[1] == CAN_ERR_CRTL_UNSPEC     ? "Unspec"      : "");
-                remove_trailing_comma(buf);
-                strcat(buf, "),");     
-                strcat(err_str, buf);
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+        return false;
+    if (ret > 0)
+        m->rx_len += ret;
+    while (m->rx_len - pos >= 2) {
+        size_t length = 0, used = 1;
+        int shift = 0;
+        do {                                        // decode remaining length
+            if (pos + used >= m->rx_len)
+                goto incomplete;
+            length |= (size_t)(m->rx[pos + used] & 0x7F) << shift;
+            shift += 7;
+        } while (m->rx[pos + used++] & 0x80 && shift < 28);
+        if (length > sizeof(m->rx) - used)
+            return false;                           // broker sends something we never asked for
+        if (pos + used + length > m->rx_len)
+            break;
+        if (((uint8_t)m->rx[pos] >> 4) == 4 && length >= 2) {   // PUBACK, broker acknowledges in order
+            uint16_t id = (uint8_t)m->rx[pos + used] << 8 | (uint8_t)m->rx[pos + used + 1];
+            pthread_mutex_lock(&m->lock);
+            if (m->inflight > 0 && m->queue[m->tail % m->queue_size].id == id) {
+                m->tail++;
+                m->inflight--;
+                m->published++;
             }
+            pthread_mutex_unlock(&m->lock);
+        }
+        pos += used + length;                       // PINGRESP and others need no action
+    }
+incomplete:
+    memmove(m->rx, m->rx + pos, m->rx_len - pos);
+    m->rx_len -= pos;
+    return true;
+}
+
+// send queued messages which are not in flight yet, returns count or -1, QoS 0 ones are released at once
+int mqtt_send_queued(struct mqtt *m) {
+    int sent = 0;
+
+    while (1) {
+        struct mqtt_message *msg;
+        pthread_mutex_lock(&m->lock);
+        if (m->tail + m->inflight == m->head || m->inflight >= MQTT_MAX_INFLIGHT) {
+            pthread_mutex_unlock(&m->lock);
+            return sent;
+        }
+        msg = &m->queue[(m->tail + m->inflight) % m->queue_size];
+        m->inflight++;                              // main thread never drops in flight messages
+        pthread_mutex_unlock(&m->lock);
+        if (!mqtt_send_publish(m, msg))
+            return -1;
+        sent++;
+        if (m->qos == 0) {
+            pthread_mutex_lock(&m->lock);
+            m->tail++;
+            m->inflight--;
+            m->published++;
+            pthread_mutex_unlock(&m->lock);
+        }
+    }
+}
+
+bool mqtt_drained(struct mqtt *m) {
+    bool drained;
+    pthread_mutex_lock(&m->lock);
+    drained = m->tail == m->head;
+    pthread_mutex_unlock(&m->lock);
+    return drained;
+}
+
+void *mqtt_publisher(void *arg) {
+    struct mqtt *m = arg;
+    int backoff = 1, sent;
+    uint64_t last_send = 0, stop_ns = 0;
+    uint64_t wakeups;
+
+    while (1) {
+        struct pollfd pfds[2] = { { .fd = m->wake_fd, .events = POLLIN }, { .fd = m->fd, .events = POLLIN } };
+        uint64_t now = canerr_now_ns();
+        bool stopping;
+
+        pthread_mutex_lock(&m->lock);
+        stopping = m->stopping;
+        pthread_mutex_unlock(&m->lock);
+        if (stopping && stop_ns == 0)
+            stop_ns = now;
+        if (stopping && (mqtt_drained(m) || now - stop_ns > MQTT_TIMEOUT_S * 1000000000ULL))
+            break;                                  // queue delivered or broker gone for good
 
-            if (frame.can_id & CAN_ERR_PROT) {                 // error in CAN protocol
-                sprintf(buf, "Prot(Type(%s%s%s%s%s%s%s%s%s",   // error in CAN protocol (type)                 / data[2]
-                        frame.data[2] & CAN_ERR_PROT_BIT      ? "SingleBit,"          : "",
-                        frame.data[2] & CAN_ERR_PROT_FORM     ? "FrameFormat,"        : "",
-                        frame.data[2] & CAN_ERR_PROT_STUFF    ? "BitStuffing,"        : "",
-                        frame.data[2] & CAN_ERR_PROT_BIT0     ? "Bit0,"               : "",
-                        frame.data[2] & CAN_ERR_PROT_BIT1     ? "Bit1,"               : "",
-                        frame.data[2] & CAN_ERR_PROT_OVERLOAD ? "BusOverload,"        : "",
-                        frame.data[2] & CAN_ERR_PROT_ACTIVE   ? "ActiveAnnouncement," : "",
-                        frame.data[2] & CAN_ERR_PROT_TX       ? "TX"                  : "",
-                        frame.data[2] == CAN_ERR_PROT_UNSPEC  ? "Unspec"              : "");
-                remove_trailing_comma(buf);
-                strcat(err_str, buf);
-                sprintf(buf, "),Loc(%s)),",                    // error in CAN protocol (location)             / data[3]
-                        frame.data[3] == CAN_ERR_PROT_LOC_UNSPEC  ? "Unspec" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_SOF     ? "SOF" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ID28_21 ? "ID28_21" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ID20_18 ? "ID20_18" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_SRTR    ? "SRTR" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_IDE     ? "IDE" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ID17_13 ? "ID17_13" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ID12_05 ? "ID12_05" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ID04_00 ? "ID04_00" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_RTR     ? "RTR" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_RES1    ? "RES1" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_RES0    ? "RES0" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_DLC     ? "DLC" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_DATA    ? "DATA" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_CRC_SEQ ? "CRC_SEQ" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_CRC_DEL ? "CRC_DEL" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ACK     ? "ACK" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_ACK_DEL ? "ACK_DEL" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_EOF     ? "EOF" :
-                        frame.data[3] == CAN_ERR_PROT_LOC_INTERM  ? "INTERM" : "Unknown");
-                strcat(err_str, buf);
-            }            
-
-            if (frame.can_id & CAN_ERR_TRX) {                  // error status of CAN-transceiver              / data[4]
-                sprintf(buf, "Trans(%s),",                    
-                        frame.data[4] == CAN_ERR_TRX_UNSPEC             ? "Unspec" :
-                        frame.data[4] == CAN_ERR_TRX_CANH_NO_WIRE       ? "CanHiNoWire" :
-                        frame.data[4] == CAN_ERR_TRX_CANH_SHORT_TO_BAT  ? "CanHiShortToBAT" :
-                        frame.data[4] == CAN_ERR_TRX_CANH_SHORT_TO_VCC  ? "CanHiShortToVCC" :
-                        frame.data[4] == CAN_ERR_TRX_CANH_SHORT_TO_GND  ? "CanHiShortToGND" :
-                        frame.data[4] == CAN_ERR_TRX_CANL_NO_WIRE       ? "CanLoNoWire" :
-                        frame.data[4] == CAN_ERR_TRX_CANL_SHORT_TO_BAT  ? "CanLoShortToBAT" :
-                        frame.data[4] == CAN_ERR_TRX_CANL_SHORT_TO_VCC  ? "CanLoShortToVCC" :
-                        frame.data[4] == CAN_ERR_TRX_CANL_SHORT_TO_GND  ? "CanLoShortToGND" :
-                        frame.data[4] == CAN_ERR_TRX_CANL_SHORT_TO_CANH ? "CanLoShortToCanHi" : "Unknown");
-                strcat(err_str, buf);
+        if (m->fd < 0) {
+            if (!mqtt_connect(m)) {
+                pfds[1].fd = -1;                    // wait for next attempt, main thread can still wake us
+                if (poll(pfds, 1, stopping ? 100 : backoff * 1000) > 0 && read(m->wake_fd, &wakeups, sizeof(wakeups)) < 0)
+                    perror("Error reading MQTT wakeup");
+                backoff = backoff < MQTT_MAX_BACKOFF_S ? backoff * 2 : MQTT_MAX_BACKOFF_S;
+                continue;
             }
+            backoff = 1;
+            last_send = now;
+            pfds[1].fd = m->fd;
+        }
+        if ((sent = mqtt_send_queued(m)) < 0) {
+            mqtt_disconnect(m);
+            continue;
+        }
+        if (sent > 0)
+            last_send = now;
+        if (now - last_send > MQTT_KEEPALIVE_S * 1000000000ULL / 2) {
+            uint8_t ping[2] = { 0xC0, 0x00 };
+            if (!mqtt_send_all(m->fd, ping, sizeof(ping))) {
+                mqtt_disconnect(m);
+                continue;
+            }
+            last_send = now;
+        }
+        if (poll(pfds, 2, stopping ? 100 : 1000) < 0 && errno != EINTR)
+            break;
+        if (pfds[0].revents & POLLIN && read(m->wake_fd, &wakeups, sizeof(wakeups)) < 0)
+            perror("Error reading MQTT wakeup");
+        if (pfds[1].revents & (POLLIN | POLLHUP | POLLERR) && !mqtt_receive(m))
+            mqtt_disconnect(m);
+    }
+    if (m->fd >= 0) {
+        uint8_t disconnect[2] = { 0xE0, 0x00 };
+        mqtt_send_all(m->fd, disconnect, sizeof(disconnect));
+        close(m->fd);
+        m->fd = -1;
+    }
+    return NULL;
+}
 
-            remove_trailing_comma(err_str);     
-            printf("%s\n", err_str);
+// append message to queue, oldest queued message is dropped when broker is offline for too long
+void mqtt_push(struct mqtt *m, const char *ifname, const char *kind, const char *payload, size_t payload_len) {
+    struct mqtt_message *msg;
+    uint64_t one = 1;
+    int topic_len;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->head - m->tail == m->queue_size) {
+        m->dropped++;
+        if (m->inflight > 0) {                      // oldest one is on the wire, drop new one instead
+            pthread_mutex_unlock(&m->lock);
+            return;
         }
+        m->tail++;
     }
+    msg = &m->queue[m->head % m->queue_size];
+    topic_len = snprintf(msg->topic, sizeof(msg->topic), "%s/%s/%s", m->topic, ifname, kind);
+    msg->topic_len   = topic_len < (int)sizeof(msg->topic) ? topic_len : (int)sizeof(msg->topic) - 1;
+    msg->payload_len = payload_len < sizeof(msg->payload) ? payload_len : sizeof(msg->payload);
+    memcpy(msg->payload, payload, msg->payload_len);
+    msg->dup = false;
+    if (++m->next_id == 0)                          // packet identifier 0 is not allowed
+        m->next_id = 1;
+    msg->id = m->next_id;
+    m->head++;
+    pthread_mutex_unlock(&m->lock);
+    if (write(m->wake_fd, &one, sizeof(one)) < 0)
+        perror("Error waking MQTT publisher");
+}
 
-    close(sock);
-    return 0;
+// Mqtt=<host>[:<port>], [host] for IPv6 addresses
+void mqtt_open(struct mqtt *m, char *address, const char *topic, int qos, long interval, long queue_size) {
+    split_host_port(address, &m->host, &m->port, "1883");
+    m->topic       = topic;
+    m->qos         = qos;
+    m->interval_ns = interval * 1000000000ULL;
+    m->queue_size  = queue_size;
+    snprintf(m->client_id, sizeof(m->client_id), "canerrdump-%d", (int)getpid());
+    if ((m->queue = footprint_alloc(queue_size * sizeof(struct mqtt_message), 64, "MQTT queue")) == NULL)
+        err_exit("Error allocating MQTT queue");
+    if (footprint.active) {                         // getaddrinfo() allocates, so not at reconnect
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        if (getaddrinfo(m->host, m->port, &hints, &m->addrs) != 0) {
+            printf("Error: Can not resolve MQTT broker %s\n", m->host);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((m->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        err_exit("Error creating MQTT eventfd");
+    pthread_mutex_init(&m->lock, NULL);
+    for (int i = 0; i < CANERR_MAX_INTERFACES; i++)
+        m->summaries[i].tec = m->summaries[i].rec = -1;
+    m->next_summary_ns = canerr_now_ns() + m->interval_ns;
+    m->active = true;
+    if ((errno = footprint_thread(&m->thread, mqtt_publisher, m)) != 0)
+        err_exit("Error starting MQTT publisher thread");
+}
+
+// immediate event for critical errors, JSON with decoded error text
+void mqtt_event(struct mqtt *m, const struct canerr_record *rec) {
+    char payload[MQTT_PAYLOAD_SIZE], err[512];
+    size_t len = 0;
+
+    canerr_decode(&rec->frame, err, sizeof(err));
+    canerr_append(payload, sizeof(payload), &len, "{\"if\":\"%s\",\"ts\":%lld.%06ld,\"id\":\"0x%03X\",\"err\":\"%s\"}",
+                  rec->ifname, (long long)rec->timestamp.tv_sec, rec->timestamp.tv_nsec / 1000,
+                  rec->frame.can_id & CAN_ERR_MASK, err);
+    mqtt_push(m, rec->ifname, "event", payload, len);
+}
+
+void mqtt_add(struct mqtt *m, const struct canerr_record *rec) {
+    struct mqtt_summary *sum = &m->summaries[rec->iface];
+    const struct can_frame *frame = &rec->frame;
+
+    if (rec->type != CANERR_FRAME_ERROR)
+        return;
+    if (frame->can_id & (CAN_ERR_BUSOFF | CAN_ERR_TRX))
+        mqtt_event(m, rec);
+    if (sum->frames++ == 0)
+        sum->start_ns = canerr_timespec_ns(&rec->timestamp);
+    sum->end_ns = canerr_timespec_ns(&rec->timestamp);
+    for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+        if (frame->can_id & (1U << bit))
+            sum->classes[bit]++;
+    if (frame->can_id & CAN_ERR_CNT) {
+        if (frame->data[6] > sum->tec)
+            sum->tec = frame->data[6];
+        if (frame->data[7] > sum->rec)
+            sum->rec = frame->data[7];
+    }
+}
+
+// publish summaries of interfaces which had errors since last interval, force at exit
+void mqtt_publish_summaries(struct mqtt *m, bool force) {
+    uint64_t now = canerr_now_ns();
+    char payload[MQTT_PAYLOAD_SIZE];
+
+    if (!m->active || (!force && now < m->next_summary_ns))
+        return;
+    m->next_summary_ns = now + m->interval_ns;
+    for (int i = 0; i < stream.count; i++) {
+        struct mqtt_summary *sum = &m->summaries[i];
+        size_t len = 0;
+        if (sum->frames == 0)
+            continue;
+        canerr_append(payload, sizeof(payload), &len, "{\"if\":\"%s\",\"start\":%llu.%06llu,\"end\":%llu.%06llu,\"frames\":%llu",
+                      stream.ifnames[i], (unsigned long long)(sum->start_ns / 1000000000ULL),
+                      (unsigned long long)(sum->start_ns % 1000000000ULL / 1000), (unsigned long long)(sum->end_ns / 1000000000ULL),
+                      (unsigned long long)(sum->end_ns % 1000000000ULL / 1000), (unsigned long long)sum->frames);
+        for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+            if (sum->classes[bit] > 0)
+                canerr_append(payload, sizeof(payload), &len, ",\"%s\":%llu", canerr_class_bit_names[bit],
+                              (unsigned long long)sum->classes[bit]);
+        if (sum->tec >= 0)
+            canerr_append(payload, sizeof(payload), &len, ",\"tec\":%d,\"rec\":%d", sum->tec, sum->rec);
+        canerr_append(payload, sizeof(payload), &len, "}");
+        mqtt_push(m, stream.ifnames[i], "summary", payload, len);
+        memset(sum, 0, sizeof(*sum));
+        sum->tec = sum->rec = -1;
+    }
+}
+
+// publish last summaries and give publisher a few seconds to deliver the queue
+void mqtt_close(struct mqtt *m) {
+    uint64_t one = 1;
+
+    if (!m->active)
+        return;
+    mqtt_publish_summaries(m, true);
+    pthread_mutex_lock(&m->lock);
+    m->stopping = true;
+    pthread_mutex_unlock(&m->lock);
+    if (write(m->wake_fd, &one, sizeof(one)) < 0)
+        perror("Error waking MQTT publisher");
+    pthread_join(m->thread, NULL);
+    close(m->wake_fd);
+    fprintf(stderr, "Published %llu MQTT messages in %llu connections, %llu dropped, %zu undelivered\n",
+            (unsigned long long)m->published, (unsigned long long)m->connects,
+            (unsigned long long)m->dropped, m->head - m->tail);
+    footprint_free(m->queue);
+    if (m->addrs != NULL)
+        freeaddrinfo(m->addrs);
+    m->active = false;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Bridge mode: received records go to another host in UDP datagrams of canerr.h bridge format,  //
+//  packed up to CANERR_BRIDGE_PAYLOAD bytes with sequence number and send time, all datagrams of //
+//  a batch with one sendmmsg() call. canerrsim Bridge= on the other host injects them into a     //
+//  local interface with their original spacing.                                                  //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct bridge {
+    int fd;                                         // UDP socket connected to receiver
+    const char *host;
+    const char *port;
+    uint64_t seq;
+    uint64_t datagrams;
+    uint64_t records;
+    uint64_t failed;                                // datagrams refused by local stack
+    char dgrams[CANERR_MAX_BATCH][CANERR_BRIDGE_DGRAM_MAX] __attribute__((aligned(8)));
+    struct iovec iovs[CANERR_MAX_BATCH];
+    struct mmsghdr msgs[CANERR_MAX_BATCH];
+};
+
+struct bridge bridge = { .fd = -1 };
+
+void bridge_open(struct bridge *b, char *address) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM }, *res, *ai;
+    const int sndbuf = 4 << 20;                     // whole error storm batches without blocking
+
+    split_host_port(address, &b->host, &b->port, CANERR_BRIDGE_PORT);
+    if (getaddrinfo(b->host, b->port, &hints, &res) != 0) {
+        printf("Error: Can not resolve bridge receiver %s\n", b->host);
+        exit(EXIT_FAILURE);
+    }
+    for (ai = res; ai != NULL && b->fd < 0; ai = ai->ai_next) {
+        if ((b->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+            continue;
+        if (connect(b->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(b->fd);
+            b->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (b->fd < 0)
+        err_exit("Error opening bridge socket");
+    setsockopt(b->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+}
+
+// finish datagram i with header, returns index of next datagram
+int bridge_seal(struct bridge *b, int i, size_t len, int count) {
+    struct canerr_bridge_header *hdr = (struct canerr_bridge_header *)b->dgrams[i];
+
+    hdr->magic   = CANERR_BRIDGE_MAGIC;
+    hdr->version = CANERR_BRIDGE_VERSION;
+    hdr->count   = count;
+    hdr->seq     = b->seq++;
+    hdr->sent_ns = canerr_now_ns();
+    b->iovs[i].iov_base = b->dgrams[i];
+    b->iovs[i].iov_len  = len;
+    memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+    b->msgs[i].msg_hdr.msg_iov    = &b->iovs[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+    return i + 1;
+}
+
+void bridge_send_batch(struct bridge *b, const struct canerr_record *recs, int n) {
+    size_t len = sizeof(struct canerr_bridge_header);
+    int dgram = 0, count = 0, sent;
+
+    for (int i = 0; i < n; i++) {
+        size_t size = canerr_cap_record_bytes(&recs[i]);
+        if (count > 0 && len + size > sizeof(struct canerr_bridge_header) + CANERR_BRIDGE_PAYLOAD) {
+            dgram = bridge_seal(b, dgram, len, count);
+            len   = sizeof(struct canerr_bridge_header);
+            count = 0;
+        }
+        len += canerr_cap_put(b->dgrams[dgram] + len, &recs[i]);
+        count++;
+    }
+    if (count > 0)
+        dgram = bridge_seal(b, dgram, len, count);
+    for (int done = 0; done < dgram; done += sent) {
+        if ((sent = sendmmsg(b->fd, b->msgs + done, dgram - done, 0)) <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                sent = 0;
+                continue;
+            }
+            b->failed += dgram - done;              // receiver not listening yet (ECONNREFUSED) and such
+            break;
+        }
+        b->datagrams += sent;
+    }
+    b->records += n;
+}
+
+void bridge_close(struct bridge *b) {
+    if (b->fd < 0)
+        return;
+    close(b->fd);
+    b->fd = -1;
+    fprintf(stderr, "Bridged %llu records in %llu datagrams to %s port %s, %llu datagrams failed\n",
+            (unsigned long long)b->records, (unsigned long long)b->datagrams, b->host, b->port,
+            (unsigned long long)b->failed);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Sqlite mode: decoded errors go to table errors of an SQLite database in WAL mode, so they can  //
+//  be queried with sqlite3 while canerrdump is still writing. Main thread only appends raw frames //
+//  to a bounded queue, writer thread decodes them and inserts with one prepared statement in     //
+//  large transactions, committed after SqliteBatch rows or SqliteFlush ms, whatever comes first. //
+//  libsqlite3 is loaded with dlopen(), so canerrdump builds and runs without it.                 //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SQLITE_OK 0
+#define SQLITE_DONE 101
+#define SQLITE_OPEN_READWRITE 0x02
+#define SQLITE_OPEN_CREATE 0x04
+#define SQLITE_OPEN_NOMUTEX 0x8000                  // connection is used by one thread at a time
+
+typedef struct sqlite3 sqlite3;
+typedef struct sqlite3_stmt sqlite3_stmt;
+
+// the part of SQLite C API used here, resolved by name from SQLITE_LIBRARY
+struct sqlite_api {
+    int (*open_v2)(const char *, sqlite3 **, int, const char *);
+    int (*close)(sqlite3 *);
+    int (*exec)(sqlite3 *, const char *, void *, void *, char **);
+    int (*busy_timeout)(sqlite3 *, int);
+    int (*prepare_v2)(sqlite3 *, const char *, int, sqlite3_stmt **, const char **);
+    int (*bind_int64)(sqlite3_stmt *, int, long long);
+    int (*bind_text)(sqlite3_stmt *, int, const char *, int, void (*)(void *));
+    int (*bind_null)(sqlite3_stmt *, int);
+    int (*step)(sqlite3_stmt *);
+    int (*reset)(sqlite3_stmt *);
+    int (*finalize)(sqlite3_stmt *);
+    const char *(*errmsg)(sqlite3 *);
+    const char *(*libversion)(void);
+    long long (*memory_highwater)(int);
+    long long (*hard_heap_limit64)(long long);      // SQLite 3.31 and newer, may be missing
+};
+
+// one queued error, decoded only by writer thread
+struct sqlite_row {
+    uint64_t timestamp_ns;
+    int iface;
+    struct can_frame frame;
+};
+
+struct sqlite {
+    bool active;
+    bool wait;                                      // replaying capture: block instead of dropping
+    void *lib;
+    struct sqlite_api api;
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+    const char *path;
+    long batch;                                     // rows per transaction
+    uint64_t flush_ns;                              // open transaction is committed after this
+    pthread_t thread;
+    pthread_mutex_t lock;                           // protects queue below
+    pthread_cond_t cond;                            // writer waits for rows, main thread for space
+    struct sqlite_row *queue;                       // ring of SQLITE_QUEUE_ROWS rows
+    size_t tail;                                    // oldest row, index never wraps
+    size_t head;                                    // next free row
+    bool stopping;
+    struct sqlite_row chunk[CANERR_MAX_BATCH];      // rows taken from queue by writer thread
+    uint64_t rows;
+    uint64_t transactions;
+    uint64_t dropped;
+    uint64_t failed;
+};
+
+struct sqlite sqlite;
+
+const char *sqlite_schema =
+    "PRAGMA journal_mode=WAL;"                      // readers never block writer and the other way round
+    "PRAGMA synchronous=NORMAL;"                    // fsync at checkpoint, not at every commit
+    "CREATE TABLE IF NOT EXISTS errors ("
+    "  ts INTEGER NOT NULL,"                        // receive time, ns since 1970
+    "  iface TEXT NOT NULL,"
+    "  id INTEGER NOT NULL,"                        // error class bits of CAN ID
+    "  class TEXT NOT NULL,"                        // class names like in journal, BusOff,Count
+    "  ctrl TEXT, prot TEXT, loc TEXT, trx TEXT,"   // NULL when class is not set
+    "  arb INTEGER, tec INTEGER, rec INTEGER,"
+    "  err TEXT NOT NULL);"                         // whole decoded error, like ERR= of stdout
+    "CREATE INDEX IF NOT EXISTS errors_ts ON errors(ts);"
+    "CREATE INDEX IF NOT EXISTS errors_iface ON errors(iface, ts);"
+    "CREATE INDEX IF NOT EXISTS errors_class ON errors(class, ts);";
+
+void sqlite_fail(struct sqlite *q, const char *what) {
+    if (q->failed++ == 0)                           // report first one, count the rest
+        fprintf(stderr, "Error %s SQLite database %s: %s\n", what, q->path, q->api.errmsg(q->db));
+}
+
+bool sqlite_exec(struct sqlite *q, const char *sql, const char *what) {
+    if (q->api.exec(q->db, sql, NULL, NULL, NULL) == SQLITE_OK)
+        return true;
+    sqlite_fail(q, what);
+    return false;
+}
+
+void sqlite_bind_text(struct sqlite *q, int column, const char *text, bool present) {
+    if (present)
+        q->api.bind_text(q->insert, column, text, -1, NULL);    // NULL is SQLITE_STATIC, step follows
+    else
+        q->api.bind_null(q->insert, column);
+}
+
+void sqlite_bind_int(struct sqlite *q, int column, int value, bool present) {
+    if (present)
+        q->api.bind_int64(q->insert, column, value);
+    else
+        q->api.bind_null(q->insert, column);
+}
+
+void sqlite_insert(struct sqlite *q, const struct sqlite_row *row) {
+    const struct can_frame *frame = &row->frame;
+    char classes[128], ctrl[256], prot[256], err[512];
+    size_t classes_len = 0, ctrl_len = 0, prot_len = 0;
+    const char *sep = "";
+
+    classes[0] = ctrl[0] = prot[0] = '\0';
+    for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+        if (frame->can_id & (1U << bit)) {
+            canerr_append(classes, sizeof(classes), &classes_len, "%s%s", sep, canerr_class_bit_names[bit]);
+            sep = ",";
+        }
+    canerr_append_bits(ctrl, sizeof(ctrl), &ctrl_len, CANERR_SUB_CTRL, frame->data[1]);
+    canerr_append_bits(prot, sizeof(prot), &prot_len, CANERR_SUB_PROT, frame->data[2]);
+    canerr_decode(frame, err, sizeof(err));
+
+    q->api.bind_int64(q->insert, 1, row->timestamp_ns);
+    q->api.bind_text(q->insert, 2, stream.ifnames[row->iface], -1, NULL);
+    q->api.bind_int64(q->insert, 3, frame->can_id & CAN_ERR_MASK);
+    q->api.bind_text(q->insert, 4, classes, -1, NULL);
+    sqlite_bind_text(q, 5, ctrl, frame->can_id & CAN_ERR_CRTL);
+    sqlite_bind_text(q, 6, prot, frame->can_id & CAN_ERR_PROT);
+    sqlite_bind_text(q, 7, canerr_code_name(CANERR_SUB_LOC, frame->data[3]), frame->can_id & CAN_ERR_PROT);
+    sqlite_bind_text(q, 8, canerr_code_name(CANERR_SUB_TRX, frame->data[4]), frame->can_id & CAN_ERR_TRX);
+    sqlite_bind_int(q, 9, frame->data[0], frame->can_id & CAN_ERR_LOSTARB);
+    sqlite_bind_int(q, 10, frame->data[6], frame->can_id & CAN_ERR_CNT);
+    sqlite_bind_int(q, 11, frame->data[7], frame->can_id & CAN_ERR_CNT);
+    q->api.bind_text(q->insert, 12, err, -1, NULL);
+    if (q->api.step(q->insert) == SQLITE_DONE)
+        q->rows++;
+    else
+        sqlite_fail(q, "inserting into");
+    q->api.reset(q->insert);
+}
+
+// takes rows from queue and inserts them, one transaction stays open until it is big or old enough
+void *sqlite_writer(void *arg) {
+    struct sqlite *q = arg;
+    uint64_t commit_ns = 0;                         // due time of open transaction, 0 if none
+    long pending = 0;                               // rows in open transaction
+
+    pthread_mutex_lock(&q->lock);
+    while (1) {
+        int n = 0;
+        bool stopping;
+        while (q->head == q->tail && !q->stopping && (pending == 0 || canerr_now_ns() < commit_ns)) {
+            uint64_t wake = pending > 0 ? commit_ns : canerr_now_ns() + 1000000000ULL;
+            struct timespec ts = { .tv_sec = wake / 1000000000ULL, .tv_nsec = wake % 1000000000ULL };
+            pthread_cond_timedwait(&q->cond, &q->lock, &ts);
+        }
+        for (; n < CANERR_MAX_BATCH && q->tail != q->head; n++, q->tail++)
+            q->chunk[n] = q->queue[q->tail % SQLITE_QUEUE_ROWS];
+        stopping = q->stopping && q->tail == q->head;
+        if (n > 0)
+            pthread_cond_broadcast(&q->cond);      // main thread may wait for space
+        pthread_mutex_unlock(&q->lock);
+
+        if (n > 0 && pending == 0) {
+            sqlite_exec(q, "BEGIN", "starting transaction in");
+            commit_ns = canerr_now_ns() + q->flush_ns;
+        }
+        for (int i = 0; i < n; i++)
+            sqlite_insert(q, &q->chunk[i]);
+        pending += n;
+        if (pending > 0 && (pending >= q->batch || stopping || canerr_now_ns() >= commit_ns)) {
+            if (sqlite_exec(q, "COMMIT", "committing to"))
+                q->transactions++;
+            pending = 0;
+        }
+        if (stopping)
+            break;
+        pthread_mutex_lock(&q->lock);
+    }
+    return NULL;
+}
+
+// load libsqlite3, open or create database with table and indexes, start writer thread
+void sqlite_open(struct sqlite *q, const char *path, long batch, long flush_ms, bool wait) {
+    static const char *const names[] = {
+        "sqlite3_open_v2", "sqlite3_close", "sqlite3_exec", "sqlite3_busy_timeout", "sqlite3_prepare_v2",
+        "sqlite3_bind_int64", "sqlite3_bind_text", "sqlite3_bind_null", "sqlite3_step", "sqlite3_reset",
+        "sqlite3_finalize", "sqlite3_errmsg", "sqlite3_libversion", "sqlite3_memory_highwater", "sqlite3_hard_heap_limit64"
+    };
+    void **fns = (void **)&q->api;
+    char heap[64];
+
+    if ((q->lib = dlopen(SQLITE_LIBRARY, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        printf("Error: Can not load %s, install it with: sudo apt-get install libsqlite3-0\n", SQLITE_LIBRARY);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < CANERR_COUNT(names); i++)
+        if ((fns[i] = dlsym(q->lib, names[i])) == NULL && i < CANERR_COUNT(names) - 1) {
+            printf("Error: %s has no %s\n", SQLITE_LIBRARY, names[i]);
+            exit(EXIT_FAILURE);
+        }
+    q->path     = path;
+    q->batch    = batch;
+    q->flush_ns = flush_ms * 1000000ULL;
+    q->wait     = wait;
+    if (footprint.active && q->api.hard_heap_limit64 != NULL) {
+        q->api.hard_heap_limit64(SQLITE_HEAP_LIMIT);   // SQLite heap is bounded, not preallocated
+        snprintf(heap, sizeof(heap), "PRAGMA cache_size=-%d;", SQLITE_HEAP_LIMIT / 2048);
+    } else
+        heap[0] = '\0';
+    if (q->api.open_v2(path, &q->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK ||
+        q->api.busy_timeout(q->db, SQLITE_BUSY_MS) != SQLITE_OK || !sqlite_exec(q, heap, "configuring") ||
+        !sqlite_exec(q, sqlite_schema, "creating table in") ||
+        q->api.prepare_v2(q->db, "INSERT INTO errors VALUES (?,?,?,?,?,?,?,?,?,?,?,?)", -1, &q->insert, NULL) != SQLITE_OK) {
+        if (q->failed == 0)
+            sqlite_fail(q, "opening");
+        exit(EXIT_FAILURE);
+    }
+    if ((q->queue = footprint_alloc(SQLITE_QUEUE_ROWS * sizeof(struct sqlite_row), 64, "SQLite queue")) == NULL)
+        err_exit("Error allocating SQLite queue");
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->active = true;
+    if ((errno = footprint_thread(&q->thread, sqlite_writer, q)) != 0)
+        err_exit("Error starting SQLite writer thread");
+}
+
+// queue error records of one batch, oldest ones are kept when writer thread is behind on live bus
+void sqlite_push_batch(struct sqlite *q, const struct canerr_record *recs, int n) {
+    pthread_mutex_lock(&q->lock);
+    for (int i = 0; i < n; i++) {
+        struct sqlite_row *row;
+        if (recs[i].type != CANERR_FRAME_ERROR)
+            continue;
+        while (q->wait && q->head - q->tail == SQLITE_QUEUE_ROWS)
+            pthread_cond_wait(&q->cond, &q->lock);
+        if (q->head - q->tail == SQLITE_QUEUE_ROWS) {
+            q->dropped++;
+            continue;
+        }
+        row = &q->queue[q->head++ % SQLITE_QUEUE_ROWS];
+        row->timestamp_ns = canerr_timespec_ns(&recs[i].timestamp);
+        row->iface        = recs[i].iface;
+        row->frame        = recs[i].frame;
+    }
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// writer thread inserts what is queued and commits, then database is closed
+void sqlite_close(struct sqlite *q) {
+    if (!q->active)
+        return;
+    pthread_mutex_lock(&q->lock);
+    q->stopping = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    q->api.finalize(q->insert);
+    q->api.close(q->db);
+    fprintf(stderr, "Stored %llu errors in %llu transactions to %s (SQLite %s), %llu dropped, %llu failed\n",
+            (unsigned long long)q->rows, (unsigned long long)q->transactions, q->path, q->api.libversion(),
+            (unsigned long long)q->dropped, (unsigned long long)q->failed);
+    footprint_free(q->queue);
+    q->active = false;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Dashboard mode: small HTTP server serving one page, which opens a WebSocket back to it. Main   //
+//  thread only counts errors per interface and class, tracks error state transitions and counts  //
+//  error signatures (error frame without counters) in a fixed hash table. Dashboard thread owns  //
+//  all connections and every DashboardInterval pushes only what changed since last push: class   //
+//  rates, error counters, new transitions and top signatures. Raw frames never leave canerrdump, //
+//  so any number of browsers cost the bus side nothing more than one.                            //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum dash_state { DASH_ACTIVE, DASH_WARNING, DASH_PASSIVE, DASH_BUSOFF };
+
+const char *const dash_state_names[] = { "Active", "Warning", "Passive", "BusOff" };
+
+struct dash_iface {
+    uint64_t classes[CANERR_COUNT(canerr_class_bit_names)];   // errors so far, main thread counts
+    int state;                                      // dash_state
+    int tec, rec;                                   // last error counters, -1 if none yet
+};
+
+struct dash_transition {
+    uint64_t timestamp_ns;
+    int iface;
+    int from, to;
+};
+
+// frame without error counters, decoded to text only when first seen
+struct dash_signature {
+    canid_t id;                                     // 0 marks free slot
+    uint8_t data[5];
+    uint8_t iface;
+    uint64_t count;
+    char text[DASH_SIGNATURE_SIZE];
+};
+
+struct dash_client {
+    int fd;                                         // -1 marks free slot
+    bool websocket;                                 // upgraded, gets pushes
+    bool fresh;                                     // needs whole state with next push
+    bool closing;                                   // HTTP answer done, close once queue is sent
+    char *tx;                                       // DASH_QUEUE_SIZE bytes the socket did not take yet
+    size_t tx_len;
+    size_t rx_len;
+    char rx[DASH_REQUEST_SIZE];
+};
+
+struct dash {
+    bool active;
+    int listen_fd;
+    int wake_fd;                                    // eventfd, written at exit
+    const char *host;
+    const char *port;
+    uint64_t interval_ns;
+    pthread_t thread;
+    pthread_mutex_t lock;                           // protects aggregates down to signature_count
+    struct dash_iface ifaces[CANERR_MAX_INTERFACES];
+    struct dash_transition transitions[DASH_TRANSITIONS];
+    uint64_t transition_count;                      // index never wraps
+    struct dash_signature signatures[DASH_SIGNATURES];
+    int signature_count;
+    uint64_t other;                                 // errors of signatures which did not fit in table
+    bool stopping;
+    // dashboard thread only
+    struct dash_client clients[DASH_MAX_CLIENTS];
+    struct dash_iface snapshot[CANERR_MAX_INTERFACES];
+    struct dash_iface sent[CANERR_MAX_INTERFACES];  // state of last push
+    double sent_rates[CANERR_MAX_INTERFACES][CANERR_COUNT(canerr_class_bit_names)];
+    uint64_t sent_transitions;
+    struct dash_transition recent[DASH_TRANSITIONS];    // copy of transitions, taken with lock
+    int top[DASH_TOP];                              // signature slots of last pushed top list
+    uint64_t top_counts[DASH_TOP];
+    int top_count;
+    uint64_t last_push_ns;
+    uint64_t pushes;
+    uint64_t connections;
+    char msg[DASH_MESSAGE_SIZE];
+};
+
+struct dash dash = { .listen_fd = -1, .wake_fd = -1 };
+
+const char *dash_page =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>canerrdump</title><style>"
+    "body{font:14px monospace;margin:1em}table{border-collapse:collapse;margin-bottom:1em}"
+    "td,th{border:1px solid #ccc;padding:2px 8px;text-align:right}th{background:#eee}td.l{text-align:left}"
+    ".Warning{background:#ffa}.Passive{background:#fc8}.BusOff{background:#f88}</style></head><body>"
+    "<h3>canerrdump <span id=\"st\">connecting</span></h3><table id=\"ifs\"></table>"
+    "<h4>Top error signatures</h4><table id=\"top\"></table><h4>State transitions</h4><table id=\"tr\"></table>"
+    "<script>\n"
+    "var cls=[],rates={},states={},cnt={},tr=[],top=[],other=0;\n"
+    "function e(s){return String(s).replace(/[&<>]/g,function(c){return{'&':'&amp;','<':'&lt;','>':'&gt;'}[c]})}\n"
+    "function time(ns){return new Date(ns/1e6).toISOString().substr(11,12)}\n"
+    "function render(){\n"
+    " var h='<tr><th>Interface</th><th>State</th><th>TEC</th><th>REC</th>';\n"
+    " cls.forEach(function(c){h+='<th>'+c+'/s</th>'});h+='</tr>';\n"
+    " for(var i in states){var r=rates[i]||{},c=cnt[i]||['-','-'];\n"
+    "  h+='<tr><td class=\"l\">'+e(i)+'</td><td class=\"l '+states[i]+'\">'+states[i]+'</td><td>'+c[0]+'</td><td>'+c[1]+'</td>';\n"
+    "  cls.forEach(function(k){h+='<td>'+(r[k]||0)+'</td>'});h+='</tr>'}\n"
+    " document.getElementById('ifs').innerHTML=h;\n"
+    " h='<tr><th>Interface</th><th>Errors</th><th>Signature</th></tr>';\n"
+    " top.forEach(function(t){h+='<tr><td class=\"l\">'+e(t.if)+'</td><td>'+t.n+'</td><td class=\"l\">'+e(t.sig)+'</td></tr>'});\n"
+    " if(other)h+='<tr><td class=\"l\">any</td><td>'+other+'</td><td class=\"l\">(table full)</td></tr>';\n"
+    " document.getElementById('top').innerHTML=h;\n"
+    " h='<tr><th>Time</th><th>Interface</th><th>From</th><th>To</th></tr>';\n"
+    " tr.slice(-20).reverse().forEach(function(t){h+='<tr><td>'+time(t.ts)+'</td><td class=\"l\">'+e(t.if)+\n"
+    "  '</td><td class=\"l '+t.from+'\">'+t.from+'</td><td class=\"l '+t.to+'\">'+t.to+'</td></tr>'});\n"
+    " document.getElementById('tr').innerHTML=h}\n"
+    "function connect(){var ws=new WebSocket('ws://'+location.host+'/ws'),st=document.getElementById('st');\n"
+    " ws.onopen=function(){st.textContent='connected'};\n"
+    " ws.onclose=function(){st.textContent='disconnected';setTimeout(connect,2000)};\n"
+    " ws.onmessage=function(m){var d=JSON.parse(m.data),i;\n"
+    "  if(d.full){cls=d.classes;rates={};states={};cnt={};tr=[]}\n"
+    "  for(i in d.rates)for(var k in d.rates[i])(rates[i]=rates[i]||{})[k]=d.rates[i][k];\n"
+    "  for(i in d.states)states[i]=d.states[i];for(i in d.counters)cnt[i]=d.counters[i];\n"
+    "  if(d.transitions)tr=tr.concat(d.transitions).slice(-100);if(d.top)top=d.top;if(d.other)other=d.other;\n"
+    "  render()}}\n"
+    "connect();\n"
+    "</script></body></html>";
+
+// SHA-1 of WebSocket handshake, RFC 3174
+void dash_sha1(const uint8_t *data, size_t len, uint8_t out[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t block[64];
+    size_t total = ((len + 8) / 64 + 1) * 64;
+
+    for (size_t offset = 0; offset < total; offset += 64) {
+        uint32_t w[80], a, b, c, d, e;
+        for (size_t i = 0; i < 64; i++) {
+            size_t pos = offset + i;
+            if (pos < len)
+                block[i] = data[pos];
+            else if (pos == len)
+                block[i] = 0x80;
+            else if (pos >= total - 8)
+                block[i] = (uint64_t)len * 8 >> (8 * (total - 1 - pos));
+            else
+                block[i] = 0;
+        }
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+        for (int i = 16; i < 80; i++) {
+            uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = x << 1 | x >> 31;
+        }
+        a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k, t;
+            if (i < 20)
+                f = (b & c) | (~b & d), k = 0x5A827999;
+            else if (i < 40)
+                f = b ^ c ^ d, k = 0x6ED9EBA1;
+            else if (i < 60)
+                f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+            else
+                f = b ^ c ^ d, k = 0xCA62C1D6;
+            t = (a << 5 | a >> 27) + f + e + k + w[i];
+            e = d, d = c, c = b << 30 | b >> 2, b = a, a = t;
+        }
+        h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+    }
+    for (int i = 0; i < 20; i++)
+        out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+size_t dash_base64(const uint8_t *data, size_t len, char *out) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0) | (i + 2 < len ? data[i + 2] : 0);
+        out[n++] = digits[v >> 18 & 63];
+        out[n++] = digits[v >> 12 & 63];
+        out[n++] = i + 1 < len ? digits[v >> 6 & 63] : '=';
+        out[n++] = i + 2 < len ? digits[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// error state after frame, controller problems and bus off as drivers report them
+int dash_next_state(const struct can_frame *frame, int state) {
+    if (frame->can_id & CAN_ERR_BUSOFF)
+        return DASH_BUSOFF;
+    if (frame->can_id & CAN_ERR_RESTARTED)
+        return DASH_ACTIVE;
+    if (!(frame->can_id & CAN_ERR_CRTL))
+        return state;
+    if (frame->data[1] & CAN_ERR_CRTL_ACTIVE)
+        return DASH_ACTIVE;
+    if (frame->data[1] & (CAN_ERR_CRTL_TX_PASSIVE | CAN_ERR_CRTL_RX_PASSIVE))
+        return DASH_PASSIVE;
+    if (frame->data[1] & (CAN_ERR_CRTL_TX_WARNING | CAN_ERR_CRTL_RX_WARNING))
+        return DASH_WARNING;
+    return state;
+}
+
+// count signature of frame in open addressing table, called with lock held
+void dash_count_signature(struct dash *d, const struct canerr_record *rec) {
+    struct can_frame frame = rec->frame;
+    uint32_t hash = 2166136261U;                    // FNV-1a over id, data[0..4] and interface
+    uint8_t key[10];
+
+    frame.can_id &= CAN_ERR_MASK & ~CAN_ERR_CNT;
+    if (frame.can_id == 0)
+        frame.can_id = CAN_ERR_CNT;                 // counters only frame is its own signature
+    memcpy(key, &frame.can_id, 4);
+    memcpy(key + 4, frame.data, 5);
+    key[9] = rec->iface;
+    for (size_t i = 0; i < sizeof(key); i++)
+        hash = (hash ^ key[i]) * 16777619U;
+    for (int probe = 0; probe < DASH_SIGNATURES; probe++) {
+        struct dash_signature *sig = &d->signatures[(hash + probe) & (DASH_SIGNATURES - 1)];
+        if (sig->id == frame.can_id && sig->iface == rec->iface && memcmp(sig->data, frame.data, 5) == 0) {
+            sig->count++;
+            return;
+        }
+        if (sig->id != 0)
+            continue;
+        if (d->signature_count >= DASH_SIGNATURES * 3 / 4)
+            break;                                  // keep probes short, rest goes to other
+        sig->id    = frame.can_id;
+        sig->iface = rec->iface;
+        memcpy(sig->data, frame.data, 5);
+        sig->count = 1;
+        if (frame.can_id == CAN_ERR_CNT)
+            snprintf(sig->text, sizeof(sig->text), "Count");
+        else
+            canerr_decode(&frame, sig->text, sizeof(sig->text));
+        d->signature_count++;
+        return;
+    }
+    d->other++;
+}
+
+void dash_add_batch(struct dash *d, const struct canerr_record *recs, int n) {
+    pthread_mutex_lock(&d->lock);
+    for (int i = 0; i < n; i++) {
+        const struct can_frame *frame = &recs[i].frame;
+        struct dash_iface *di = &d->ifaces[recs[i].iface];
+        int state;
+        if (recs[i].type != CANERR_FRAME_ERROR)
+            continue;
+        for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+            if (frame->can_id & (1U << bit))
+                di->classes[bit]++;
+        if (frame->can_id & CAN_ERR_CNT) {
+            di->tec = frame->data[6];
+            di->rec = frame->data[7];
+        }
+        if ((state = dash_next_state(frame, di->state)) != di->state) {
+            struct dash_transition *t = &d->transitions[d->transition_count++ % DASH_TRANSITIONS];
+            t->timestamp_ns = canerr_timespec_ns(&recs[i].timestamp);
+            t->iface = recs[i].iface;
+            t->from  = di->state;
+            t->to    = state;
+            di->state = state;
+        }
+        dash_count_signature(d, &recs[i]);
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+void dash_drop_client(struct dash_client *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->tx_len = 0;
+}
+
+// send queued bytes as far as socket takes them, on POLLOUT and before anything new
+bool dash_flush(struct dash_client *c) {
+    while (c->tx_len > 0) {
+        ssize_t ret = send(c->fd, c->tx, c->tx_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (ret <= 0) {
+            dash_drop_client(c);
+            return false;
+        }
+        memmove(c->tx, c->tx + ret, c->tx_len - ret);
+        c->tx_len -= ret;
+    }
+    if (c->closing)
+        dash_drop_client(c);
+    return c->fd >= 0;
+}
+
+// send what socket takes now and queue the rest for POLLOUT, only a client more than
+// DASH_QUEUE_SIZE behind is dropped
+bool dash_send(struct dash_client *c, const void *buf, size_t len) {
+    ssize_t ret = 0;
+
+    if (c->tx_len == 0) {
+        do
+            ret = send(c->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        while (ret < 0 && errno == EINTR);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            dash_drop_client(c);
+            return false;
+        }
+        if (ret < 0)
+            ret = 0;
+    }
+    if (len - ret > DASH_QUEUE_SIZE - c->tx_len) {
+        dash_drop_client(c);
+        return false;
+    }
+    memcpy(c->tx + c->tx_len, (const char *)buf + ret, len - ret);
+    c->tx_len += len - ret;
+    return true;
+}
+
+bool dash_send_frame(struct dash_client *c, int opcode, const char *payload, size_t len) {
+    uint8_t hdr[4] = { 0x80 | opcode };
+    size_t hdr_len = 2;
+
+    if (len < 126)
+        hdr[1] = len;
+    else {
+        hdr[1] = 126;
+        hdr[2] = len >> 8;
+        hdr[3] = len & 0xFF;
+        hdr_len = 4;
+    }
+    return dash_send(c, hdr, hdr_len) && dash_send(c, payload, len);
+}
+
+// answer GET / with page and GET /ws with WebSocket upgrade, returns false if client is done
+bool dash_http(struct dash *d, struct dash_client *c) {
+    char response[512], accept_key[32], handshake[128], *key;
+    uint8_t digest[20];
+    size_t len = 0, key_len;
+
+    if (strncmp(c->rx, "GET /ws ", 8) == 0 && (key = strcasestr(c->rx, "\r\nSec-WebSocket-Key:")) != NULL) {
+        key += 20;
+        key += strspn(key, " \t");
+        if ((key_len = strcspn(key, " \t\r\n")) > 64)
+            return false;
+        memcpy(handshake, key, key_len);
+        memcpy(handshake + key_len, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);   // GUID of RFC 6455
+        dash_sha1((uint8_t *)handshake, key_len + 36, digest);
+        dash_base64(digest, sizeof(digest), accept_key);
+        canerr_append(response, sizeof(response), &len, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                      "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept_key);
+        c->websocket = dash_send(c, response, len);
+        c->fresh     = true;
+        c->rx_len    = 0;
+        d->connections++;
+        return c->websocket;
+    }
+    if (strncmp(c->rx, "GET / ", 6) == 0) {
+        canerr_append(response, sizeof(response), &len, "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\n"
+                      "Content-Length: %zu\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n", strlen(dash_page));
+        if (dash_send(c, response, len))
+            dash_send(c, dash_page, strlen(dash_page));
+    } else {
+        canerr_append(response, sizeof(response), &len, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        dash_send(c, response, len);
+    }
+    return false;
+}
+
+// request bytes until empty line, then WebSocket frames of browser: close and ping need an answer
+void dash_receive(struct dash *d, struct dash_client *c) {
+    ssize_t ret = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - 1 - c->rx_len, MSG_DONTWAIT);
+    size_t pos = 0;
+
+    if (ret <= 0) {
+        if (ret == 0 || (errno != EAGAIN && errno != EINTR))
+            dash_drop_client(c);
+        return;
+    }
+    c->rx_len += ret;
+    c->rx[c->rx_len] = '\0';
+    if (!c->websocket) {
+        if (strstr(c->rx, "\r\n\r\n") != NULL) {
+            if (!dash_http(d, c) && c->fd >= 0) {
+                c->closing = true;                  // after queued answer is sent
+                dash_flush(c);
+            }
+        } else if (c->rx_len == sizeof(c->rx) - 1)
+            dash_drop_client(c);                    // header too long, not our page
+        return;
+    }
+    while (c->rx_len - pos >= 6) {                  // browser frames are always masked
+        uint8_t *f = (uint8_t *)c->rx + pos;
+        size_t len = f[1] & 0x7F, hdr = 6;
+        if (len == 126) {
+            if (c->rx_len - pos < 8)
+                break;
+            len = f[2] << 8 | f[3];
+            hdr = 8;
+        }
+        if ((f[1] & 0x7F) == 127 || !(f[1] & 0x80) || hdr + len > sizeof(c->rx) - 1) {
+            dash_drop_client(c);                    // nothing a dashboard page sends
+            return;
+        }
+        if (pos + hdr + len > c->rx_len)
+            break;
+        for (size_t i = 0; i < len; i++)
+            f[hdr + i] ^= f[hdr - 4 + i % 4];
+        if ((f[0] & 0x0F) == 0x8) {                 // close
+            if (dash_send_frame(c, 0x8, (char *)f + hdr, len < 2 ? len : 2)) {
+                c->closing = true;
+                dash_flush(c);
+            }
+            return;
+        }
+        if ((f[0] & 0x0F) == 0x9 && !dash_send_frame(c, 0xA, (char *)f + hdr, len))
+            return;                                 // ping answered by pong, text ignored
+        pos += hdr + len;
+    }
+    memmove(c->rx, c->rx + pos, c->rx_len - pos);
+    c->rx_len -= pos;
+}
+
+// top signatures by count, returns how many, called with lock held
+int dash_top(struct dash *d, int *top) {
+    int n = 0;
+
+    for (int slot = 0; slot < DASH_SIGNATURES; slot++) {
+        int i;
+        if (d->signatures[slot].id == 0)
+            continue;
+        for (i = n; i > 0 && d->signatures[top[i - 1]].count < d->signatures[slot].count; i--)
+            if (i < DASH_TOP)
+                top[i] = top[i - 1];
+        if (i < DASH_TOP) {
+            top[i] = slot;
+            if (n < DASH_TOP)
+                n++;
+        }
+    }
+    return n;
+}
+
+// JSON with changes since last push, or whole state, returns length, 0 if nothing changed
+size_t dash_message(struct dash *d, bool full, double seconds, const int *top, const uint64_t *top_counts, int top_n,
+                    uint64_t other, uint64_t transitions) {
+    char *out = d->msg;
+    size_t size = sizeof(d->msg), len = 0, empty;
+    const char *sep = "";
+
+    canerr_append(out, size, &len, "{\"ts\":%llu", (unsigned long long)canerr_now_ns());
+    empty = len;
+    if (full) {
+        canerr_append(out, size, &len, ",\"full\":true,\"classes\":[");
+        for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+            canerr_append(out, size, &len, "%s\"%s\"", bit ? "," : "", canerr_class_bit_names[bit]);
+        canerr_append(out, size, &len, "]");
+    }
+    canerr_append(out, size, &len, ",\"states\":{");
+    for (int i = 0; i < stream.count; i++)
+        if (full || d->snapshot[i].state != d->sent[i].state) {
+            canerr_append(out, size, &len, "%s\"%s\":\"%s\"", sep, stream.ifnames[i], dash_state_names[d->snapshot[i].state]);
+            sep = ",";
+        }
+    canerr_append(out, size, &len, "},\"counters\":{");
+    sep = "";
+    for (int i = 0; i < stream.count; i++)
+        if (d->snapshot[i].tec >= 0 && (full || d->snapshot[i].tec != d->sent[i].tec || d->snapshot[i].rec != d->sent[i].rec)) {
+            canerr_append(out, size, &len, "%s\"%s\":[%d,%d]", sep, stream.ifnames[i], d->snapshot[i].tec, d->snapshot[i].rec);
+            sep = ",";
+        }
+    canerr_append(out, size, &len, "},\"rates\":{");
+    sep = "";
+    for (int i = 0; i < stream.count; i++) {
+        const char *class_sep = "";
+        for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++) {
+            double rate = seconds > 0 ? (d->snapshot[i].classes[bit] - d->sent[i].classes[bit]) / seconds : 0;
+            rate = (double)(uint64_t)(rate * 10 + 0.5) / 10;
+            if (!full && rate == d->sent_rates[i][bit])
+                continue;
+            if (full && rate == 0)
+                continue;
+            if (*class_sep == '\0')
+                canerr_append(out, size, &len, "%s\"%s\":{", sep, stream.ifnames[i]);
+            canerr_append(out, size, &len, "%s\"%s\":%g", class_sep, canerr_class_bit_names[bit], rate);
+            class_sep = ",";
+            sep = ",";
+        }
+        if (*class_sep != '\0')
+            canerr_append(out, size, &len, "}");
+    }
+    canerr_append(out, size, &len, "}");
+    if (full || transitions > d->sent_transitions) {
+        uint64_t first = full ? 0 : d->sent_transitions;
+        if (transitions > DASH_TRANSITIONS && first < transitions - DASH_TRANSITIONS)
+            first = transitions - DASH_TRANSITIONS;  // older ones were overwritten
+        canerr_append(out, size, &len, ",\"transitions\":[");
+        for (uint64_t t = first; t < transitions; t++) {
+            const struct dash_transition *tr = &d->recent[t % DASH_TRANSITIONS];
+            canerr_append(out, size, &len, "%s{\"if\":\"%s\",\"ts\":%llu,\"from\":\"%s\",\"to\":\"%s\"}", t > first ? "," : "",
+                          stream.ifnames[tr->iface], (unsigned long long)tr->timestamp_ns,
+                          dash_state_names[tr->from], dash_state_names[tr->to]);
+        }
+        canerr_append(out, size, &len, "]");
+    }
+    if (full || top_n != d->top_count || memcmp(top, d->top, top_n * sizeof(int)) != 0 ||
+        memcmp(top_counts, d->top_counts, top_n * sizeof(uint64_t)) != 0) {
+        canerr_append(out, size, &len, ",\"top\":[");
+        for (int i = 0; i < top_n; i++) {
+            const struct dash_signature *sig = &d->signatures[top[i]];
+            canerr_append(out, size, &len, "%s{\"if\":\"%s\",\"n\":%llu,\"sig\":\"%s\"}", i ? "," : "",
+                          stream.ifnames[sig->iface], (unsigned long long)top_counts[i], sig->text);
+        }
+        canerr_append(out, size, &len, "],\"other\":%llu", (unsigned long long)other);
+    }
+    canerr_append(out, size, &len, "}");
+    if (!full && strcmp(out + empty, ",\"states\":{},\"counters\":{},\"rates\":{}}") == 0)
+        return 0;
+    return len;
+}
+
+// take snapshot of aggregates, push deltas to clients and whole state to new ones
+void dash_push(struct dash *d) {
+    uint64_t now = canerr_now_ns(), other, transitions;
+    double seconds = (double)(now - d->last_push_ns) / 1e9;
+    int top[DASH_TOP], top_n;
+    uint64_t top_counts[DASH_TOP];
+    size_t len;
+
+    pthread_mutex_lock(&d->lock);
+    memcpy(d->snapshot, d->ifaces, sizeof(d->snapshot));
+    top_n = dash_top(d, top);
+    for (int i = 0; i < top_n; i++)
+        top_counts[i] = d->signatures[top[i]].count;
+    other = d->other;
+    transitions = d->transition_count;              // signature texts never change once written
+    memcpy(d->recent, d->transitions, sizeof(d->recent));
+    pthread_mutex_unlock(&d->lock);
+
+    if ((len = dash_message(d, false, seconds, top, top_counts, top_n, other, transitions)) > 0)
+        for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+            if (d->clients[i].fd >= 0 && d->clients[i].websocket && !d->clients[i].fresh)
+                dash_send_frame(&d->clients[i], 0x1, d->msg, len);
+    for (int i = 0; i < stream.count; i++)
+        for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++) {
+            double rate = seconds > 0 ? (d->snapshot[i].classes[bit] - d->sent[i].classes[bit]) / seconds : 0;
+            d->sent_rates[i][bit] = (double)(uint64_t)(rate * 10 + 0.5) / 10;
+        }
+    for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+        if (d->clients[i].fd >= 0 && d->clients[i].fresh) {
+            len = dash_message(d, true, seconds, top, top_counts, top_n, other, transitions);
+            d->clients[i].fresh = false;
+            dash_send_frame(&d->clients[i], 0x1, d->msg, len);
+        }
+    memcpy(d->sent, d->snapshot, sizeof(d->sent));
+    memcpy(d->top, top, sizeof(top));
+    memcpy(d->top_counts, top_counts, sizeof(top_counts));
+    d->top_count = top_n;
+    d->sent_transitions = transitions;
+    d->last_push_ns = now;
+    d->pushes++;
+}
+
+void *dash_server(void *arg) {
+    struct dash *d = arg;
+    struct pollfd pfds[DASH_MAX_CLIENTS + 2];
+    uint64_t next_push = canerr_now_ns() + d->interval_ns;
+
+    while (1) {
+        uint64_t now = canerr_now_ns();
+        int n = 2;
+        bool stopping;
+
+        pthread_mutex_lock(&d->lock);
+        stopping = d->stopping;
+        pthread_mutex_unlock(&d->lock);
+        if (now >= next_push || stopping) {
+            dash_push(d);
+            next_push = now + d->interval_ns;
+        }
+        if (stopping)
+            break;
+        pfds[0] = (struct pollfd){ .fd = d->listen_fd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = d->wake_fd, .events = POLLIN };
+        for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+            if (d->clients[i].fd >= 0)
+                pfds[n++] = (struct pollfd){ .fd = d->clients[i].fd,
+                                             .events = POLLIN | (d->clients[i].tx_len > 0 ? POLLOUT : 0) };
+        if (poll(pfds, n, (next_push - now) / 1000000 + 1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error polling dashboard connections");
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(d->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK), i;
+            for (i = 0; fd >= 0 && i < DASH_MAX_CLIENTS && d->clients[i].fd >= 0; i++)
+                ;
+            if (fd >= 0 && i == DASH_MAX_CLIENTS)
+                close(fd);                          // all slots taken, browser retries
+            else if (fd >= 0)
+                d->clients[i] = (struct dash_client){ .fd = fd, .tx = d->clients[i].tx };
+        }
+        for (int p = 2; p < n; p++)
+            if (pfds[p].revents)
+                for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+                    if (d->clients[i].fd == pfds[p].fd) {
+                        if ((pfds[p].revents & POLLOUT) && !dash_flush(&d->clients[i]))
+                            break;
+                        if (pfds[p].revents & ~POLLOUT)
+                            dash_receive(d, &d->clients[i]);
+                        break;
+                    }
+    }
+    for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+        if (d->clients[i].fd >= 0) {
+            if (d->clients[i].websocket)
+                dash_send_frame(&d->clients[i], 0x8, "\x03\xE9", 2);   // 1001 going away
+            if (d->clients[i].fd >= 0 && dash_flush(&d->clients[i]))  // what socket takes without waiting
+                dash_drop_client(&d->clients[i]);
+        }
+    return NULL;
+}
+
+// Dashboard=[<host>:]<port>, localhost if no host is given
+void dash_open(struct dash *d, char *address, long interval_ms) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *res, *ai;
+    const int on = 1;
+
+    if (strspn(address, "0123456789") == strlen(address)) {
+        d->host = "localhost";
+        d->port = address;
+    } else
+        split_host_port(address, &d->host, &d->port, DASH_PORT);
+    if (getaddrinfo(d->host, d->port, &hints, &res) != 0) {
+        printf("Error: Can not resolve dashboard address %s\n", d->host);
+        exit(EXIT_FAILURE);
+    }
+    for (ai = res; ai != NULL && d->listen_fd < 0; ai = ai->ai_next) {
+        if ((d->listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+            continue;
+        setsockopt(d->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(d->listen_fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(d->listen_fd, DASH_MAX_CLIENTS) < 0) {
+            close(d->listen_fd);
+            d->listen_fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (d->listen_fd < 0)
+        err_exit("Error opening dashboard port");
+    if ((d->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        err_exit("Error creating dashboard eventfd");
+    for (int i = 0; i < DASH_MAX_CLIENTS; i++) {
+        d->clients[i].fd = -1;
+        if ((d->clients[i].tx = footprint_alloc(DASH_QUEUE_SIZE, 64, "dashboard send queues")) == NULL)
+            err_exit("Error allocating dashboard send queue");
+    }
+    for (int i = 0; i < CANERR_MAX_INTERFACES; i++)
+        d->ifaces[i].tec = d->ifaces[i].rec = d->sent[i].tec = d->sent[i].rec = -1;
+    d->interval_ns  = interval_ms * 1000000ULL;
+    d->last_push_ns = canerr_now_ns();
+    pthread_mutex_init(&d->lock, NULL);
+    d->active = true;
+    if ((errno = footprint_thread(&d->thread, dash_server, d)) != 0)
+        err_exit("Error starting dashboard thread");
+}
+
+// last push, then browsers are told that canerrdump went away
+void dash_close(struct dash *d) {
+    uint64_t one = 1;
+
+    if (!d->active)
+        return;
+    pthread_mutex_lock(&d->lock);
+    d->stopping = true;
+    pthread_mutex_unlock(&d->lock);
+    if (write(d->wake_fd, &one, sizeof(one)) < 0)
+        perror("Error waking dashboard thread");
+    pthread_join(d->thread, NULL);
+    close(d->wake_fd);
+    close(d->listen_fd);
+    for (int i = 0; i < DASH_MAX_CLIENTS; i++)
+        footprint_free(d->clients[i].tx);
+    fprintf(stderr, "Dashboard pushed %llu updates, %llu browser connections, %d signatures\n",
+            (unsigned long long)d->pushes, (unsigned long long)d->connections, d->signature_count);
+    d->active = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Load mode: traffic baseline without receiving data frames. Every interval netdev counters and //
+//  bit timing of each interface come from one RTM_GETLINK on a netlink socket kept open, and     //
+//  totals of CAN core from /proc/net/can/stats, so errors can be put in relation to frames at    //
+//  almost no CPU cost. Bus load is estimated from frames and bytes at nominal bit rate, with     //
+//  payload at data bit rate when CAN FD is configured, and LOAD_STUFF_PERCENT of stuff bits.     //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct load_sample {
+    uint64_t rx_packets, tx_packets;
+    uint64_t rx_bytes, tx_bytes;
+    uint64_t errors;                                // error frames received so far
+};
+
+struct load {
+    bool active;
+    int nl_fd;                                      // NETLINK_ROUTE, open for whole run
+    int proc_fd;                                    // /proc/net/can/stats, -1 if can module has none
+    uint32_t seq;
+    uint64_t interval_ns;
+    uint64_t next_ns;
+    uint64_t last_ns;
+    uint32_t bitrate[CANERR_MAX_INTERFACES];        // nominal, 0 if interface has no bit timing (vcan)
+    uint32_t data_bitrate[CANERR_MAX_INTERFACES];   // CAN FD data phase, 0 if not configured
+    struct load_sample now[CANERR_MAX_INTERFACES];
+    struct load_sample last[CANERR_MAX_INTERFACES];
+    uint64_t core[3], core_last[3];                 // CAN core transmitted, received and matched frames
+    char buf[LOAD_NETLINK_SIZE];
+};
+
+struct load load = { .nl_fd = -1, .proc_fd = -1 };
+
+// bit rates from IFLA_LINKINFO / IFLA_INFO_DATA of a CAN interface
+void load_linkinfo(struct load *l, int iface, struct rtattr *info) {
+    int len = RTA_PAYLOAD(info);
+
+    for (struct rtattr *rta = RTA_DATA(info); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        int data_len = RTA_PAYLOAD(rta);
+        if (rta->rta_type != IFLA_INFO_DATA)
+            continue;
+        for (struct rtattr *can = RTA_DATA(rta); RTA_OK(can, data_len); can = RTA_NEXT(can, data_len)) {
+            const struct can_bittiming *bt = RTA_DATA(can);
+            if (RTA_PAYLOAD(can) < sizeof(*bt))
+                continue;
+            if (can->rta_type == IFLA_CAN_BITTIMING)
+                l->bitrate[iface] = bt->bitrate;
+            else if (can->rta_type == IFLA_CAN_DATA_BITTIMING)
+                l->data_bitrate[iface] = bt->bitrate;
+        }
+    }
+}
+
+// netdev counters and bit rates of one interface, false if kernel did not answer
+bool load_query(struct load *l, int iface) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    struct nlmsghdr *nh;
+    ssize_t len;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len    = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type   = RTM_GETLINK;
+    req.nh.nlmsg_flags  = NLM_F_REQUEST;
+    req.nh.nlmsg_seq    = ++l->seq;
+    req.ifi.ifi_family  = AF_UNSPEC;
+    req.ifi.ifi_index   = stream.ifindexes[iface];
+    if (send(l->nl_fd, &req, req.nh.nlmsg_len, 0) < 0)
+        return false;
+    do                                              // answers to timed out requests are skipped
+        len = recv(l->nl_fd, l->buf, sizeof(l->buf), 0);
+    while (len > 0 && ((struct nlmsghdr *)l->buf)->nlmsg_seq != l->seq);
+    for (nh = (struct nlmsghdr *)l->buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+        struct ifinfomsg *ifi = NLMSG_DATA(nh);
+        int attr_len = IFLA_PAYLOAD(nh);
+        if (nh->nlmsg_type != RTM_NEWLINK)
+            return false;
+        l->bitrate[iface] = l->data_bitrate[iface] = 0;
+        for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, attr_len); rta = RTA_NEXT(rta, attr_len)) {
+            if (rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+                struct rtnl_link_stats64 stats;
+                memcpy(&stats, RTA_DATA(rta), sizeof(stats));   // attribute is only 4 byte aligned
+                l->now[iface].rx_packets = stats.rx_packets;
+                l->now[iface].tx_packets = stats.tx_packets;
+                l->now[iface].rx_bytes   = stats.rx_bytes;
+                l->now[iface].tx_bytes   = stats.tx_bytes;
+            } else if (rta->rta_type == IFLA_LINKINFO)
+                load_linkinfo(l, iface, rta);
+        }
+        return true;
+    }
+    return false;
+}
+
+// totals of CAN core, lines like "   123456 transmitted frames (TXF)"
+void load_proc(struct load *l) {
+    static const char *const names[] = { "transmitted frames (TXF)", "received frames (RXF)", "matched frames (RXMF)" };
+    ssize_t len;
+
+    if (l->proc_fd < 0 || (len = pread(l->proc_fd, l->buf, sizeof(l->buf) - 1, 0)) <= 0)
+        return;
+    l->buf[len] = '\0';
+    for (size_t i = 0; i < CANERR_COUNT(names); i++) {
+        char *name = strstr(l->buf, names[i]), *line;
+        if (name == NULL)
+            continue;
+        for (line = name; line > l->buf && line[-1] != '\n'; line--)
+            ;
+        l->core[i] = strtoull(line, NULL, 10);
+    }
+}
+
+void load_sample(struct load *l) {
+    for (int i = 0; i < stream.count; i++)
+        load_query(l, i);
+    load_proc(l);
+}
+
+// Load=<seconds>: open netlink socket and CAN core statistics, take first sample
+void load_open(struct load *l, long interval) {
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    struct timeval timeout = { .tv_sec = 1 };
+
+    if ((l->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0 ||
+        bind(l->nl_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        err_exit("Error opening netlink socket");
+    setsockopt(l->nl_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    l->proc_fd = open("/proc/net/can/stats", O_RDONLY | O_CLOEXEC);
+    l->interval_ns = interval * 1000000000ULL;
+    l->active = true;
+    load_sample(l);
+    memcpy(l->last, l->now, sizeof(l->last));
+    memcpy(l->core_last, l->core, sizeof(l->core_last));
+    l->last_ns = canerr_now_ns();
+    l->next_ns = l->last_ns + l->interval_ns;
+}
+
+void load_count(struct load *l, const struct canerr_record *recs, int n) {
+    for (int i = 0; i < n; i++)
+        if (recs[i].type == CANERR_FRAME_ERROR)
+            l->now[recs[i].iface].errors++;
+}
+
+// share of interval the bus was busy with these frames, -1 without bit timing
+double load_percent(struct load *l, int iface, uint64_t frames, uint64_t bytes, double seconds) {
+    double header = (double)frames * LOAD_FRAME_BITS, payload = (double)bytes * 8, busy;
+
+    if (l->bitrate[iface] == 0 || seconds <= 0)
+        return -1;
+    busy = header / l->bitrate[iface] + payload / (l->data_bitrate[iface] ? l->data_bitrate[iface] : l->bitrate[iface]);
+    return busy * (100 + LOAD_STUFF_PERCENT) / seconds;
+}
+
+// print frame rates, estimated load and error rates of interval, when it is due or forced at exit
+void load_report(struct load *l, bool force) {
+    uint64_t now = canerr_now_ns();
+    double seconds;
+
+    if (!l->active || (!force && now < l->next_ns))
+        return;
+    load_sample(l);
+    seconds = (double)(now - l->last_ns) / 1e9;
+    for (int i = 0; i < stream.count; i++) {
+        struct load_sample *cur = &l->now[i], *last = &l->last[i];
+        uint64_t rx = cur->rx_packets - last->rx_packets, tx = cur->tx_packets - last->tx_packets;
+        uint64_t errors = cur->errors - last->errors;
+        double percent = load_percent(l, i, rx + tx, cur->rx_bytes - last->rx_bytes + cur->tx_bytes - last->tx_bytes, seconds);
+        size_t len = 0;
+        canerr_append(out_buf, sizeof(out_buf), &len, "LOAD %s %.0f frames/s (rx %.0f, tx %.0f), ", stream.ifnames[i],
+                      (rx + tx) / seconds, rx / seconds, tx / seconds);
+        if (percent >= 0)
+            canerr_append(out_buf, sizeof(out_buf), &len, "%.1f%% of %u kbit/s, ", percent, l->bitrate[i] / 1000);
+        else
+            canerr_append(out_buf, sizeof(out_buf), &len, "load unknown without bit timing, ");
+        canerr_append(out_buf, sizeof(out_buf), &len, "%.1f errors/s", errors / seconds);
+        if (rx + tx > 0)
+            canerr_append(out_buf, sizeof(out_buf), &len, ", %.2f per 1000 frames", errors * 1000.0 / (rx + tx));
+        canerr_append(out_buf, sizeof(out_buf), &len, "\n");
+        fwrite(out_buf, 1, len, stdout);
+    }
+    if (l->proc_fd >= 0)
+        printf("LOAD can core %.0f frames/s received, %.0f frames/s sent, %.0f frames/s matched by sockets\n",
+               (l->core[1] - l->core_last[1]) / seconds, (l->core[0] - l->core_last[0]) / seconds,
+               (l->core[2] - l->core_last[2]) / seconds);
+    fflush(stdout);
+    memcpy(l->last, l->now, sizeof(l->last));
+    memcpy(l->core_last, l->core, sizeof(l->core_last));
+    l->last_ns = now;
+    l->next_ns = now + l->interval_ns;
+}
+
+void load_close(struct load *l) {
+    if (!l->active)
+        return;
+    close(l->nl_fd);
+    if (l->proc_fd >= 0)
+        close(l->proc_fd);
+    l->active = false;
+}
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Expect mode: pattern over decoded errors like "WarningTX Prot(Bit0,DATA){3,} PassiveTX BusOff //
+//  within 500ms" is compiled once into a position automaton (Glushkov NFA, one state per         //
+//  repeated item copy, no epsilon moves), whose state set is a 64 bit mask. Every error frame    //
+//  costs one match test per item and one OR per active state. An attempt starts on a frame       //
+//  matching the first item, in each interface of its own, and ends as match when the last item   //
+//  is reached, as violation when a frame leads to no state, or as timeout when "within" passed.  //
+//  Frames before an attempt, data frames and kernel log messages are ignored.                    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct expect_item {
+    char text[EXPECT_ITEM_SIZE];                    // as written in pattern, for reports
+    canid_t classes;                                // error class bits which must all be set
+    uint8_t data[5];                                // sub codes, bits must be set in data[1] and data[2]
+    uint8_t exact;                                  // bit i: data[i] must be equal, not only contain bits
+    bool any;
+    uint64_t positions;                             // automaton states standing for this item
+};
+
+struct expect_attempt {
+    uint64_t states;                                // 0 while no attempt runs
+    uint64_t start_ns;                              // timestamp of first frame
+    int events;
+};
+
+struct expect {
+    bool active;
+    bool once;                                      // stop after first verdict
+    bool done;
+    int item_count;
+    int count;                                      // automaton states
+    struct expect_item items[EXPECT_MAX_STATES];
+    int item_of[EXPECT_MAX_STATES];
+    uint64_t first, final, follow[EXPECT_MAX_STATES];
+    uint64_t within_ns;                             // 0 without time limit
+    struct expect_attempt attempts[CANERR_MAX_INTERFACES];
+    uint64_t matches, violations, timeouts;
+};
+
+struct expect expect;
+
+// add error name to item, same names as canerrsim options plus class names of decoded output
+void expect_name(struct expect_item *item, const char *name) {
+    if (strcasecmp(name, "Any") == STR_EQUAL) {
+        item->any = true;
+        return;
+    }
+    for (size_t i = 0; i < CANERR_COUNT(canerr_class_codes); i++)
+        if (strcasecmp(name, canerr_class_codes[i].name) == STR_EQUAL) {
+            item->classes |= canerr_class_codes[i].value;
+            return;
+        }
+    for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++)
+        if (strcasecmp(name, canerr_class_bit_names[bit]) == STR_EQUAL) {
+            item->classes |= 1U << bit;             // Ctrl, Prot, Trans, Count, LostArBit
+            return;
+        }
+    for (size_t s = 0; s < CANERR_COUNT(canerr_subclasses); s++) {
+        const struct canerr_subclass *sub = &canerr_subclasses[s];
+        if (strcasecmp(name, sub->unspec_option) == STR_EQUAL) {
+            item->classes |= sub->class_mask;
+            item->data[sub->data_index] = 0;
+            item->exact |= 1U << sub->data_index;
+            return;
+        }
+        for (size_t i = 0; i < sub->count; i++)
+            if (sub->codes[i].value != 0 && strcasecmp(name, sub->codes[i].name) == STR_EQUAL) {
+                item->classes |= sub->class_mask;
+                if (sub->is_bitmask)
+                    item->data[sub->data_index] |= (uint8_t)sub->codes[i].value;
+                else {
+                    item->data[sub->data_index] = (uint8_t)sub->codes[i].value;
+                    item->exact |= 1U << sub->data_index;
+                }
+                return;
+            }
+    }
+    printf("Error: Unknown error name %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+void expect_add_state(struct expect *e, int item, bool optional, bool repeat, bool *opt, bool *rep) {
+    if (e->count == EXPECT_MAX_STATES) {
+        printf("Error: Expect pattern needs more than %d states, use smaller repeat counts\n", EXPECT_MAX_STATES);
+        exit(EXIT_FAILURE);
+    }
+    opt[e->count] = optional;
+    rep[e->count] = repeat;
+    e->item_of[e->count] = item;
+    e->items[item].positions |= 1ULL << e->count;
+    e->count++;
+}
+
+// "Name", "Name(Sub,Sub...)" or "Any" followed by {n}, {n,}, {n,m}, ?, * or +
+void expect_parse_item(struct expect *e, char *token, bool *opt, bool *rep) {
+    struct expect_item *item = &e->items[e->item_count];
+    long min = 1, max = 1;
+    char name[64], *quant = token + strcspn(token, "({?*+"), *end, *save;
+
+    snprintf(item->text, sizeof(item->text), "%s", token);
+    snprintf(name, sizeof(name), "%.*s", (int)(quant - token), token);
+    if (name[0] != '\0')
+        expect_name(item, name);
+    if (*quant == '(') {                            // Prot(Bit0,DATA) needs all names
+        if ((end = strchr(quant, ')')) == NULL)
+            goto invalid;
+        *end = '\0';
+        for (char *sub = strtok_r(quant + 1, ",", &save); sub != NULL; sub = strtok_r(NULL, ",", &save))
+            expect_name(item, sub);
+        quant = end + 1;
+    }
+    if (*quant == '{') {
+        min = max = strtol(quant + 1, &end, 10);
+        if (end == quant + 1)
+            goto invalid;
+        if (*end == ',' && end[1] == '}')
+            max = -1, end++;
+        else if (*end == ',')
+            max = strtol(end + 1, &end, 10);
+        if (*end != '}' || end[1] != '\0' || (max >= 0 && max < min) || max == 0)
+            goto invalid;
+    } else if (*quant != '\0' && quant[1] != '\0')
+        goto invalid;
+    else if (*quant == '?')
+        min = 0;
+    else if (*quant == '*')
+        min = 0, max = -1;
+    else if (*quant == '+')
+        max = -1;
+    if (!item->any && item->classes == 0)
+        goto invalid;
+
+    for (long i = 0; i < min; i++)                  // {3,} is three copies, last one repeating
+        expect_add_state(e, e->item_count, false, max < 0 && i == min - 1, opt, rep);
+    if (max < 0 && min == 0)
+        expect_add_state(e, e->item_count, true, true, opt, rep);
+    for (long i = min; i < max; i++)
+        expect_add_state(e, e->item_count, true, false, opt, rep);
+    e->item_count++;
+    return;
+invalid:
+    printf("Error: Invalid pattern item %s\n", item->text);
+    exit(EXIT_FAILURE);
+}
+
+// "within" takes durations like 500ms, 2s or 250us
+uint64_t expect_duration(const char *text) {
+    char *unit;
+    double value = text != NULL ? strtod(text, &unit) : -1;
+
+    if (value > 0 && strcasecmp(unit, "us") == STR_EQUAL)
+        return value * 1e3;
+    if (value > 0 && strcasecmp(unit, "ms") == STR_EQUAL)
+        return value * 1e6;
+    if (value > 0 && strcasecmp(unit, "s") == STR_EQUAL)
+        return value * 1e9;
+    printf("Error: Expect needs a duration like 500ms after within\n");
+    exit(EXIT_FAILURE);
+}
+
+// Expect=<pattern>: compile pattern into first, follow and final state masks
+void expect_open(struct expect *e, const char *pattern, bool once) {
+    char text[1024], *save, *token;
+    bool opt[EXPECT_MAX_STATES], rep[EXPECT_MAX_STATES];
+
+    snprintf(text, sizeof(text), "%s", pattern);
+    for (token = strtok_r(text, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save)) {
+        if (strcasecmp(token, "within") == STR_EQUAL)
+            e->within_ns = expect_duration(strtok_r(NULL, " \t", &save));
+        else if (e->item_count == EXPECT_MAX_STATES) {
+            printf("Error: Expect pattern has more than %d items\n", EXPECT_MAX_STATES);
+            exit(EXIT_FAILURE);
+        } else
+            expect_parse_item(e, token, opt, rep);
+    }
+    if (e->count == 0) {
+        printf("Error: Expect pattern has no items\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < e->count; i++) {            // optional states can be skipped
+        e->follow[i] = rep[i] ? 1ULL << i : 0;
+        for (int j = i + 1; j < e->count; j++) {
+            e->follow[i] |= 1ULL << j;
+            if (!opt[j])
+                break;
+        }
+    }
+    for (int j = 0; j < e->count; j++) {
+        e->first |= 1ULL << j;
+        if (!opt[j])
+            break;
+    }
+    for (int j = e->count - 1; j >= 0; j--) {
+        e->final |= 1ULL << j;
+        if (!opt[j])
+            break;
+    }
+    e->once   = once;
+    e->active = true;
+}
+
+bool expect_item_matches(const struct expect_item *item, const struct can_frame *frame) {
+    if (item->any)
+        return true;
+    if ((frame->can_id & item->classes) != item->classes)
+        return false;
+    for (int i = 1; i < 5; i++) {
+        if (item->exact & (1U << i) ? frame->data[i] != item->data[i] : (frame->data[i] & item->data[i]) != item->data[i])
+            return false;
+    }
+    return true;
+}
+
+// states reachable by next frame
+uint64_t expect_next(const struct expect *e, uint64_t states) {
+    uint64_t next = 0;
+
+    for (int i = 0; i < e->count; i++)
+        if (states & (1ULL << i))
+            next |= e->follow[i];
+    return next;
+}
+
+// items which could have come next, like "PassiveTX or Prot(Bit0,DATA){3,}"
+void expect_expected(const struct expect *e, uint64_t states, char *out, size_t size) {
+    size_t len = 0;
+    uint64_t items = 0;
+
+    for (int i = 0; i < e->count; i++)
+        if (states & (1ULL << i))
+            items |= 1ULL << e->item_of[i];
+    out[0] = '\0';
+    for (int i = 0; i < e->item_count; i++)
+        if (items & (1ULL << i))
+            canerr_append(out, size, &len, "%s%s", len > 0 ? " or " : "", e->items[i].text);
+}
+
+// print verdict of finished attempt, with ExpectOnce main loop ends after it
+void expect_verdict(struct expect *e, int iface, const char *verdict, uint64_t end_ns, const char *detail) {
+    struct expect_attempt *a = &e->attempts[iface];
+
+    printf("EXPECT %s on %s after %d events in %.3f ms%s\n", verdict, stream.ifnames[iface], a->events,
+           (double)(end_ns - a->start_ns) / 1e6, detail);
+    fflush(stdout);
+    a->states = 0;
+    if (e->once) {
+        e->done = true;
+        canerr_stream_cancel(&stream);
+    }
+}
+
+void expect_timeout(struct expect *e, int iface, uint64_t now) {
+    char expected[512], detail[600];
+
+    expect_expected(e, expect_next(e, e->attempts[iface].states), expected, sizeof(expected));
+    snprintf(detail, sizeof(detail), ", still waiting for %s", expected);
+    e->timeouts++;
+    expect_verdict(e, iface, "timeout", now, detail);
+}
+
+// advance automaton of frame's interface, O(items + states) per frame
+void expect_step(struct expect *e, const struct canerr_record *rec) {
+    struct expect_attempt *a = &e->attempts[rec->iface];
+    uint64_t ts = canerr_timespec_ns(&rec->timestamp), matched = 0, next = 0;
+
+    for (int i = 0; i < e->item_count; i++)
+        if (expect_item_matches(&e->items[i], &rec->frame))
+            matched |= e->items[i].positions;
+    if (a->states != 0 && e->within_ns > 0 && ts - a->start_ns > e->within_ns) {
+        expect_timeout(e, rec->iface, a->start_ns + e->within_ns);
+        if (e->done)
+            return;
+    }
+    if (a->states != 0) {
+        next = expect_next(e, a->states);
+        if ((next & matched) == 0) {                // earliest frame which breaks the sequence
+            char expected[512], line[1200], detail[1800];
+            size_t len = format_line(rec, false, line, sizeof(line));
+            if (len > 0 && line[len - 1] == '\n')
+                line[len - 1] = '\0';
+            expect_expected(e, next, expected, sizeof(expected));
+            snprintf(detail, sizeof(detail), ", expected %s, got: %s", expected, line);
+            e->violations++;
+            expect_verdict(e, rec->iface, "violated", ts, detail);
+            if (e->done)
+                return;
+        }
+        next &= matched;
+    }
+    if (a->states == 0) {                           // frame may start a new attempt
+        if ((next = e->first & matched) == 0)
+            return;
+        a->start_ns = ts;
+        a->events   = 0;
+    }
+    a->states = next;
+    a->events++;
+    if (next & e->final) {
+        e->matches++;
+        expect_verdict(e, rec->iface, "match", ts, "");
+    }
+}
+
+void expect_batch(struct expect *e, const struct canerr_record *recs, int n) {
+    for (int i = 0; i < n && !e->done; i++)
+        if (recs[i].type == CANERR_FRAME_ERROR)
+            expect_step(e, &recs[i]);
+}
+
+// live streams: attempts run out of time without any further frame too
+void expect_tick(struct expect *e, uint64_t now) {
+    if (!e->active || e->within_ns == 0)
+        return;
+    for (int i = 0; i < stream.count && !e->done; i++)
+        if (e->attempts[i].states != 0 && now - e->attempts[i].start_ns > e->within_ns)
+            expect_timeout(e, i, e->attempts[i].start_ns + e->within_ns);
+}
+
+// summary to stderr, returns exit code: 0 only if something matched and nothing failed
+int expect_close(struct expect *e) {
+    if (!e->active)
+        return 0;
+    for (int i = 0; i < stream.count && !e->done; i++)
+        if (e->attempts[i].states != 0) {
+            printf("EXPECT incomplete on %s after %d events, stream ended\n", stream.ifnames[i], e->attempts[i].events);
+            e->timeouts++;
+        }
+    fprintf(stderr, "Expect: %llu matches, %llu violations, %llu timeouts\n", (unsigned long long)e->matches,
+            (unsigned long long)e->violations, (unsigned long long)e->timeouts);
+    return e->matches > 0 && (e->once || e->violations + e->timeouts == 0) ? 0 : 1;
+}
+
+
+
+// format and output one received batch to stdout, per interface files, journal, MQTT, SQLite or bridge,
+// stdout only when none of the others is active, dashboard counts it next to any of them
+void output_batch(const struct canerr_record *recs, int n) {
+    size_t len = 0, pushed = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (shard_count > 0) {
+            size_t line = format_line(&recs[i], false, out_buf, sizeof(out_buf));
+            shard_push(shards[recs[i].iface], out_buf, line);
+            pushed += line;
+        } else if (journal.fd < 0 && !mqtt.active && !sqlite.active && bridge.fd < 0)
+            len += format_line(&recs[i], stream.count > 1, out_buf + len, sizeof(out_buf) - len);
+        if (mqtt.active)
+            mqtt_add(&mqtt, &recs[i]);
+        CANERR_PROBE(frame_decoded, recs[i].iface, recs[i].frame.can_id,
+                     canerr_timespec_ns(&recs[i].timestamp), canerr_now_ns());
+    }
+    if (shard_count > 0)
+        shard_wake_all();
+    if (journal.fd >= 0)
+        journal_send_batch(&journal, recs, n);
+    if (sqlite.active)
+        sqlite_push_batch(&sqlite, recs, n);
+    if (dash.active)
+        dash_add_batch(&dash, recs, n);
+    if (load.active)
+        load_count(&load, recs, n);
+    if (bridge.fd >= 0)
+        bridge_send_batch(&bridge, recs, n);
+    if (len > 0) {
+        fwrite(out_buf, 1, len, stdout);                    // whole batch with one write
+        fflush(stdout);
+    }
+    if (expect.active)                                      // verdicts follow the lines they are about
+        expect_batch(&expect, recs, n);
+    CANERR_PROBE(output_flushed, n, len + pushed, canerr_now_ns());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Capture=<file>: binary capture written with O_DIRECT from two aligned block buffers. Main      //
+//  thread fills one buffer while writer thread writes the other, so capture I/O bypasses page    //
+//  cache and never evicts pages of other applications. Partially filled block is written in      //
+//  place when bus is idle and rewritten when it fills up, readers use block header used bytes.   //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct capture {
+    int fd;
+    bool direct;                                    // O_DIRECT is active
+    size_t block_size;
+    char *header;                                   // aligned CANERR_CAP_HEADER_SIZE buffer
+    char *bufs[2];                                  // aligned block buffers
+    int cur;                                        // buffer filled by main thread
+    size_t used;                                    // bytes used in current buffer, block header included
+    uint64_t seq;                                   // block number of current buffer
+    bool dirty;                                     // current buffer has records which are not on disk
+    uint64_t flushed_ns;                            // time of last write of partial block
+    uint64_t flush_ns;                              // partial block write interval
+    struct canerr_cap_header *live;                 // header page mapped shared, followers read committed
+    uint64_t pending_commit;                        // partial block written while full one was still queued
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int submitted;                                  // buffer handed to writer thread, -1 if none
+    uint64_t submitted_seq;
+    bool stopping;
+    uint64_t records;
+    uint64_t blocks;
+};
+
+struct capture capture = { .fd = -1, .flush_ns = CAPTURE_FLUSH_MS * 1000000ULL };
+
+// write whole aligned buffer, drops O_DIRECT if file system accepted the flag but refuses the write
+void capture_pwrite(struct capture *cap, const char *buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t ret = pwrite(cap->fd, buf, size, offset);
+        if (ret < 0 && errno == EINVAL && cap->direct) {
+            fcntl(cap->fd, F_SETFL, fcntl(cap->fd, F_GETFL) & ~O_DIRECT);
+            cap->direct = false;
+            fprintf(stderr, "Capture file system refused O_DIRECT write, using page cache\n");
+            continue;
+        }
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error writing capture file");
+            return;
+        }
+        buf    += ret;
+        size   -= ret;
+        offset += ret;
+    }
+}
+
+off_t capture_block_offset(struct capture *cap, uint64_t seq) {
+    return CANERR_CAP_HEADER_SIZE + (off_t)seq * cap->block_size;
+}
+
+// publish end of complete records to followers, called with lock held once data is written
+void capture_commit(struct capture *cap, uint64_t offset) {
+    if (cap->live != NULL && offset > cap->live->committed)
+        __atomic_store_n(&cap->live->committed, offset, __ATOMIC_RELEASE);
+}
+
+void *capture_writer(void *arg) {
+    struct capture *cap = arg;
+
+    pthread_mutex_lock(&cap->lock);
+    while (1) {
+        while (cap->submitted < 0 && !cap->stopping)
+            pthread_cond_wait(&cap->cond, &cap->lock);
+        if (cap->submitted < 0)
+            break;                                  // stopping and nothing left to write
+        pthread_mutex_unlock(&cap->lock);
+        capture_pwrite(cap, cap->bufs[cap->submitted], cap->block_size, capture_block_offset(cap, cap->submitted_seq));
+        pthread_mutex_lock(&cap->lock);
+        cap->blocks++;
+        capture_commit(cap, capture_block_offset(cap, cap->submitted_seq + 1));
+        capture_commit(cap, cap->pending_commit);   // later partial block is on disk too
+        cap->submitted = -1;
+        pthread_cond_broadcast(&cap->cond);
+    }
+    pthread_mutex_unlock(&cap->lock);
+    return NULL;
+}
+
+void capture_start_block(struct capture *cap) {
+    memset(cap->bufs[cap->cur], 0, cap->block_size);   // zero padding after last record
+    cap->used  = sizeof(struct canerr_cap_block);
+    cap->dirty = false;
+}
+
+void capture_seal_block(struct capture *cap) {
+    struct canerr_cap_block *hdr = (struct canerr_cap_block *)cap->bufs[cap->cur];
+    hdr->magic = CANERR_CAP_BLOCK_MAGIC;
+    hdr->used  = cap->used - sizeof(struct canerr_cap_block);
+    hdr->seq   = cap->seq;
+}
+
+// hand full buffer to writer thread and continue in the other one, waits while both are busy
+void capture_submit(struct capture *cap) {
+    capture_seal_block(cap);
+    pthread_mutex_lock(&cap->lock);
+    while (cap->submitted >= 0)
+        pthread_cond_wait(&cap->cond, &cap->lock);
+    cap->submitted     = cap->cur;
+    cap->submitted_seq = cap->seq;
+    pthread_cond_broadcast(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+    cap->cur ^= 1;
+    cap->seq++;
+    capture_start_block(cap);
+}
+
+// write partially filled block in place, so readers see records even when block fills slowly
+void capture_flush(struct capture *cap) {
+    if (cap->fd < 0 || !cap->dirty)
+        return;
+    capture_seal_block(cap);
+    capture_pwrite(cap, cap->bufs[cap->cur], cap->block_size, capture_block_offset(cap, cap->seq));
+    pthread_mutex_lock(&cap->lock);
+    if (cap->submitted < 0)                         // followers must not pass a block still queued
+        capture_commit(cap, capture_block_offset(cap, cap->seq) + cap->used);
+    else
+        cap->pending_commit = capture_block_offset(cap, cap->seq) + cap->used;
+    pthread_mutex_unlock(&cap->lock);
+    cap->dirty = false;
+    cap->flushed_ns = canerr_now_ns();
+}
+
+// at most one partial block write per CaptureFlush interval, full blocks go through writer thread anyway
+void capture_flush_due(struct capture *cap) {
+    if (cap->fd >= 0 && cap->dirty && canerr_now_ns() - cap->flushed_ns >= cap->flush_ns)
+        capture_flush(cap);
+}
+
+void capture_add(struct capture *cap, const struct canerr_record *rec) {
+    if (cap->used + canerr_cap_record_bytes(rec) > cap->block_size)
+        capture_submit(cap);
+    cap->used += canerr_cap_put(cap->bufs[cap->cur] + cap->used, rec);
+    cap->dirty = true;
+    cap->records++;
+}
+
+void capture_open(struct capture *cap, const char *path, size_t block_size, struct canerr_stream *s) {
+    struct canerr_cap_header *hdr;
+    char buf[PATH_MAX + 64];
+
+    cap->block_size = block_size;
+    cap->direct = true;
+    cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);   // read for header mapping
+    if (cap->fd < 0 && errno == EINVAL) {           // tmpfs and some others have no O_DIRECT
+        cap->direct = false;
+        cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (cap->fd < 0) {
+        snprintf(buf, sizeof(buf), "Error opening capture file %s", path);
+        err_exit(buf);
+    }
+    if ((cap->header  = footprint_alloc(CANERR_CAP_HEADER_SIZE, 4096, "capture header")) == NULL ||
+        (cap->bufs[0] = footprint_alloc(block_size, 4096, "capture blocks")) == NULL ||
+        (cap->bufs[1] = footprint_alloc(block_size, 4096, "capture blocks")) == NULL)
+        err_exit("Error allocating capture buffers");
+
+    hdr = (struct canerr_cap_header *)cap->header;
+    memcpy(hdr->magic, CANERR_CAP_MAGIC, sizeof(hdr->magic));
+    hdr->version    = CANERR_CAP_VERSION;
+    hdr->block_size = block_size;
+    hdr->start_ns   = canerr_now_ns();
+    hdr->if_count   = s->count;
+    for (int i = 0; i < s->count; i++)
+        memcpy(hdr->ifnames[i], s->ifnames[i], IF_NAMESIZE);
+    capture_pwrite(cap, cap->header, CANERR_CAP_HEADER_SIZE, 0);
+    cap->live = mmap(NULL, CANERR_CAP_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+    if (cap->live == MAP_FAILED)
+        cap->live = NULL;                           // followers then see a finished capture
+    else
+        __atomic_store_n(&cap->live->flags, CANERR_CAP_LIVE, __ATOMIC_RELEASE);
+
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->cond, NULL);
+    cap->submitted = -1;
+    cap->cur = 0;
+    cap->seq = 0;
+    capture_start_block(cap);
+    if ((errno = footprint_thread(&cap->thread, capture_writer, cap)) != 0)
+        err_exit("Error starting capture writer thread");
+}
+
+void capture_close(struct capture *cap) {
+    if (cap->fd < 0)
+        return;
+    capture_flush(cap);
+    pthread_mutex_lock(&cap->lock);
+    cap->stopping = true;
+    pthread_cond_broadcast(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+    pthread_join(cap->thread, NULL);
+    if (cap->live != NULL) {                        // committed is final now, followers may stop
+        __atomic_store_n(&cap->live->flags, 0, __ATOMIC_RELEASE);
+        munmap(cap->live, CANERR_CAP_HEADER_SIZE);
+        cap->live = NULL;
+    }
+    fsync(cap->fd);
+    close(cap->fd);
+    cap->fd = -1;
+    fprintf(stderr, "Captured %llu frames in %llu blocks of %zu KiB%s\n", (unsigned long long)cap->records,
+            (unsigned long long)(cap->seq + (cap->used > sizeof(struct canerr_cap_block))), cap->block_size / 1024,
+            cap->direct ? " with O_DIRECT" : "");
+    footprint_free(cap->header);
+    footprint_free(cap->bufs[0]);
+    footprint_free(cap->bufs[1]);
+}
+
+// Read=<file>: open capture and take interface names from its header, returns file descriptor
+int capture_read_open(const char *path, struct canerr_stream *s, size_t *block_size) {
+    struct canerr_cap_header hdr;
+    char buf[PATH_MAX + 64];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        snprintf(buf, sizeof(buf), "Error opening capture file %s", path);
+        err_exit(buf);
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || memcmp(hdr.magic, CANERR_CAP_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != CANERR_CAP_VERSION || hdr.block_size < 4096 || hdr.block_size > (1 << 24) ||
+        hdr.if_count > CANERR_MAX_INTERFACES) {
+        printf("Error: %s is not a canerrdump capture file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    memset(s, 0, sizeof(*s));
+    if ((s->cancel_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)   // Ctrl+C stops Follow mode
+        err_exit("Error creating eventfd");
+    s->count = hdr.if_count;
+    for (int i = 0; i < s->count; i++) {
+        memcpy(s->ifnames[i], hdr.ifnames[i], IF_NAMESIZE);
+        s->ifnames[i][IF_NAMESIZE - 1] = '\0';
+    }
+    *block_size = hdr.block_size;
+    if (hdr.flags & CANERR_CAP_INCIDENT) {          // snapshot of canerrdump Incident=
+        hdr.note[sizeof(hdr.note) - 1] = '\0';
+        printf("Incident: %s\n", hdr.note);
+    }
+    return fd;
+}
+
+// decode records of one block starting at *pos through normal output path, software errmask like
+// CAN_RAW_ERR_FILTER, data frames only when asked for like on live interfaces
+void capture_decode_block(const char *block, size_t block_size, size_t *pos, can_err_mask_t errmask, bool data_frames) {
+    const struct canerr_cap_record *rec;
+    int n = 0;
+
+    while ((rec = canerr_cap_next(block, block_size, pos)) != NULL) {
+        struct canerr_record *out = &records[n];
+        if (rec->iface >= stream.count ||
+            (rec->type != CANERR_FRAME_ERROR && rec->type != CANERR_FRAME_KMSG && !data_frames) ||
+            !canerr_record_set(out, rec->type, (const uint8_t *)(rec + 1), rec->len))
+            continue;
+        if (rec->type == CANERR_FRAME_ERROR && !(out->frame.can_id & errmask & CAN_ERR_MASK))
+            continue;
+        out->timestamp.tv_sec  = rec->timestamp_ns / 1000000000ULL;
+        out->timestamp.tv_nsec = rec->timestamp_ns % 1000000000ULL;
+        out->iface  = rec->iface;
+        out->ifname = stream.ifnames[rec->iface];
+        if (++n == CANERR_MAX_BATCH) {
+            output_batch(records, n);
+            n = 0;
+        }
+    }
+    if (n > 0)                                      // data frames point into block buffer
+        output_batch(records, n);
+}
+
+// decode all records of capture file, block is buffer of block_size bytes
+int capture_read_all(int fd, char *block, size_t block_size, can_err_mask_t errmask, bool data_frames) {
+    for (off_t offset = CANERR_CAP_HEADER_SIZE; pread(fd, block, block_size, offset) == (ssize_t)block_size; offset += block_size) {
+        size_t pos = 0;
+        if (((struct canerr_cap_block *)block)->magic != CANERR_CAP_BLOCK_MAGIC)
+            break;                                  // never written, end of capture
+        capture_decode_block(block, block_size, &pos, errmask, data_frames);
+    }
+    return 0;
+}
+
+// Follow=<file>: decode capture which canerrdump is still writing, like tail -f. File is mapped shared
+// and read only, records are decoded only up to offset writer committed, so writer never waits for
+// followers. inotify wakes up on every write, polling interval covers file systems without inotify.
+int capture_follow(int fd, const char *path, char *block, size_t block_size, can_err_mask_t errmask, bool data_frames) {
+    struct pollfd pfds[2] = { { .fd = stream.cancel_fd, .events = POLLIN }, { .fd = -1, .events = POLLIN } };
+    off_t offset = CANERR_CAP_HEADER_SIZE;          // block being decoded
+    size_t map_len = FOLLOW_MAP_STEP, pos = 0;
+    char events[4096] __attribute__((aligned(8)));
+    char *map;
+
+    if ((map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        err_exit("Error mapping capture file");
+    if ((pfds[1].fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) >= 0 && inotify_add_watch(pfds[1].fd, path, IN_MODIFY) < 0) {
+        close(pfds[1].fd);
+        pfds[1].fd = -1;
+    }
+
+    while (1) {
+        const struct canerr_cap_header *hdr = (const struct canerr_cap_header *)map;
+        bool live = canerr_cap_flags(hdr) & CANERR_CAP_LIVE;
+        uint64_t committed = canerr_cap_committed(hdr);
+        struct stat st;
+
+        if (!live && committed == 0 && fstat(fd, &st) == 0)
+            committed = st.st_size;                 // finished capture of older writer
+        if (committed > map_len) {
+            size_t len = (committed + FOLLOW_MAP_STEP - 1) / FOLLOW_MAP_STEP * FOLLOW_MAP_STEP;
+            if ((map = mremap(map, map_len, len, MREMAP_MAYMOVE)) == MAP_FAILED)
+                err_exit("Error mapping capture file");
+            map_len = len;
+        }
+        while (offset + sizeof(struct canerr_cap_block) <= committed) {
+            struct canerr_cap_block *bh = (struct canerr_cap_block *)block;
+            size_t avail = committed - offset < block_size ? committed - offset : block_size;
+            memcpy(block, map + offset, sizeof(*bh));
+            if (avail > pos)                        // earlier records of block are in buffer already
+                memcpy(block + pos, map + offset + pos, avail - pos);
+            if (bh->magic == CANERR_CAP_BLOCK_MAGIC) {
+                if (bh->used > avail - sizeof(*bh))
+                    bh->used = avail - sizeof(*bh); // writer is adding records behind committed
+                capture_decode_block(block, block_size, &pos, errmask, data_frames);
+            }
+            if (avail < block_size)
+                break;                              // rest of block is not committed yet
+            offset += block_size;
+            pos = 0;
+        }
+        if (!live)
+            break;
+        if (poll(pfds, 2, FOLLOW_POLL_MS) > 0) {
+            if (pfds[0].revents)
+                break;                              // Ctrl+C
+            while (pfds[1].fd >= 0 && read(pfds[1].fd, events, sizeof(events)) > 0)
+                ;
+        }
+    }
+    if (pfds[1].fd >= 0)
+        close(pfds[1].fd);
+    munmap(map, map_len);
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Incident=<dir>: every record of the last IncidentPre plus IncidentPost seconds is kept in a   //
+//  RAM ring in capture format. An error frame matching IncidentTrigger marks an incident, once   //
+//  its post window passed the records around it are copied out of the ring and a writer thread   //
+//  stores them as a self contained capture file, while receiving goes on. Header note tells      //
+//  trigger, TEC/REC and drops at that time, Read= decodes the file like any capture.             //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct incident {
+    bool active;
+    const char *dir;
+    uint64_t pre_ns, post_ns;
+    struct expect trigger;                          // only items are used, any one of them fires
+    char *ring;                                     // capture records, wrap is filled with a type 0 record
+    size_t ring_size;
+    uint64_t head, tail;                            // bytes ever added and evicted, offsets modulo ring_size
+    uint64_t evicted_ns;                            // newest record evicted for space before its time
+    bool pending;                                   // trigger seen, post window still runs
+    bool waiting;                                   // post window passed, writer still busy
+    uint64_t trigger_ns, end_ns;
+    int trigger_iface;
+    const char *trigger_text;                       // trigger item which fired
+    uint64_t triggers;                              // triggers counted into pending incident
+    int tec[CANERR_MAX_INTERFACES], rec[CANERR_MAX_INTERFACES];   // last error counters, -1 unknown
+    int trigger_tec[CANERR_MAX_INTERFACES], trigger_rec[CANERR_MAX_INTERFACES];   // and at trigger
+    uint32_t drops[CANERR_MAX_INTERFACES];          // kernel drops at trigger
+    char *header;                                   // handed to writer with snapshot
+    char *snapshot;                                 // records of one incident, written by writer thread
+    size_t snapshot_used;
+    char *block;
+    char path[PATH_MAX];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool busy;                                      // writer owns header, snapshot and path
+    bool stopping;
+    uint64_t written;
+    uint64_t delayed;                               // incidents which waited for writer
+};
+
+struct incident incident = { .trigger_iface = -1 };
+
+// write one finished incident file, header first, records in blocks of INCIDENT_BLOCK_SIZE
+void incident_write(struct incident *inc) {
+    struct canerr_cap_block *bh = (struct canerr_cap_block *)inc->block;
+    const struct canerr_cap_record *rec;
+    size_t pos = 0, used = sizeof(*bh), records = 0;
+    uint64_t seq = 0;
+    bool failed;
+    int fd = open(inc->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error opening incident file %s: %s\n", inc->path, strerror(errno));
+        return;
+    }
+    failed = write(fd, inc->header, CANERR_CAP_HEADER_SIZE) != CANERR_CAP_HEADER_SIZE;
+    memset(inc->block, 0, INCIDENT_BLOCK_SIZE);
+    while (!failed) {
+        rec = canerr_cap_record_at(inc->snapshot, inc->snapshot_used, &pos);
+        if (rec == NULL || used + rec->size > INCIDENT_BLOCK_SIZE) {
+            if (used == sizeof(*bh))
+                break;
+            bh->magic = CANERR_CAP_BLOCK_MAGIC;
+            bh->used  = used - sizeof(*bh);
+            bh->seq   = seq++;
+            failed = write(fd, inc->block, INCIDENT_BLOCK_SIZE) != INCIDENT_BLOCK_SIZE;
+            memset(inc->block, 0, INCIDENT_BLOCK_SIZE);
+            used = sizeof(*bh);
+        }
+        if (rec == NULL)
+            break;
+        memcpy(inc->block + used, rec, rec->size);
+        used += rec->size;
+        records++;
+    }
+    if (failed || fdatasync(fd) < 0)                // incidents are what must survive a power cut
+        fprintf(stderr, "Error writing incident file %s: %s\n", inc->path, strerror(errno));
+    else
+        fprintf(stderr, "Incident written to %s, %zu records\n", inc->path, records);
+    close(fd);
+}
+
+void *incident_writer(void *arg) {
+    struct incident *inc = arg;
+
+    pthread_mutex_lock(&inc->lock);
+    while (1) {
+        while (!inc->busy && !inc->stopping)
+            pthread_cond_wait(&inc->cond, &inc->lock);
+        if (!inc->busy)
+            break;
+        pthread_mutex_unlock(&inc->lock);
+        incident_write(inc);
+        pthread_mutex_lock(&inc->lock);
+        inc->written++;
+        inc->busy = false;
+        pthread_cond_broadcast(&inc->cond);
+    }
+    pthread_mutex_unlock(&inc->lock);
+    return NULL;
+}
+
+// IncidentTrigger=<names>: error names of Expect, like "BusOff Trans Prot(Bit0,DATA)"
+void incident_open(struct incident *inc, const char *dir, long pre_s, long post_s, const char *trigger, long ring_kib) {
+    char text[1024], *save;
+    bool opt[EXPECT_MAX_STATES], rep[EXPECT_MAX_STATES];
+
+    snprintf(text, sizeof(text), "%s", trigger);
+    for (char *token = strtok_r(text, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save)) {
+        if (inc->trigger.item_count == EXPECT_MAX_STATES) {
+            printf("Error: Invalid option IncidentTrigger=%s ( at most %d error names )\n", trigger, EXPECT_MAX_STATES);
+            exit(EXIT_FAILURE);
+        }
+        inc->trigger.count = 0;                     // no automaton, item list only
+        expect_parse_item(&inc->trigger, token, opt, rep);
+    }
+    if (inc->trigger.item_count == 0) {
+        printf("Error: IncidentTrigger has no error names\n");
+        exit(EXIT_FAILURE);
+    }
+    inc->dir       = dir;
+    inc->pre_ns    = pre_s * 1000000000ULL;
+    inc->post_ns   = post_s * 1000000000ULL;
+    inc->ring_size = ring_kib * 1024;
+    for (int i = 0; i < CANERR_MAX_INTERFACES; i++)
+        inc->tec[i] = inc->rec[i] = -1;
+    if ((inc->ring     = footprint_alloc(inc->ring_size, 64, "incident ring")) == NULL ||
+        (inc->snapshot = footprint_alloc(inc->ring_size, 64, "incident snapshot")) == NULL ||
+        (inc->header   = footprint_alloc(CANERR_CAP_HEADER_SIZE, 64, "incident header")) == NULL ||
+        (inc->block    = footprint_alloc(INCIDENT_BLOCK_SIZE, 64, "incident block")) == NULL)
+        err_exit("Error allocating incident buffers");
+    pthread_mutex_init(&inc->lock, NULL);
+    pthread_cond_init(&inc->cond, NULL);
+    if ((errno = footprint_thread(&inc->thread, incident_writer, inc)) != 0)
+        err_exit("Error starting incident writer thread");
+    inc->active = true;
+}
+
+// oldest record leaves ring, returns its timestamp
+uint64_t incident_evict(struct incident *inc) {
+    size_t pos = inc->tail % inc->ring_size;
+    const struct canerr_cap_record *rec = (const struct canerr_cap_record *)(inc->ring + pos);
+
+    if (inc->ring_size - pos < sizeof(*rec)) {      // gap too small for a fill record
+        inc->tail += inc->ring_size - pos;
+        return 0;
+    }
+    inc->tail += rec->size;
+    return rec->type != 0 ? rec->timestamp_ns : 0;
+}
+
+const struct canerr_cap_record *incident_oldest(const struct incident *inc) {
+    size_t pos = inc->tail % inc->ring_size;
+
+    if (inc->tail == inc->head || inc->ring_size - pos < sizeof(struct canerr_cap_record))
+        return NULL;
+    return (const struct canerr_cap_record *)(inc->ring + pos);
+}
+
+// append record, records never wrap, rest of ring before wrap is filled instead
+void incident_push(struct incident *inc, const struct canerr_record *rec) {
+    size_t size = canerr_cap_record_bytes(rec), pos = inc->head % inc->ring_size;
+    size_t fill = pos + size > inc->ring_size ? inc->ring_size - pos : 0;
+    uint64_t ts = canerr_timespec_ns(&rec->timestamp), keep = inc->pre_ns + inc->post_ns, evicted;
+    const struct canerr_cap_record *old;
+
+    while (inc->head - inc->tail + fill + size > inc->ring_size)
+        if ((evicted = incident_evict(inc)) > inc->evicted_ns)
+            inc->evicted_ns = evicted;
+    if (fill >= sizeof(struct canerr_cap_record)) {
+        struct canerr_cap_record *pad = (struct canerr_cap_record *)(inc->ring + pos);
+        memset(pad, 0, sizeof(*pad));
+        pad->size = fill;                           // smaller than one record, fits its size field
+    }
+    inc->head += fill;
+    inc->head += canerr_cap_put(inc->ring + inc->head % inc->ring_size, rec);
+    while ((old = incident_oldest(inc)) != NULL && (old->type == 0 || old->timestamp_ns + keep < ts) &&
+           (!inc->pending || old->timestamp_ns + inc->pre_ns < inc->trigger_ns))   // waits for writer
+        incident_evict(inc);
+}
+
+// post window passed: copy records around trigger and hand them to writer, while writer is still busy
+// with last incident this one stays pending and its records in ring
+void incident_finish(struct incident *inc) {
+    struct canerr_cap_header *hdr = (struct canerr_cap_header *)inc->header;
+    uint64_t from = inc->trigger_ns - inc->pre_ns, offset = inc->tail;
+    time_t secs = inc->trigger_ns / 1000000000ULL;
+    size_t len = 0;
+    char stamp[32];
+    struct tm tm;
+
+    pthread_mutex_lock(&inc->lock);
+    if (inc->busy && !inc->stopping) {
+        pthread_mutex_unlock(&inc->lock);
+        if (!inc->waiting)
+            inc->delayed++;
+        inc->waiting = true;
+        return;
+    }
+    while (inc->busy)                               // at exit last incident is written anyway
+        pthread_cond_wait(&inc->cond, &inc->lock);
+    pthread_mutex_unlock(&inc->lock);
+    inc->pending = false;
+    inc->waiting = false;
+
+    inc->snapshot_used = 0;
+    while (offset < inc->head) {
+        size_t pos = offset % inc->ring_size;
+        const struct canerr_cap_record *rec = (const struct canerr_cap_record *)(inc->ring + pos);
+        if (inc->ring_size - pos < sizeof(*rec)) {
+            offset += inc->ring_size - pos;
+            continue;
+        }
+        offset += rec->size;
+        if (rec->type != 0 && rec->timestamp_ns >= from && rec->timestamp_ns <= inc->end_ns) {
+            memcpy(inc->snapshot + inc->snapshot_used, rec, rec->size);
+            inc->snapshot_used += rec->size;
+        }
+    }
+
+    memset(hdr, 0, CANERR_CAP_HEADER_SIZE);
+    memcpy(hdr->magic, CANERR_CAP_MAGIC, sizeof(hdr->magic));
+    hdr->version    = CANERR_CAP_VERSION;
+    hdr->block_size = INCIDENT_BLOCK_SIZE;
+    hdr->start_ns   = from;
+    hdr->if_count   = stream.count;
+    hdr->flags      = CANERR_CAP_INCIDENT;
+    hdr->trigger_ns = inc->trigger_ns;
+    for (int i = 0; i < stream.count; i++)
+        memcpy(hdr->ifnames[i], stream.ifnames[i], IF_NAMESIZE);
+    localtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    canerr_append(hdr->note, sizeof(hdr->note), &len, "%s on %s at %s.%03llu, %llu triggers, %.0f s before and %.0f s after",
+                  inc->trigger_text, stream.ifnames[inc->trigger_iface], stamp,
+                  (unsigned long long)(inc->trigger_ns / 1000000 % 1000), (unsigned long long)inc->triggers,
+                  inc->pre_ns / 1e9, inc->post_ns / 1e9);
+    for (int i = 0; i < stream.count; i++) {
+        canerr_append(hdr->note, sizeof(hdr->note), &len, "; %s", stream.ifnames[i]);
+        if (inc->trigger_tec[i] >= 0)
+            canerr_append(hdr->note, sizeof(hdr->note), &len, " TEC %d REC %d", inc->trigger_tec[i], inc->trigger_rec[i]);
+        canerr_append(hdr->note, sizeof(hdr->note), &len, " drops %u", inc->drops[i]);
+    }
+    if (inc->evicted_ns >= from)                    // error storm filled ring faster than IncidentPre
+        canerr_append(hdr->note, sizeof(hdr->note), &len, "; ring kept only %.1f s before trigger, raise IncidentRing",
+                      inc->evicted_ns < inc->trigger_ns ? (inc->trigger_ns - inc->evicted_ns) / 1e9 : 0.0);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(inc->path, sizeof(inc->path), "%s/incident-%s.%03llu-%s.cap", inc->dir, stamp,
+             (unsigned long long)(inc->trigger_ns / 1000000 % 1000), stream.ifnames[inc->trigger_iface]);
+    printf("Incident: %s\n", hdr->note);
+    fflush(stdout);
+
+    pthread_mutex_lock(&inc->lock);
+    inc->busy = true;
+    pthread_cond_broadcast(&inc->cond);
+    pthread_mutex_unlock(&inc->lock);
+}
+
+// keep records, counters and drops, start incident on first matching error frame
+void incident_add_batch(struct incident *inc, const struct canerr_record *recs, int n) {
+    for (int i = 0; i < n; i++) {
+        const struct canerr_record *rec = &recs[i];
+        const struct can_frame *frame = &rec->frame;
+        uint64_t ts = canerr_timespec_ns(&rec->timestamp);
+
+        if (inc->pending && !inc->waiting && ts > inc->end_ns)
+            incident_finish(inc);
+        incident_push(inc, rec);
+        if (rec->type != CANERR_FRAME_ERROR)
+            continue;
+        if (frame->can_id & CAN_ERR_CNT) {
+            inc->tec[rec->iface] = frame->data[6];
+            inc->rec[rec->iface] = frame->data[7];
+        }
+        for (int t = 0; t < inc->trigger.item_count; t++) {
+            if (!expect_item_matches(&inc->trigger.items[t], frame))
+                continue;
+            if (inc->pending && ts > inc->end_ns)
+                break;                              // last incident waits for writer, this one is lost
+            if (!inc->pending) {
+                inc->trigger_text  = inc->trigger.items[t].text;
+                inc->pending       = true;
+                inc->trigger_ns    = ts;
+                inc->end_ns        = ts + inc->post_ns;
+                inc->trigger_iface = rec->iface;
+                inc->triggers      = 0;
+                memcpy(inc->drops, stream.drops, sizeof(inc->drops));
+                memcpy(inc->trigger_tec, inc->tec, sizeof(inc->tec));
+                memcpy(inc->trigger_rec, inc->rec, sizeof(inc->rec));
+            }
+            inc->triggers++;
+            break;
+        }
+    }
+}
+
+// live streams: post window also ends without any further frame
+void incident_tick(struct incident *inc, uint64_t now) {
+    if (inc->active && inc->pending && now > inc->end_ns)
+        incident_finish(inc);
+}
+
+void incident_close(struct incident *inc) {
+    if (!inc->active)
+        return;
+    pthread_mutex_lock(&inc->lock);
+    inc->stopping = true;
+    pthread_mutex_unlock(&inc->lock);
+    if (inc->pending)                               // stopped during post window, keep what is there
+        incident_finish(inc);
+    pthread_mutex_lock(&inc->lock);
+    pthread_cond_broadcast(&inc->cond);
+    pthread_mutex_unlock(&inc->lock);
+    pthread_join(inc->thread, NULL);
+    fprintf(stderr, "Incidents: %llu written, %llu waited for writer\n",
+            (unsigned long long)inc->written, (unsigned long long)inc->delayed);
+    footprint_free(inc->ring);
+    footprint_free(inc->snapshot);
+    footprint_free(inc->header);
+    footprint_free(inc->block);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  BpfStats mode: eBPF socket filter on each interface socket counts error classes and sub codes //
+//  in an array map and drops every frame, so nothing is copied to user space. Program is         //
+//  generated from canerr.h tables, so counters have exactly the names canerrdump prints.          //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct bpf_prog_buf {
+    struct bpf_insn insns[BPF_MAX_INSNS];
+    int count;
+};
+
+struct bpf_stats {
+    int map_fd;
+    int slots;                                       // used counters per interface
+    char names[BPF_SLOTS][32];                       // counter names, same for all interfaces
+    uint64_t last[CANERR_MAX_INTERFACES][BPF_SLOTS]; // counter values at previous report
+};
+
+struct bpf_stats bpf_stats;
+
+long bpf_syscall(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+int bpf_emit(struct bpf_prog_buf *p, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    if (p->count >= BPF_MAX_INSNS) {
+        fprintf(stderr, "Error: eBPF program too long\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&p->insns[p->count], 0, sizeof(struct bpf_insn));
+    p->insns[p->count].code    = code;
+    p->insns[p->count].dst_reg = dst;
+    p->insns[p->count].src_reg = src;
+    p->insns[p->count].off     = off;
+    p->insns[p->count].imm     = imm;
+    return p->count++;
+}
+
+// point forward jump emitted at index jmp to next instruction to be emitted
+void bpf_patch(struct bpf_prog_buf *p, int jmp) {
+    p->insns[jmp].off = p->count - jmp - 1;
+}
+
+// allocate named counter slot (same order for every interface)
+int bpf_slot(struct bpf_stats *st, const char *format, const char *name) {
+    if (st->slots >= BPF_SLOTS) {
+        fprintf(stderr, "Error: too many eBPF counters\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(st->names[st->slots], sizeof(st->names[0]), format, name);
+    return st->slots++;
+}
+
+// map[key]++ : r1..r5 and r0 are clobbered, r6..r9 survive
+void bpf_emit_inc(struct bpf_prog_buf *p, int map_fd, int key) {
+    bpf_emit(p, BPF_ST  | BPF_MEM | BPF_W,    BPF_REG_10, 0, -20, key);
+    bpf_emit(p, BPF_LD  | BPF_DW  | BPF_IMM,  BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+    bpf_emit(p, 0, 0, 0, 0, 0);                                            // second half of 64 bit immediate
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X,  BPF_REG_2, BPF_REG_10, 0, 0);
+    bpf_emit(p, BPF_ALU64 | BPF_ADD | BPF_K,  BPF_REG_2, 0, 0, -20);
+    bpf_emit(p, BPF_JMP | BPF_CALL,           0, 0, 0, BPF_FUNC_map_lookup_elem);
+    bpf_emit(p, BPF_JMP | BPF_JEQ | BPF_K,    BPF_REG_0, 0, 2, 0);        // no such key
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_K,  BPF_REG_1, 0, 0, 1);
+    bpf_emit(p, BPF_STX | BPF_XADD | BPF_DW,  BPF_REG_0, BPF_REG_1, 0, 0); // atomic add, many CPUs may run filter
+}
+
+// returns jump to patch at end of class block, taken when class bit is not set in r7 (CAN ID)
+int bpf_emit_class_test(struct bpf_prog_buf *p, canid_t mask) {
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_7, 0, 0);
+    bpf_emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_1, 0, 0, mask);
+    return bpf_emit(p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_1, 0, 0, 0);
+}
+
+// count sub codes of one subclass, data byte is loaded to r8
+void bpf_emit_subclass(struct bpf_prog_buf *p, struct bpf_stats *st, int base, const struct canerr_subclass *sub, const char *format) {
+    int skip_class = bpf_emit_class_test(p, sub->class_mask);
+    int ends[64], end_count = 0;
+
+    bpf_emit(p, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_8, BPF_REG_10, -16 + offsetof(struct can_frame, data) + sub->data_index, 0);
+    if (sub->is_bitmask) {
+        int jmp = bpf_emit(p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_8, 0, 0, 0);
+        bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, format, "Unspec"));
+        bpf_patch(p, jmp);
+        for (size_t i = 0; i < sub->count; i++) {
+            bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_8, 0, 0);
+            bpf_emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_1, 0, 0, sub->codes[i].value);
+            jmp = bpf_emit(p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_1, 0, 0, 0);
+            bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, format, sub->codes[i].name));
+            bpf_patch(p, jmp);
+        }
+    } else {
+        for (size_t i = 0; i < sub->count && end_count < 64; i++) {
+            int jmp = bpf_emit(p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_8, 0, 0, sub->codes[i].value);
+            bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, format, sub->codes[i].name));
+            ends[end_count++] = bpf_emit(p, BPF_JMP | BPF_JA, 0, 0, 0, 0);
+            bpf_patch(p, jmp);
+        }
+        bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, format, "Unknown"));
+        for (int i = 0; i < end_count; i++)
+            bpf_patch(p, ends[i]);
+    }
+    bpf_patch(p, skip_class);
+}
+
+// generate socket filter which counts into slots base.. of the map and drops all frames
+void bpf_generate(struct bpf_prog_buf *p, struct bpf_stats *st, int base) {
+    int out[2];
+
+    p->count  = 0;
+    st->slots = 0;
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);   // r6 = skb
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);   // skb_load_bytes(skb, 0, fp - 16, 16)
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, 0);
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_10, 0, 0);
+    bpf_emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, -16);
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, sizeof(struct can_frame));
+    bpf_emit(p, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_skb_load_bytes);
+    out[0] = bpf_emit(p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 0, 0);    // shorter than can_frame
+    bpf_emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_10, -16, 0);  // r7 = can_id
+    out[1] = bpf_emit_class_test(p, CAN_ERR_FLAG);                          // data frame
+
+    bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, "%s", "Errors"));
+    for (size_t bit = 0; bit < CANERR_COUNT(canerr_class_bit_names); bit++) {
+        int jmp = bpf_emit_class_test(p, 1U << bit);
+        bpf_emit_inc(p, st->map_fd, base + bpf_slot(st, "%s", canerr_class_bit_names[bit]));
+        bpf_patch(p, jmp);
+    }
+    bpf_emit_subclass(p, st, base, CANERR_SUB_CTRL, "Ctrl(%s)");
+    bpf_emit_subclass(p, st, base, CANERR_SUB_PROT, "Prot(%s)");
+    bpf_emit_subclass(p, st, base, CANERR_SUB_LOC,  "Loc(%s)");
+    bpf_emit_subclass(p, st, base, CANERR_SUB_TRX,  "Trans(%s)");
+
+    bpf_patch(p, out[0]);
+    bpf_patch(p, out[1]);
+    bpf_emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);           // keep 0 bytes, frame is dropped
+    bpf_emit(p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+// create counter map and attach generated filter to every socket of stream, returns -1 with errno set
+int bpf_stats_attach(struct bpf_stats *st, struct canerr_stream *s) {
+    static struct bpf_prog_buf prog;
+    static char log[65536];
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = BPF_MAP_TYPE_ARRAY;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(uint64_t);
+    attr.max_entries = CANERR_MAX_INTERFACES * BPF_SLOTS;
+    if ((st->map_fd = bpf_syscall(BPF_MAP_CREATE, &attr)) < 0)
+        return -1;
+
+    for (int i = 0; i < s->count; i++) {
+        int prog_fd;
+        bpf_generate(&prog, st, i * BPF_SLOTS);
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+        attr.insns     = (uintptr_t)prog.insns;
+        attr.insn_cnt  = prog.count;
+        attr.license   = (uintptr_t)"Dual BSD/GPL";
+        attr.log_buf   = (uintptr_t)log;
+        attr.log_size  = sizeof(log);
+        attr.log_level = 1;
+        log[0] = '\0';
+        if ((prog_fd = bpf_syscall(BPF_PROG_LOAD, &attr)) < 0) {
+            int err = errno;
+            fprintf(stderr, "%s", log);                 // verifier explains what it rejected
+            errno = err;
+            return -1;
+        }
+        if (setsockopt(s->socks[i], SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) < 0)
+            return -1;
+        close(prog_fd);                                 // socket keeps program alive
+    }
+    return 0;
+}
+
+uint64_t bpf_stats_read(struct bpf_stats *st, int iface, int slot) {
+    union bpf_attr attr;
+    uint32_t key = iface * BPF_SLOTS + slot;
+    uint64_t value = 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = st->map_fd;
+    attr.key    = (uintptr_t)&key;
+    attr.value  = (uintptr_t)&value;
+    bpf_syscall(BPF_MAP_LOOKUP_ELEM, &attr);
+    return value;
+}
+
+// print counters which changed since last report, like "vcan0 Errors=12 BusOff=1 Prot(Bit0)=5 Loc(DATA)=5"
+void bpf_stats_report(struct bpf_stats *st, struct canerr_stream *s) {
+    for (int i = 0; i < s->count; i++) {
+        size_t len = 0;
+        canerr_append(out_buf, sizeof(out_buf), &len, "%s", s->ifnames[i]);
+        for (int slot = 0; slot < st->slots; slot++) {
+            uint64_t value = bpf_stats_read(st, i, slot);
+            if (slot == 0 || value != st->last[i][slot])
+                canerr_append(out_buf, sizeof(out_buf), &len, " %s=%llu", st->names[slot],
+                              (unsigned long long)(value - st->last[i][slot]));
+            st->last[i][slot] = value;
+        }
+        canerr_append(out_buf, sizeof(out_buf), &len, "\n");
+        fwrite(out_buf, 1, len, stdout);
+    }
+    fflush(stdout);
+    if (load.active) {                                  // filter drops error frames, it counted them
+        for (int i = 0; i < s->count; i++)
+            load.now[i].errors = bpf_stats_read(st, i, 0);
+        load_report(&load, true);
+    }
+}
+
+// report in-kernel counters every interval seconds until SIGINT or SIGTERM
+int run_bpf_stats(struct canerr_stream *s, long interval) {
+    uint64_t next = canerr_now_ns() + interval * 1000000000ULL;
+
+    if (bpf_stats_attach(&bpf_stats, s) < 0)
+        err_exit("Error loading eBPF statistics filter");
+    printf("Counting errors in kernel, new ones are shown every %ld seconds...\n", interval);
+    fflush(stdout);
+
+    while (1) {
+        uint64_t now = canerr_now_ns();
+        int timeout = now >= next ? 0 : (int)((next - now) / 1000000) + 1;
+        if (canerr_stream_read(s, records, CANERR_MAX_BATCH, timeout) < 0) {  // only wakes up on cancel,
+            if (errno == ECANCELED)                                        // filter drops every frame
+                break;
+            perror("Error waiting on CAN sockets");
+            return 1;
+        }
+        if (canerr_now_ns() >= next) {
+            bpf_stats_report(&bpf_stats, s);
+            next += interval * 1000000000ULL;
+        }
+    }
+    bpf_stats_report(&bpf_stats, s);                   // final partial interval
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Footprint report: static state, arena parts and thread stacks, printed when start finished.   //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t footprint_heap(void) {
+#ifdef FOOTPRINT_HEAP_CHECK
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// resident set size of whole process in KiB, includes code and libraries
+long footprint_rss_kib(void) {
+    char buf[2048], *line;
+    int fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+    ssize_t len;
+
+    if (fd < 0)
+        return -1;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    line = strstr(buf, "VmRSS:");
+    return line != NULL ? strtol(line + 6, NULL, 10) : -1;
+}
+
+void footprint_line(const char *what, size_t size, size_t *total) {
+    fprintf(stderr, "  %-28s %10zu bytes\n", what, size);
+    *total += size;
+}
+
+// start finished: give back unused reservation, lock arena and report every byte canerrdump owns
+void footprint_seal(struct footprint *f) {
+    size_t page = sysconf(_SC_PAGESIZE), mapped, total = 0;
+
+    if (!f->active)
+        return;
+    mapped = (f->used + page - 1) & ~(page - 1);
+    munmap(f->arena + mapped, FOOTPRINT_RESERVE - mapped);
+    f->locked = mapped > 0 && mlock(f->arena, mapped) == 0;
+    f->heap_at_seal = footprint_heap();
+    f->sealed = true;
+
+    fprintf(stderr, "Footprint profile, memory owned by canerrdump:\n");
+    footprint_line("receive stream", sizeof(stream), &total);
+    footprint_line("record batch", sizeof(records), &total);
+    footprint_line("output batch", sizeof(out_buf), &total);
+    footprint_line("format template", sizeof(format_ops), &total);
+    footprint_line("journal batch", sizeof(journal), &total);
+    footprint_line("MQTT state", sizeof(mqtt), &total);
+    footprint_line("capture state", sizeof(capture), &total);
+    footprint_line("bridge batch", sizeof(bridge), &total);
+    footprint_line("SQLite state", sizeof(sqlite), &total);
+    footprint_line("dashboard state", sizeof(dash), &total);
+    footprint_line("load sampling", sizeof(load), &total);
+    footprint_line("incident state", sizeof(incident), &total);
+    for (int i = 0; i < f->part_count; i++)
+        footprint_line(f->parts[i].what, f->parts[i].size, &total);
+    if (mapped > f->used)
+        footprint_line("arena alignment and padding", mapped - f->used, &total);
+    if (f->threads > 0)
+        footprint_line("helper thread stacks", (size_t)f->threads * (FOOTPRINT_STACK_SIZE + page), &total);
+    fprintf(stderr, "  %-28s %10zu bytes (%zu KiB), arena %s\n", "Total", total, (total + 1023) / 1024,
+            f->locked ? "locked in RAM" : "not locked, raise RLIMIT_MEMLOCK to lock it");
+    if (sqlite.active)
+        fprintf(stderr, "  %-28s %10d bytes, allocated by SQLite as needed\n", "SQLite heap limit", SQLITE_HEAP_LIMIT);
+#ifdef FOOTPRINT_HEAP_CHECK
+    fprintf(stderr, "  %-28s %10zu bytes\n", "libc heap at start", f->heap_at_seal);
+#endif
+    fprintf(stderr, "  %-28s %10ld KiB (includes code, libraries and main stack)\n", "Resident set now",
+            footprint_rss_kib());
+}
+
+// at exit: prove that nothing was allocated after start
+void footprint_close(struct footprint *f) {
+    if (!f->sealed)
+        return;
+#ifdef FOOTPRINT_HEAP_CHECK
+    if (footprint_heap() > f->heap_at_seal && sqlite.lib != NULL)
+        fprintf(stderr, "libc heap grew by %zu bytes after start, SQLite peak was %lld of its %d bytes\n",
+                footprint_heap() - f->heap_at_seal, sqlite.api.memory_highwater(0), SQLITE_HEAP_LIMIT);
+    else if (footprint_heap() > f->heap_at_seal)
+        fprintf(stderr, "Warning: libc heap grew by %zu bytes after start\n", footprint_heap() - f->heap_at_seal);
+    else
+        fprintf(stderr, "Footprint kept, no heap allocations after start\n");
+#endif
+}
+
+
+
+int main(int argc, char *argv[]) {
+    // struct can_filter filter;
+    can_err_mask_t errmask;
+    bool show_bits = false;
+    bool data_frames = false;
+    bool hw_timestamps = false;
+    bool kernel_log = false;
+    const char *phc_path = NULL;
+    long batch = CANERR_MAX_BATCH;
+    long bpf_interval = 0;
+    long load_interval = 0;
+    const char *expect_pattern = NULL;
+    long coalesce_ms = 0, coalesce_enter = 200, coalesce_leave = 50;
+    uint64_t start_ns;
+    bool expect_once = false;
+    const char *incident_dir = NULL;
+    const char *incident_trigger = "BusOff Trans";
+    long incident_pre = 10, incident_post = 5, incident_ring = 8192;
+    const char *output_dir = NULL;
+    const char *capture_file = NULL;
+    const char *read_file = NULL;
+    long capture_block = 128;
+    long capture_flush = CAPTURE_FLUSH_MS;
+    bool follow = false;
+    int read_timeout;
+    bool use_journal = false;
+    long journal_rate = 1000;
+    const char *journal_socket = JOURNAL_SOCKET;
+    char *mqtt_address = NULL;
+    const char *mqtt_topic = "canerr";
+    long mqtt_qos = 0;
+    long mqtt_interval = 10;
+    long mqtt_queue = 1000;
+    long output_ring = SHARD_RING_SIZE / 1024;
+    char *bridge_address = NULL;
+    const char *sqlite_file = NULL;
+    char *dash_address = NULL;
+    long dash_interval = 1000;
+    long sqlite_batch = SQLITE_BATCH;
+    long sqlite_flush = SQLITE_FLUSH_MS;
+    bool use_footprint = FOOTPRINT_DEFAULT;
+    char *read_block;
+    size_t read_block_size = 0;
+    int read_fd = -1;
+    uint64_t incomplete = 0;
+    char interfaces[256];
+    char buf[256];
+
+    printf("CAN Sockets Error Messages Dumper\n");
+    if (argc < 2)
+        show_help_and_exit();
+    if (strncasecmp(argv[1], "Read=", 5) == STR_EQUAL)
+        read_file = argv[1] + 5;   // decode capture file instead of CAN interface
+    else if (strncasecmp(argv[1], "Follow=", 7) == STR_EQUAL) {
+        read_file = argv[1] + 7;   // decode capture file while another canerrdump writes it
+        follow = true;
+    }
+
+    //filter.can_id = CAN_INV_FILTER;
+
+    errmask       = CAN_ERR_FLAG   // include only error frames
+                  | CAN_ERR_MASK;  // show all possible error frames
+
+    if (argc >= 3) {               // Parse command line parameters
+        for (int i = 2; i < argc; i++) {
+            // str_to_upper(argv[i]);
+            if (strcasecmp(argv[i], "IgnoreTxTimeout")        == STR_EQUAL)
+                errmask &= ~CAN_ERR_TX_TIMEOUT; // Exclude TxTimeout errors
+            else if (strcasecmp(argv[i], "IgnoreLostArbit")   == STR_EQUAL)
+                errmask &= ~CAN_ERR_LOSTARB;   // Exclude LostArbitration errors
+            else if (strcasecmp(argv[i], "IgnoreController")  == STR_EQUAL)
+                errmask &= ~CAN_ERR_CRTL;      // Exclude Controller errors
+            else if (strcasecmp(argv[i], "IgnoreProtocol")    == STR_EQUAL)
+                errmask &= ~CAN_ERR_PROT;      // Exclude Protocol errors
+            else if (strcasecmp(argv[i], "IgnoreTransveiver") == STR_EQUAL)
+                errmask &= ~CAN_ERR_TRX;       // Exclude Transceiver errors
+            else if (strcasecmp(argv[i], "IgnoreNoAck")       == STR_EQUAL)
+                errmask &= ~CAN_ERR_ACK;       // Exclude NoAck errors
+            else if (strcasecmp(argv[i], "IgnoreBusOff")      == STR_EQUAL)
+                errmask &= ~CAN_ERR_BUSOFF;    // Exclude BusOff errors
+            else if (strcasecmp(argv[i], "IgnoreBusError")    == STR_EQUAL)
+                errmask &= ~CAN_ERR_BUSERROR;  // Exclude BusError errors
+            else if (strcasecmp(argv[i], "IgnoreRestarted")   == STR_EQUAL)
+                errmask &= ~CAN_ERR_RESTARTED; // Exclude Restarted errors
+            else if (strcasecmp(argv[i], "IgnoreCounters")    == STR_EQUAL)
+                errmask &= ~CAN_ERR_CNT;       // Exclude TX and RX counter errors
+            else if (strcasecmp(argv[i], "ShowBits")          == STR_EQUAL)
+                show_bits = true;              // Display all error mask filtering bits
+            else if (strcasecmp(argv[i], "HwTimestamps")      == STR_EQUAL)
+                hw_timestamps = true;          // Adapter timestamps, PHC found through ethtool
+            else if (strncasecmp(argv[i], "HwTimestamps=", 13) == STR_EQUAL) {
+                phc_path = argv[i] + 13;       // Adapter timestamps with given PHC
+                hw_timestamps = true;
+            }
+            else if (strcasecmp(argv[i], "DataFrames")        == STR_EQUAL)
+                data_frames = true;            // Also classic, FD and XL data frames
+            else if (strcasecmp(argv[i], "KernelLog")         == STR_EQUAL)
+                kernel_log = true;             // Merge driver messages of /dev/kmsg
+            else if (parse_number_option(argv[i], "Batch", 1, CANERR_MAX_BATCH, &batch))
+                ;                              // Max frames fetched by one receive call
+            else if (strncasecmp(argv[i], "Format=", 7)     == STR_EQUAL)
+                compile_format(argv[i] + 7);   // Print only fields chosen by template
+            else if (strncasecmp(argv[i], "OutputDir=", 10) == STR_EQUAL)
+                output_dir = argv[i] + 10;     // One file and writer thread per interface
+            else if (parse_number_option(argv[i], "OutputRing", 4, 1024, &output_ring)) {
+                if (output_ring & (output_ring - 1)) {
+                    printf("Error: OutputRing must be a power of 2\n");
+                    exit(EXIT_FAILURE);
+                }
+                shard_ring_size = output_ring * 1024;   // Buffer of each output writer
+            }
+            else if (strcasecmp(argv[i], "Journal")           == STR_EQUAL)
+                use_journal = true;            // Structured entries to systemd journal
+            else if (parse_number_option(argv[i], "JournalRate", 0, 100000, &journal_rate))
+                ;                              // Journal rate limit
+            else if (strncasecmp(argv[i], "JournalSocket=", 14) == STR_EQUAL) {
+                journal_socket = argv[i] + 14; // Journal socket stand-in for testing
+                use_journal = true;
+            }
+            else if (strncasecmp(argv[i], "Mqtt=", 5)      == STR_EQUAL)
+                mqtt_address = argv[i] + 5;    // Publish events and summaries to MQTT broker
+            else if (strncasecmp(argv[i], "MqttTopic=", 10) == STR_EQUAL)
+                mqtt_topic = argv[i] + 10;     // MQTT topic prefix
+            else if (parse_number_option(argv[i], "MqttQos", 0, 1, &mqtt_qos))
+                ;                              // MQTT quality of service
+            else if (parse_number_option(argv[i], "MqttInterval", 1, 3600, &mqtt_interval))
+                ;                              // MQTT summary interval
+            else if (parse_number_option(argv[i], "MqttQueue", 1, 100000, &mqtt_queue))
+                ;                              // MQTT offline queue length
+            else if (strncasecmp(argv[i], "Sqlite=", 7)    == STR_EQUAL)
+                sqlite_file = argv[i] + 7;     // Decoded errors to SQLite database
+            else if (parse_number_option(argv[i], "SqliteBatch", 1, 1000000, &sqlite_batch))
+                ;                              // Rows per SQLite transaction
+            else if (parse_number_option(argv[i], "SqliteFlush", 10, 60000, &sqlite_flush))
+                ;                              // SQLite transaction is committed after this
+            else if (strncasecmp(argv[i], "Dashboard=", 10) == STR_EQUAL)
+                dash_address = argv[i] + 10;   // Web dashboard with WebSocket pushes
+            else if (parse_number_option(argv[i], "DashboardInterval", 100, 60000, &dash_interval))
+                ;                              // Dashboard push cadence
+            else if (strncasecmp(argv[i], "Bridge=", 7)    == STR_EQUAL)
+                bridge_address = argv[i] + 7;  // Forward records to canerrsim on another host
+            else if (strncasecmp(argv[i], "Capture=", 8)   == STR_EQUAL)
+                capture_file = argv[i] + 8;    // Binary capture with O_DIRECT
+            else if (parse_number_option(argv[i], "CaptureBlock", 64, 256, &capture_block))
+                capture_block &= ~3L;          // Keep blocks 4 KiB aligned
+            else if (parse_number_option(argv[i], "CaptureFlush", 10, 60000, &capture_flush))
+                capture.flush_ns = capture_flush * 1000000ULL;   // Partial block interval for followers
+            else if (parse_number_option(argv[i], "BpfStats", 1, 3600, &bpf_interval))
+                ;                              // Count errors in kernel and report periodically
+            else if (parse_number_option(argv[i], "Load", 1, 3600, &load_interval))
+                ;                              // Frame rates and bus load from kernel counters
+            else if (strncasecmp(argv[i], "Expect=", 7)    == STR_EQUAL)
+                expect_pattern = argv[i] + 7;  // Match error sequence pattern
+            else if (strcasecmp(argv[i], "ExpectOnce")        == STR_EQUAL)
+                expect_once = true;            // Stop after first verdict
+            else if (strncasecmp(argv[i], "Incident=", 9)  == STR_EQUAL)
+                incident_dir = argv[i] + 9;    // Snapshot files around trigger errors
+            else if (parse_number_option(argv[i], "IncidentPre", 1, 3600, &incident_pre))
+                ;                              // Seconds kept before trigger
+            else if (parse_number_option(argv[i], "IncidentPost", 0, 3600, &incident_post))
+                ;                              // Seconds recorded after trigger
+            else if (strncasecmp(argv[i], "IncidentTrigger=", 16) == STR_EQUAL)
+                incident_trigger = argv[i] + 16;   // Error names which start an incident
+            else if (parse_number_option(argv[i], "IncidentRing", 64, 1048576, &incident_ring))
+                ;                              // Size of pre-trigger ring in KiB
+            else if (parse_number_option(argv[i], "Coalesce", 1, 1000, &coalesce_ms))
+                ;                              // Drain sockets periodically under load
+            else if (parse_number_option(argv[i], "CoalesceEnter", 1, 1000000, &coalesce_enter))
+                ;                              // Rate from which draining starts
+            else if (parse_number_option(argv[i], "CoalesceLeave", 1, 1000000, &coalesce_leave))
+                ;                              // Rate below which frames wake up again
+            else if (strcasecmp(argv[i], "Footprint")         == STR_EQUAL)
+                use_footprint = true;          // All buffers sized at start, no allocations later
+            else {
+                printf("Error: Invalid option: %s\n", argv[i]);
+                //show_help_and_exit();
+                exit(EXIT_SUCCESS);
+            }
+        }
+    }
+
+    if (show_bits == true) {
+        //printf("filter.can_id = ");
+        //print_binary(filter.can_id);
+        //printf("\n");
+        printf("Error Mask = ");
+        print_binary(errmask);        
+        printf("\n");
+    }
+    
+    if (expect_pattern != NULL && bpf_interval > 0 && read_file == NULL) {
+        printf("Error: Expect needs received frames, it can not be combined with BpfStats\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (use_footprint)
+        footprint_open(&footprint);
+
+    if (read_file != NULL)
+        read_fd = capture_read_open(read_file, &stream, &read_block_size);
+    else {
+        // create stream and add a socket bound to each CAN interface
+        if (canerr_stream_init(&stream, errmask, batch) < 0)
+            err_exit("Error while creating receive stream");
+        if (data_frames && canerr_stream_data_frames(&stream, footprint.active ?
+                footprint_alloc(CANERR_RXBUF_SIZE, 64, "data frame buffer") : NULL) < 0)
+            err_exit("Error allocating data frame buffer");
+        if (hw_timestamps)
+            canerr_stream_hw_timestamps(&stream, phc_path);
+        snprintf(interfaces, sizeof(interfaces), "%s", can_interface_name);
+        for (char *name = strtok(interfaces, ","); name; name = strtok(NULL, ",")) {
+            if (canerr_stream_add(&stream, name) < 0) {      // can0, vcan0...
+                sprintf(buf, "Error setting CAN interface name %s", name);
+                err_exit(buf);
+            }
+        }
+        if (stream.count == 0)
+            show_help_and_exit();
+        if (kernel_log && canerr_stream_kmsg(&stream) < 0)
+            err_exit("Error opening /dev/kmsg (needs CAP_SYSLOG when kernel.dmesg_restrict is 1)");
+        if (coalesce_ms > 0 && bpf_interval == 0 &&
+            canerr_stream_coalesce(&stream, coalesce_ms * 1000000ULL, coalesce_enter, coalesce_leave) < 0)
+            err_exit("Error creating drain timer");
+    }
+
+    signal(SIGINT,  stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    if (expect_pattern != NULL) {
+        expect_open(&expect, expect_pattern, expect_once);
+        printf("Expecting %s%s\n", expect_pattern, expect_once ? ", stopping after first verdict" : "");
+    }
+
+    if (incident_dir != NULL && read_fd >= 0)
+        printf("Incident is ignored when reading a capture, it watches live interfaces\n");
+
+    if (load_interval > 0 && read_fd >= 0)
+        printf("Load is ignored when reading a capture, it needs live interface counters\n");
+    else if (load_interval > 0) {
+        if (bpf_interval > 0)
+            load_interval = bpf_interval;                          // load lines follow each counter report
+        load_open(&load, load_interval);
+        printf("Reporting frame rates and bus load every %ld seconds%s\n", load_interval,
+               load.proc_fd < 0 ? ", /proc/net/can/stats not available" : "");
+    }
+
+    if (bpf_interval > 0 && read_fd < 0) {
+        int ret;
+        footprint_seal(&footprint);
+        ret = run_bpf_stats(&stream, bpf_interval);
+        load_close(&load);
+        footprint_close(&footprint);
+        canerr_stream_close(&stream);
+        return ret;
+    }
+
+    if (output_dir != NULL) {
+        shard_open_all(output_dir, &stream);
+        printf("Writing errors of each interface to %s/<interface>.log\n", output_dir);
+    }
+
+    if (use_journal) {
+        journal_open(&journal, journal_socket, journal_rate, read_fd >= 0);
+        printf("Sending errors to journal socket %s\n", journal_socket);
+    }
+
+    if (mqtt_address != NULL) {
+        mqtt_open(&mqtt, mqtt_address, mqtt_topic, mqtt_qos, mqtt_interval, mqtt_queue);
+        printf("Publishing errors to MQTT broker %s port %s, topic %s/<interface>/event|summary\n",
+               mqtt.host, mqtt.port, mqtt_topic);
+    }
+
+    if (sqlite_file != NULL) {
+        sqlite_open(&sqlite, sqlite_file, sqlite_batch, sqlite_flush, read_fd >= 0);
+        printf("Storing errors to SQLite database %s, table errors\n", sqlite_file);
+    }
+
+    if (dash_address != NULL) {
+        dash_open(&dash, dash_address, dash_interval);
+        printf("Dashboard on http://%s:%s/\n", dash.host, dash.port);
+    }
+
+    if (bridge_address != NULL) {
+        bridge_open(&bridge, bridge_address);
+        printf("Bridging errors%s to %s port %s\n", data_frames ? " and data frames" : "", bridge.host, bridge.port);
+    }
+
+    if (read_fd >= 0) {
+        if ((read_block = footprint_alloc(read_block_size, 4096, "capture read block")) == NULL)
+            err_exit("Error allocating capture block");
+        footprint_seal(&footprint);
+        if (follow)
+            capture_follow(read_fd, read_file, read_block, read_block_size, errmask, data_frames);
+        else
+            capture_read_all(read_fd, read_block, read_block_size, errmask, data_frames);
+        mqtt_close(&mqtt);
+        journal_close(&journal);
+        sqlite_close(&sqlite);
+        dash_close(&dash);
+        bridge_close(&bridge);
+        shard_close_all();
+        footprint_free(read_block);
+        footprint_close(&footprint);
+        close(read_fd);
+        return expect_close(&expect);
+    }
+
+    if (incident_dir != NULL) {
+        incident_open(&incident, incident_dir, incident_pre, incident_post, incident_trigger, incident_ring);
+        printf("Keeping last %ld s in %ld KiB of RAM, writing incidents on %s to %s\n", incident_pre + incident_post,
+               incident_ring, incident_trigger, incident_dir);
+    }
+
+    if (capture_file != NULL) {
+        capture_open(&capture, capture_file, capture_block * 1024, &stream);
+        printf("Capturing errors to %s%s\n", capture_file, capture.direct ? " with O_DIRECT" : "");
+    }
+
+    read_timeout = capture.fd >= 0 || mqtt.active ? 1000 : -1;     // work is due without traffic too
+    if (capture.fd >= 0 && capture.flush_ns < 1000000000ULL)
+        read_timeout = capture.flush_ns / 1000000;
+    if ((load.active || expect.within_ns > 0 || incident.active) && (read_timeout < 0 || read_timeout > 100))
+        read_timeout = 100;                                        // keeps load intervals and timeouts accurate
+
+    footprint_seal(&footprint);
+    printf("Listening CAN bus %s for errors...\n", can_interface_name);
+    if (stream.coalesce_ns > 0)
+        printf("Draining sockets every %ld ms from %ld records/s on, waking up per frame again below %u\n",
+               coalesce_ms, coalesce_enter, stream.coalesce_leave);
+    fflush(stdout);
+    start_ns = canerr_monotonic_ns();
+
+    while (1) {
+        int n = canerr_stream_read(&stream, records, CANERR_MAX_BATCH, read_timeout);
+        if (n < 0) {
+            if (errno == ECANCELED)
+                break;
+            perror("Error reading CAN frame");
+            return 1;
+        }
+        for (; incomplete < stream.incomplete; incomplete++)
+            fprintf(stderr, "Incomplete CAN frame\n");
+
+        if (capture.fd >= 0)
+            for (int i = 0; i < n; i++)
+                capture_add(&capture, &records[i]);
+        capture_flush_due(&capture);
+        if (incident.active)
+            incident_add_batch(&incident, records, n);
+        output_batch(records, n);
+        mqtt_publish_summaries(&mqtt, false);
+        load_report(&load, false);
+        expect_tick(&expect, canerr_now_ns());
+        incident_tick(&incident, canerr_now_ns());
+    }
+
+    if (hw_timestamps)
+        clock_report(&stream);
+    if (stream.coalesce_ns > 0)
+        coalesce_report(&stream, canerr_monotonic_ns() - start_ns);
+    capture_close(&capture);
+    incident_close(&incident);
+    mqtt_close(&mqtt);
+    journal_close(&journal);
+    sqlite_close(&sqlite);
+    dash_close(&dash);
+    bridge_close(&bridge);
+    shard_close_all();
+    load_report(&load, true);                                      // last partial interval
+    load_close(&load);
+    canerr_stream_close(&stream);
+    footprint_close(&footprint);
+    if (stream.kmsg_lost > 0)
+        fprintf(stderr, "Kernel log overwrote %llu messages before they were read\n",
+                (unsigned long long)stream.kmsg_lost);
+    if (canerr_stream_drops(&stream) > 0)
+        fprintf(stderr, "Kernel dropped %llu frames because receive queue was full\n",
+                (unsigned long long)canerr_stream_drops(&stream));
+    return expect_close(&expect);
 }
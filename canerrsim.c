@@ -8,6 +8,7 @@
 //  sudo modprobe vcan                                                                            //
 //  sudo ip link add dev vcan0 type vcan                                                          //
 //  sudo ip link set vcan0 mtu 72              # needed for CAN FD                                //
+//  sudo ip link set vcan0 mtu 2060            # needed for CAN XL (XlLen option)                 //
 //  sudo ip link set vcan0 up                                                                     //
 //                                                                                                //
 //  To simulate error messages use canerrsim utility like this:                                   //
@@ -21,25 +22,54 @@
 //                                                                                                //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <stdint.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <linux/can/error.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include "canerr_stream.h"
 
 #define can_interface_name argv[1]
 #define STR_EQUAL 0
+#define SYNC_PORT "29536"            // default TCP port of Leader mode
+#define SYNC_MAX_FOLLOWERS 64
+#define SYNC_SPIN_NS 200000ULL       // last part of waiting for start time is spent spinning
+#define BRIDGE_RING 256              // received datagrams waiting for injection
+#define BRIDGE_RESYNC_NS 1000000000ULL  // bridge schedule starts over when injection is this late
+#define BURST_MAX_SENDERS 64         // sender threads of Burst mode
+#define BURST_BATCH 64               // frames handed to one sendmmsg() call
+#define RUN_MAX_WORKERS 256          // interfaces of scenario runner pool
+#define RUN_TEXT_SIZE 256            // decoded error text of scenario
 
 void show_help_and_exit() {
     printf("\n");
     printf("Usage: canerrsim <CAN interface> <options>\n");
+    printf("       canerrsim Run=<scenario file> [Workers=<n>] [Timeout=<ms>] [Pool=<prefix>] [KeepPool]\n");
     printf("\n");
     printf("CAN interface:          ( CAN interface is case sensitive )\n");
     printf("    can0                ( or can1, can2 or virtual ones like vcan0, vcan1...\n");
@@ -106,6 +136,46 @@ void show_help_and_exit() {
     printf("    CanLoShortToCanHi   ( 1000 0000 )\n");
     printf("                        ( CUSTOM BYTE TO DATA[0..7]: )\n");
     printf("    Data<0..7>=<00..FF> ( write hex number to one of 8 payload bytes )\n");
+    printf("                        ( CAN XL DATA FRAME INSTEAD OF ERROR FRAME: )\n");
+    printf("    XlLen=<1..2048>     ( send CAN XL frame with this payload length, Data<0..7> fill first )\n");
+    printf("                        ( bytes, others count up, interface needs mtu 2060 )\n");
+    printf("    XlPrio=<0..0x7FF>   ( CAN XL priority, default 0x7FF )\n");
+    printf("    XlSdt=<0..255>      ( CAN XL service data unit type, default 0 )\n");
+    printf("                        ( SYNCHRONIZED INJECTION ON SEVERAL MACHINES: )\n");
+    printf("    Leader=<port>       ( wait for followers, send them this frame and a start time, inject )\n");
+    printf("                        ( together and print send time skew of every participant )\n");
+    printf("    Followers=<1..64>   ( number of followers leader waits for, default 1 )\n");
+    printf("    StartDelay=<10..60000> ( ms from last follower joining to injection, default 500 )\n");
+    printf("    Follow=<host>[:<port>] ( take frame and start time from leader, default port %s )\n", SYNC_PORT);
+    printf("                        ( PRECISE PACING: )\n");
+    printf("    Pace=<1..10000000>  ( send frame repeatedly, one every given us, and print distribution of )\n");
+    printf("                        ( deadline errors at end )\n");
+    printf("    Count=<1..10000000> ( frames sent by Pace, default 1000 )\n");
+    printf("    Spin=<0..100000>    ( us before deadline where sleep ends and spinning on TSC starts, default %llu, )\n",
+           SYNC_SPIN_NS / 1000);
+    printf("                        ( 0 only sleeps, to compare with plain timer pacing )\n");
+    printf("    Fifo=<1..99>        ( run with SCHED_FIFO at this priority, needs CAP_SYS_NICE )\n");
+    printf("    Cpu=<n>             ( pin to this CPU, best one isolated with isolcpus= )\n");
+    printf("    LockMemory          ( mlockall() so no page fault delays a frame )\n");
+    printf("                        ( MAX RATE INJECTION: )\n");
+    printf("    Burst=<1..1000000000> ( send this many frames as fast as possible and print frames/s and )\n");
+    printf("                        ( CPU use of every sender thread )\n");
+    printf("    Senders=<1..%d>     ( sender threads with own socket, default 1 )\n", BURST_MAX_SENDERS);
+    printf("    Streams=<n>         ( frame k belongs to stream k %% n, each stream is sent by one sender, )\n");
+    printf("                        ( so order inside a stream is kept, without it senders take shares )\n");
+    printf("    Fuzz                ( random error classes and data bytes in every frame instead of options )\n");
+    printf("    Seed=<n>            ( start value of Fuzz, same seed gives same frames, default 1 )\n");
+    printf("                        ( Cpu=<n> pins sender i to CPU n + i )\n");
+    printf("                        ( SCENARIO RUNNER, Run=<file> INSTEAD OF CAN INTERFACE: )\n");
+    printf("                        ( file line: <name> <options>... [= <expected decoded error>] )\n");
+    printf("    Workers=<1..%d>    ( parallel workers with own vcan interface each, default CPU count )\n", RUN_MAX_WORKERS);
+    printf("    Timeout=<1..60000>  ( ms to wait for monitor to receive scenario frame, default 1000 )\n");
+    printf("    Pool=<prefix>       ( vcan interface names, default vcanrun gives vcanrun0, vcanrun1... )\n");
+    printf("    KeepPool            ( do not delete vcan interfaces created by runner )\n");
+    printf("                        ( UDP BRIDGE FROM CANERRDUMP ON ANOTHER HOST: )\n");
+    printf("    Bridge=<port>       ( inject records from canerrdump Bridge=<this host> with their original )\n");
+    printf("                        ( spacing until Ctrl+C, usual port is %s )\n", CANERR_BRIDGE_PORT);
+    printf("    BridgeDelay=<0..10000> ( ms between receiving first record and injecting it, default 20 )\n");
     printf("                        ( DEBUG HELPERS: )\n");
     printf("    ShowBits            ( display all frame bits )\n");
     printf("\n");
@@ -120,6 +190,25 @@ void show_help_and_exit() {
     printf("    ./canerrsim vcan0 BusError CanHiNoWire Restarted INTERM\n");
     printf("    ( vcan0: bus error, lost CANH wiring, controller restarted, protocol location intermission )\n");
     printf("\n");
+    printf("    ./canerrsim vcan0 XlLen=2048 XlPrio=0x100 Data0=AA\n");
+    printf("    ( vcan0: CAN XL frame with 2048 bytes payload starting with AA, see it with canerrdump DataFrames )\n");
+    printf("\n");
+    printf("    ./canerrsim can0 BusOff Leader=29536 Followers=2      ( on test PC 1 )\n");
+    printf("    ./canerrsim can0 Follow=testpc1                       ( on test PC 2 and 3 )\n");
+    printf("    ( bus off injected on all three machines at the same PTP time, skew report on test PC 1 )\n");
+    printf("\n");
+    printf("    sudo ./canerrsim can0 BusError Pace=500 Count=100000 Fifo=80 Cpu=3 LockMemory\n");
+    printf("    ( bus error every 500 us from isolated CPU 3, deadline error percentiles at end )\n");
+    printf("\n");
+    printf("    ./canerrsim vcan0 Fuzz Burst=10000000 Senders=4 Streams=16\n");
+    printf("    ( ten million fuzzed error frames from four threads, how far the CAN path scales over cores )\n");
+    printf("\n");
+    printf("    ./canerrsim vcan0 Bridge=%s\n", CANERR_BRIDGE_PORT);
+    printf("    ( replay error frames which canerrdump can0 Bridge=<this host> forwards from a remote bus )\n");
+    printf("\n");
+    printf("    sudo ./canerrsim Run=regression.txt Workers=32\n");
+    printf("    ( regression.txt scenarios on 32 vcan interfaces in parallel, exit code 1 if any failed )\n");
+    printf("\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -142,10 +231,6 @@ void show_err_and_exit(const char *err_type) {
     show_custom_format_and_exit(err_type, "Error: You can only have one %s parameter!\n");        
 }
 
-void show_loc_err_and_exit() {
-    show_err_and_exit("protocol location");
-}
-
 void show_arb_err_and_exit() {
     show_err_and_exit("arbitration bit");
 }
@@ -154,386 +239,1344 @@ void show_transc_err_and_exit() {
     show_err_and_exit("transceiver");
 }
 
-void print_binary(uint32_t number) {
-    uint32_t mask = 0x80000000; // start with the most significant bit
-    for (int i = 0; i < 32; i++) {
-        putchar((number & mask) ? '1' : '0');
-        mask >>= 1; // shift the mask to the right
+// <name>=<number> option, decimal or 0x hex, exits on bad value
+bool parse_number_option(const char *arg, const char *name, long min, long max, long *value) {
+    size_t len = strlen(name);
+    char *end;
+    if (strncasecmp(arg, name, len) != STR_EQUAL || arg[len] != '=')
+        return false;
+    *value = strtol(arg + len + 1, &end, 0);
+    if (end == arg + len + 1 || *end != '\0' || *value < min || *value > max) {
+        printf("Error: Invalid value in option %s ( allowed %ld..%ld )\n", arg, min, max);
+        exit(EXIT_FAILURE);
     }
+    return true;
 }
 
+// CAN XL data frame, payload starts with Data<0..7> bytes of error frame options
+void build_xl_frame(struct canxl_frame *xl, const struct can_frame *frame, long len, long prio, long sdt) {
+    xl->prio  = prio;
+    xl->flags = CANXL_XLF;
+    xl->sdt   = sdt;
+    xl->len   = len;
+    for (long i = 0; i < len; i++)
+        xl->data[i] = i < CAN_MAX_DLEN ? frame->data[i] : i & 0xFF;
+}
 
+void enable_xl_frames(int sock) {
+    const int on = 1;
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_XL_FRAMES, &on, sizeof(on)) < 0)
+        err_exit("Error: Kernel has no CAN XL support (needs 6.2 or newer)\n");
+}
 
-int main(int argc, char *argv[]) {
-    int sock;
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_frame frame;
-    bool show_bits, location_processed, transceiver_processed, arbitration_processed = false;
-    char tmp_str[256];
+void send_xl_frame(int sock, const struct canxl_frame *xl) {
+    enable_xl_frames(sock);
+    if (write(sock, xl, CANXL_HDR_SIZE + xl->len) < 0) {
+        CANERR_PROBE(send_failed, xl->prio, canerr_now_ns(), errno);
+        err_exit(errno == EINVAL ? "Error: Interface refused CAN XL frame, set its mtu to 2060\n"
+                                 : "Error writing to socket");
+    }
+    CANERR_PROBE(frame_sent, xl->prio, canerr_now_ns());
+    printf("CAN XL frame with %d bytes sent\n", xl->len);
+}
 
-    printf("CAN Sockets Error Messages Simulator\n");
-    if (argc < 3)
-        show_help_and_exit();
- 
-    // initialize CAN frame
-    memset(&frame, 0, sizeof(frame));
-    frame.can_id  = CAN_ERR_FLAG;
-    frame.can_dlc = CAN_ERR_DLC;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Leader / Follow mode: leader waits for followers over TCP, sends them its frame and a common  //
+//  start time, then every instance injects on its own interface exactly at that time of its      //
+//  local CLOCK_REALTIME (keep it PTP disciplined with ptp4l and phc2sys for sub millisecond      //
+//  alignment between machines). Followers report their actual send times back to the leader,     //
+//  which prints skew of every participant. One text line per message: follower HELLO <host>      //
+//  <interface>, leader START <ns> <can_id> <dlc> <8 data bytes> <xl len> <prio> <sdt>, follower  //
+//  DONE <ns before write> <ns after write> <errno>.                                              //
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    // Parse command line parameters
-    for (int i = 2; i < argc; i++) {
-        //printf("strlen(argv[%d]) = %d\n", i, strlen(argv[i]));
+struct sync_result {
+    char host[64];
+    char ifname[IF_NAMESIZE];
+    uint64_t before;                                // CLOCK_REALTIME right before write()
+    uint64_t after;                                 // and right after it returned
+    int error;                                      // errno of write(), 0 on success
+    bool reported;
+};
 
-        // error class (mask) in can_id
-        if (strcasecmp(argv[i], "TxTimeout")      == STR_EQUAL)
-            frame.can_id |= CAN_ERR_TX_TIMEOUT;   // generate TxTimeout error
-        else if (strcasecmp(argv[i], "NoAck")     == STR_EQUAL) 
-            frame.can_id |= CAN_ERR_ACK;          // generate NoAck error
-        else if (strcasecmp(argv[i], "BusOff")    == STR_EQUAL)
-            frame.can_id |= CAN_ERR_BUSOFF;       // generate BusOff error
-        else if (strcasecmp(argv[i], "BusError")  == STR_EQUAL)
-            frame.can_id |= CAN_ERR_BUSERROR;     // generate BusError error
-        else if (strcasecmp(argv[i], "Restarted") == STR_EQUAL)
-            frame.can_id |= CAN_ERR_RESTARTED;    // generate Restarted error
-        // error status of CAN controller / data[1]
-        else if (strcasecmp(argv[i], "OverflowRX") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_RX_OVERFLOW;             // generate RX Overflow suberror
-        }
-        else if (strcasecmp(argv[i], "OverflowTX") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_TX_OVERFLOW;             // generate TX Overflow suberror
-        }
-        else if (strcasecmp(argv[i], "WarningRX")  == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_RX_WARNING;              // generate RX Warning suberror
-        }
-        else if (strcasecmp(argv[i], "WarningTX")  == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_TX_WARNING;              // generate TX Warning suberror
-        }
-        else if (strcasecmp(argv[i], "PassiveRX")  == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_RX_PASSIVE;              // generate RX Passive suberror
-        }
-        else if (strcasecmp(argv[i], "PassiveTX")  == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_TX_PASSIVE;              // generate TX Passive suberror
-        }
-        else if (strcasecmp(argv[i], "Active")     == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1] |= CAN_ERR_CRTL_ACTIVE;                  // generate Active suberror
-        }
-        else if (strcasecmp(argv[i], "CtrlUnspec") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_CRTL;                         // generate Controller error
-            frame.data[1]  = CAN_ERR_CRTL_UNSPEC;                  // generate Unspec suberror
-        }
-        // error in CAN protocol (type) / data[2]
-        else if (strcasecmp(argv[i], "SingleBit") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_BIT;                     // generate SingleBit suberror
-        }
-        else if (strcasecmp(argv[i], "FrameFormat") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_FORM;                    // generate FrameFormat suberror
-        }
-        else if (strcasecmp(argv[i], "BitStuffing") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_STUFF;                   // generate BitStuffing suberror
-        }
-        else if (strcasecmp(argv[i], "Bit0") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_BIT0;                  // generate Bit0 suberror
-        }
-        else if (strcasecmp(argv[i], "Bit1") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_BIT1;                    // generate Bit1 suberror
-        }
-        else if (strcasecmp(argv[i], "BusOverload") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_OVERLOAD;                // generate BusOverload suberror
-        }
-        else if (strcasecmp(argv[i], "ActiveAnnouncement") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_ACTIVE;                  // generate ActiveAnnouncement suberror
-        }
-        else if (strcasecmp(argv[i], "TX") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_TX;                  // generate TX suberror
-        }
-        else if (strcasecmp(argv[i], "ProtUnspec") == STR_EQUAL) { 
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Type error
-            frame.data[2]  = CAN_ERR_PROT_UNSPEC;                  // generate Unspec suberror
-        }
-        // error in CAN protocol (location) / data[3]
-        else if (strcasecmp(argv[i], "LocUnspec") == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_UNSPEC;              // generate Unspec suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "SOF")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_SOF;                 // generate SOF suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "SOF")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_SOF;                 // generate SOF suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "ID28_21")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ID28_21;             // generate ID28_21 suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "ID20_18")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ID20_18;             // generate ID20_18 suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "SRTR")      == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_SRTR;                // generate SRTR suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "IDE")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_IDE;                 // generate IDE suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "ID17_13")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ID17_13;             // generate ID17_13 suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "ID12_05")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ID12_05;                 // generate ID12_05 suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "ID04_00")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ID04_00;             // generate ID04_00 suberror
-            location_processed = true;
-        }
-        else if (strcasecmp(argv[i], "RTR")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_RTR;                 // generate RTR suberror
-            location_processed = true;
+// sleep until shortly before target, then spin, so wake up latency of scheduler does not count
+void wait_until(uint64_t target_ns) {
+    struct timespec ts;
+
+    if (target_ns > canerr_now_ns() + SYNC_SPIN_NS) {
+        uint64_t wake = target_ns - SYNC_SPIN_NS;
+        ts.tv_sec  = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+    while (canerr_now_ns() < target_ns)
+        ;
+}
+
+// inject prepared frame at start time and note when it really happened
+void sync_inject(int sock, const void *buf, size_t len, uint64_t start_ns, struct sync_result *res) {
+    wait_until(start_ns);
+    res->before = canerr_now_ns();
+    res->error  = write(sock, buf, len) < 0 ? errno : 0;
+    res->after  = canerr_now_ns();
+    res->reported = true;
+    if (res->error)
+        CANERR_PROBE(send_failed, ((const struct can_frame *)buf)->can_id, res->after, res->error);
+    else
+        CANERR_PROBE(frame_sent, ((const struct can_frame *)buf)->can_id, res->after);
+}
+
+void sync_print_results(const struct sync_result *res, int count, uint64_t start_ns) {
+    uint64_t first = UINT64_MAX, last = 0;
+
+    printf("%-24s %-10s %14s %10s  %s\n", "Participant", "Interface", "Skew us", "Write us", "Result");
+    for (int i = 0; i < count; i++) {
+        if (!res[i].reported) {
+            printf("%-24s %-10s %14s %10s  no report\n", res[i].host, res[i].ifname, "-", "-");
+            continue;
         }
-        else if (strcasecmp(argv[i], "RES1")      == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_RES1;                // generate RES1 suberror
-            location_processed = true;
+        printf("%-24s %-10s %14.3f %10.3f  %s\n", res[i].host, res[i].ifname,
+               ((double)res[i].before - (double)start_ns) / 1000, (double)(res[i].after - res[i].before) / 1000,
+               res[i].error ? strerror(res[i].error) : "sent");
+        if (res[i].before < first)
+            first = res[i].before;
+        if (res[i].before > last)
+            last = res[i].before;
+    }
+    if (last >= first)
+        printf("Spread of send times: %.3f us\n", (double)(last - first) / 1000);
+}
+
+// Leader=<port>: collect followers, distribute frame and start time, inject, print skew report
+void run_leader(int sock, const char *ifname, long port, long followers, long delay_ms,
+                const struct can_frame *frame, long xl_len, long xl_prio, long xl_sdt, const void *buf, size_t len) {
+    struct sockaddr_in addr;
+    struct sync_result res[SYNC_MAX_FOLLOWERS + 1];
+    FILE *peers[SYNC_MAX_FOLLOWERS];
+    char line[256];
+    uint64_t start_ns;
+    const int on = 1;
+    int listener;
+
+    memset(res, 0, sizeof(res));
+    if ((listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        err_exit("Error while opening leader socket");
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(port);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, followers) < 0)
+        err_exit("Error listening for followers");
+    printf("Waiting for %ld followers on port %ld...\n", followers, port);
+    fflush(stdout);
+
+    for (int i = 0; i < followers; i++) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0 || (peers[i] = fdopen(fd, "r+")) == NULL)
+            err_exit("Error accepting follower");
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (fgets(line, sizeof(line), peers[i]) == NULL ||
+            sscanf(line, "HELLO %63s %15s", res[i + 1].host, res[i + 1].ifname) != 2)
+            err_exit("Error: Follower did not introduce itself\n");
+        printf("Follower %s joined with %s\n", res[i + 1].host, res[i + 1].ifname);
+        fflush(stdout);
+    }
+    close(listener);
+
+    start_ns = canerr_now_ns() + delay_ms * 1000000ULL;
+    for (int i = 0; i < followers; i++) {
+        fprintf(peers[i], "START %llu %08X %d", (unsigned long long)start_ns, frame->can_id, frame->can_dlc);
+        for (int b = 0; b < CAN_MAX_DLEN; b++)
+            fprintf(peers[i], " %02X", frame->data[b]);
+        fprintf(peers[i], " %ld %ld %ld\n", xl_len, xl_prio, xl_sdt);
+        fflush(peers[i]);
+    }
+
+    gethostname(res[0].host, sizeof(res[0].host) - 1);
+    snprintf(res[0].ifname, sizeof(res[0].ifname), "%s", ifname);
+    sync_inject(sock, buf, len, start_ns, &res[0]);
+
+    for (int i = 0; i < followers; i++) {
+        unsigned long long before, after;
+        if (fgets(line, sizeof(line), peers[i]) != NULL &&
+            sscanf(line, "DONE %llu %llu %d", &before, &after, &res[i + 1].error) == 3) {
+            res[i + 1].before   = before;
+            res[i + 1].after    = after;
+            res[i + 1].reported = true;
         }
-        else if (strcasecmp(argv[i], "RES0")      == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_RES0;                // generate RES0 suberror
-            location_processed = true;
+        fclose(peers[i]);
+    }
+    sync_print_results(res, followers + 1, start_ns);
+}
+
+// Follow=<host>[:<port>]: wait for leader, take its frame and start time, inject and report back
+void run_follower(int sock, const char *ifname, char *leader) {
+    struct addrinfo hints, *ai;
+    struct sync_result res;
+    struct can_frame frame;
+    static struct canxl_frame xl;
+    unsigned long long start_ns;
+    unsigned int can_id, data[CAN_MAX_DLEN];
+    long xl_len, xl_prio, xl_sdt;
+    char line[256], host[64] = "", *port = strrchr(leader, ':');
+    const int on = 1;
+    FILE *peer;
+    int fd = -1, dlc;
+
+    if (port != NULL)
+        *port++ = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    printf("Waiting for leader %s...\n", leader);
+    fflush(stdout);
+    while (fd < 0) {                                // leader may start later than followers
+        if (getaddrinfo(leader, port ? port : SYNC_PORT, &hints, &ai) != 0)
+            err_exit("Error: Unknown leader host\n");
+        if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) >= 0 &&
+            connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+            usleep(200000);
         }
-        else if (strcasecmp(argv[i], "DLC")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_DLC;                 // generate DLC suberror
-            location_processed = true;
+        freeaddrinfo(ai);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if ((peer = fdopen(fd, "r+")) == NULL)
+        err_exit("Error opening leader connection");
+    gethostname(host, sizeof(host) - 1);
+    fprintf(peer, "HELLO %s %s\n", host, ifname);
+    fflush(peer);
+
+    memset(&frame, 0, sizeof(frame));
+    if (fgets(line, sizeof(line), peer) == NULL ||
+        sscanf(line, "START %llu %X %d %X %X %X %X %X %X %X %X %ld %ld %ld", &start_ns, &can_id, &dlc,
+               &data[0], &data[1], &data[2], &data[3], &data[4], &data[5], &data[6], &data[7],
+               &xl_len, &xl_prio, &xl_sdt) != 14 ||
+        dlc < 0 || dlc > CAN_MAX_DLEN ||            // same bounds as options of leader
+        (xl_len != 0 && (xl_len < CANXL_MIN_DLEN || xl_len > CANXL_MAX_DLEN)) ||
+        xl_prio < 0 || xl_prio > CANXL_PRIO_MASK || xl_sdt < 0 || xl_sdt > 0xFF)
+        err_exit("Error: Leader sent no valid START\n");
+    frame.can_id  = can_id;
+    frame.can_dlc = dlc;
+    for (int b = 0; b < CAN_MAX_DLEN; b++)
+        frame.data[b] = data[b];
+    if (xl_len > 0) {
+        build_xl_frame(&xl, &frame, xl_len, xl_prio, xl_sdt);
+        enable_xl_frames(sock);
+    }
+    printf("Injecting at %llu.%09llu\n", start_ns / 1000000000ULL, start_ns % 1000000000ULL);
+    fflush(stdout);
+
+    memset(&res, 0, sizeof(res));
+    if (xl_len > 0)
+        sync_inject(sock, &xl, CANXL_HDR_SIZE + xl_len, start_ns, &res);
+    else
+        sync_inject(sock, &frame, sizeof(frame), start_ns, &res);
+    fprintf(peer, "DONE %llu %llu %d\n", (unsigned long long)res.before, (unsigned long long)res.after, res.error);
+    fclose(peer);
+    snprintf(res.host, sizeof(res.host), "%s", host);
+    snprintf(res.ifname, sizeof(res.ifname), "%s", ifname);
+    sync_print_results(&res, 1, start_ns);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Bridge mode: receive records which canerrdump Bridge= forwards from another host and inject   //
+//  them into local interface. First record is injected BridgeDelay ms after it arrived, every    //
+//  later one at the same distance from it as on the original bus, so bursts keep their shape.    //
+//  Received datagrams wait in a ring while earlier records are due, so receiving never blocks    //
+//  injection and kernel socket buffer absorbs bursts. Schedule starts over after long stalls.    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct bridge_rx {
+    int fd;
+    char dgrams[BRIDGE_RING][CANERR_BRIDGE_DGRAM_MAX] __attribute__((aligned(8)));
+    size_t lens[BRIDGE_RING];
+    unsigned head;                                  // datagrams ever received
+    unsigned tail;                                  // datagrams ever injected completely
+    size_t pos;                                     // next record in datagram at tail
+    bool anchored;
+    uint64_t remote_base;                           // original timestamp of schedule start
+    uint64_t local_base;                            // local injection time of that record
+    uint64_t next_seq;
+    uint64_t datagrams, records, injected, failed, lost, resyncs, late_ns_max;
+};
+
+struct bridge_rx bridge_rx;
+volatile sig_atomic_t bridge_stop = 0;
+
+void bridge_stop_handler(int sig) {
+    (void)sig;
+    bridge_stop = 1;
+}
+
+// move datagrams from socket to ring without blocking, counts sequence gaps as lost
+void bridge_receive(struct bridge_rx *b) {
+    struct mmsghdr msgs[BRIDGE_RING];
+    struct iovec iovs[BRIDGE_RING];
+    unsigned room = BRIDGE_RING - (b->head - b->tail), first = b->head % BRIDGE_RING;
+    int n;
+
+    if (room > BRIDGE_RING - first)
+        room = BRIDGE_RING - first;                 // contiguous slots up to ring end
+    if (room == 0)
+        return;
+    memset(msgs, 0, room * sizeof(msgs[0]));
+    for (unsigned i = 0; i < room; i++) {
+        iovs[i].iov_base = b->dgrams[first + i];
+        iovs[i].iov_len  = CANERR_BRIDGE_DGRAM_MAX;
+        msgs[i].msg_hdr.msg_iov    = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    if ((n = recvmmsg(b->fd, msgs, room, MSG_DONTWAIT, NULL)) <= 0)
+        return;
+    for (int i = 0; i < n; i++) {
+        const struct canerr_bridge_header *hdr = (const struct canerr_bridge_header *)b->dgrams[first + i];
+        size_t pos = 0;
+        if (canerr_bridge_next(b->dgrams[first + i], msgs[i].msg_len, &pos) == NULL)
+            continue;                               // foreign or empty datagram, slot is reused
+        if (hdr->seq > b->next_seq)
+            b->lost += hdr->seq - b->next_seq;
+        else if (hdr->seq < b->next_seq)            // sender was restarted
+            b->anchored = false;
+        b->next_seq = hdr->seq + 1;
+        b->lens[b->head % BRIDGE_RING] = msgs[i].msg_len;
+        if (b->head % BRIDGE_RING != first + i)     // close gap left by skipped datagram
+            memcpy(b->dgrams[b->head % BRIDGE_RING], b->dgrams[first + i], msgs[i].msg_len);
+        b->head++;
+        b->datagrams++;
+        b->records += hdr->count;
+    }
+}
+
+// local injection time of record, schedule starts over when it is far off
+uint64_t bridge_due(struct bridge_rx *b, uint64_t timestamp_ns, uint64_t now, long delay_ms) {
+    uint64_t due = b->local_base + (timestamp_ns - b->remote_base);
+
+    if (!b->anchored || timestamp_ns < b->remote_base ||
+        due + BRIDGE_RESYNC_NS < now || due > now + BRIDGE_RESYNC_NS * 10) {
+        b->resyncs += b->anchored;
+        b->anchored    = true;
+        b->remote_base = timestamp_ns;
+        b->local_base  = now + delay_ms * 1000000ULL;
+        due = b->local_base;
+    }
+    return due;
+}
+
+// write record as frame of its type, payload in record is shortened for FD and XL frames
+void bridge_inject(struct bridge_rx *b, int sock, const struct canerr_cap_record *rec) {
+    static struct canfd_frame fd_frame;
+    const void *buf = rec + 1;
+    size_t len = sizeof(struct can_frame);
+
+    if (rec->type == CANERR_FRAME_KMSG)
+        return;                                     // driver messages of sender have no frame
+    if (rec->type == CANERR_FRAME_FD) {
+        memset(&fd_frame, 0, sizeof(fd_frame));
+        memcpy(&fd_frame, buf, rec->len < sizeof(fd_frame) ? rec->len : sizeof(fd_frame));
+        buf = &fd_frame;
+        len = CANFD_MTU;
+    }
+    else if (rec->type == CANERR_FRAME_XL)
+        len = rec->len;
+    else if (rec->len < sizeof(struct can_frame))
+        return;
+    if (write(sock, buf, len) < 0) {
+        b->failed++;
+        CANERR_PROBE(send_failed, ((const struct can_frame *)(rec + 1))->can_id, canerr_now_ns(), errno);
+        return;
+    }
+    b->injected++;
+    CANERR_PROBE(frame_sent, ((const struct can_frame *)(rec + 1))->can_id, canerr_now_ns());
+}
+
+// Bridge=<port>: inject records from canerrdump Bridge= until Ctrl+C
+void run_bridge(int sock, const char *ifname, long port, long delay_ms) {
+    struct bridge_rx *b = &bridge_rx;
+    struct sockaddr_in6 addr;
+    const int on = 1, off = 0, rcvbuf = 8 << 20;
+    struct pollfd pfd;
+
+    if ((b->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        err_exit("Error while opening bridge socket");
+    setsockopt(b->fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));   // IPv4 senders too
+    setsockopt(b->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr   = in6addr_any;
+    addr.sin6_port   = htons(port);
+    if (bind(b->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        err_exit("Error binding bridge port");
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));   // best effort, classic only
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_XL_FRAMES, &on, sizeof(on));   // interfaces refuse others
+    signal(SIGINT,  bridge_stop_handler);
+    signal(SIGTERM, bridge_stop_handler);
+    printf("Injecting records bridged to port %ld into %s, Ctrl+C stops\n", port, ifname);
+    fflush(stdout);
+
+    pfd.fd     = b->fd;
+    pfd.events = POLLIN;
+    while (!bridge_stop) {
+        const struct canerr_cap_record *rec;
+        uint64_t now, due;
+        char *dgram = b->dgrams[b->tail % BRIDGE_RING];
+
+        bridge_receive(b);
+        if (b->head == b->tail) {
+            poll(&pfd, 1, -1);
+            continue;
         }
-        else if (strcasecmp(argv[i], "DATA")      == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_DATA;                // generate DATA suberror
-            location_processed = true;
+        if ((rec = canerr_bridge_next(dgram, b->lens[b->tail % BRIDGE_RING], &b->pos)) == NULL) {
+            b->tail++;                              // datagram done
+            b->pos = 0;
+            continue;
         }
-        else if (strcasecmp(argv[i], "CRC_SEQ")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_CRC_SEQ;             // generate CRC_SEQ suberror
-            location_processed = true;
+        now = canerr_now_ns();
+        due = bridge_due(b, rec->timestamp_ns, now, delay_ms);
+        if (due > now + SYNC_SPIN_NS) {             // receive meanwhile, come back to this record
+            struct timespec ts = { .tv_sec = (due - now - SYNC_SPIN_NS) / 1000000000ULL,
+                                   .tv_nsec = (due - now - SYNC_SPIN_NS) % 1000000000ULL };
+            b->pos -= rec->size;
+            ppoll(&pfd, 1, &ts, NULL);
+            continue;
         }
-        else if (strcasecmp(argv[i], "CRC_DEL")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_CRC_DEL;             // generate CRC_DEL suberror
-            location_processed = true;
+        wait_until(due);
+        if (now > due && now - due > b->late_ns_max)
+            b->late_ns_max = now - due;
+        bridge_inject(b, sock, rec);
+    }
+    printf("\nReceived %llu records in %llu datagrams, injected %llu, failed %llu, lost %llu datagrams\n",
+           (unsigned long long)b->records, (unsigned long long)b->datagrams, (unsigned long long)b->injected,
+           (unsigned long long)b->failed, (unsigned long long)b->lost);
+    printf("Schedule restarted %llu times, latest injection %.3f ms behind original spacing\n",
+           (unsigned long long)b->resyncs, (double)b->late_ns_max / 1e6);
+    close(b->fd);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Pace mode: frame is sent Count times, one every Pace microseconds. Each deadline is waited    //
+//  for with clock_nanosleep(TIMER_ABSTIME) until Spin microseconds before it, then by spinning   //
+//  on TSC, which is calibrated against CLOCK_MONOTONIC at start and anchored again after every   //
+//  sleep, so wake up latency of scheduler does not reach the frame. SCHED_FIFO, CPU pinning and  //
+//  mlockall() keep preemption, migration and page faults away. Deadline error is time of write() //
+//  minus deadline, its distribution is printed at end.                                           //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct pace_clock {
+    uint64_t base_ns;                               // CLOCK_MONOTONIC at last anchor
+    uint64_t base_ticks;                            // TSC at same moment
+    double ns_per_tick;                             // 0 without invariant TSC, then spin reads CLOCK_MONOTONIC
+};
+
+struct pace_clock pace_clock;
+volatile sig_atomic_t pace_stop = 0;
+
+void pace_stop_handler(int sig) {
+    (void)sig;
+    pace_stop = 1;
+}
+
+uint64_t pace_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return canerr_timespec_ns(&ts);
+}
+
+uint64_t pace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// pair of TSC and CLOCK_MONOTONIC read closest together out of a few tries, preemption spoils single ones
+void pace_anchor(struct pace_clock *c) {
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < 4; i++) {
+        uint64_t before = pace_ticks(), ns = pace_mono_ns(), after = pace_ticks();
+        if (after - before < best) {
+            best = after - before;
+            c->base_ns    = ns;
+            c->base_ticks = before + (after - before) / 2;  // clock was read in the middle
         }
-        else if (strcasecmp(argv[i], "ACK")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ACK;                 // generate ACK suberror
-            location_processed = true;
+    }
+}
+
+uint64_t pace_now(const struct pace_clock *c) {
+    if (c->ns_per_tick == 0)
+        return pace_mono_ns();
+    return c->base_ns + (uint64_t)((double)(pace_ticks() - c->base_ticks) * c->ns_per_tick);
+}
+
+// TSC counts at same rate in all power states only with constant_tsc and nonstop_tsc, measure it for 50 ms
+void pace_calibrate(struct pace_clock *c) {
+    char line[4096];
+    bool constant = false, nonstop = false;
+    uint64_t start_ns, start_ticks;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    c->ns_per_tick = 0;
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+        if (strncmp(line, "flags", 5) == STR_EQUAL) {
+            constant = strstr(line, " constant_tsc") != NULL;
+            nonstop  = strstr(line, " nonstop_tsc") != NULL;
+            break;
         }
-        else if (strcasecmp(argv[i], "ACK_DEL")   == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_ACK_DEL;             // generate ACK_DEL suberror
-            location_processed = true;
+    if (f != NULL)
+        fclose(f);
+    if (!constant || !nonstop || pace_ticks() == 0) {
+        printf("No invariant TSC, spinning on CLOCK_MONOTONIC\n");
+        return;
+    }
+    pace_anchor(c);
+    start_ns    = c->base_ns;
+    start_ticks = c->base_ticks;
+    usleep(50000);
+    pace_anchor(c);
+    c->ns_per_tick = (double)(c->base_ns - start_ns) / (double)(c->base_ticks - start_ticks);
+    printf("Spinning on TSC at %.3f GHz\n", 1 / c->ns_per_tick);
+}
+
+// sleep until spin_ns before deadline, then spin, returns CLOCK_MONOTONIC when deadline passed
+uint64_t pace_wait(struct pace_clock *c, uint64_t deadline, uint64_t spin_ns) {
+    uint64_t now = pace_mono_ns();
+
+    if (deadline > now + spin_ns) {
+        struct timespec ts = { .tv_sec  = (deadline - spin_ns) / 1000000000ULL,
+                               .tv_nsec = (deadline - spin_ns) % 1000000000ULL };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !pace_stop)
+            ;
+    }
+    pace_anchor(c);                                 // sleep may have lasted long, keep TSC drift out
+    while (pace_now(c) < deadline)
+        ;
+    return pace_mono_ns();
+}
+
+int pace_compare(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// percentiles and decade histogram of deadline errors, errors get sorted
+void pace_report(int64_t *errors, long count, long failed, uint64_t period_ns) {
+    static const double percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+    static const int64_t limits[] = { 100, 1000, 10000, 100000, 1000000 };
+    static const char *const names[] = { "< 0.1 us", "< 1 us", "< 10 us", "< 100 us", "< 1 ms", ">= 1 ms" };
+    long buckets[CANERR_COUNT(names)] = { 0 }, late = 0;
+
+    if (count == 0)
+        return;
+    qsort(errors, count, sizeof(errors[0]), pace_compare);
+    for (long i = 0; i < count; i++) {
+        size_t b = 0;
+        while (b < CANERR_COUNT(limits) && errors[i] >= limits[b])
+            b++;
+        buckets[b]++;
+        if (errors[i] >= (int64_t)period_ns)
+            late++;
+    }
+    printf("\nDeadline error of %ld frames (write() start minus deadline):\n", count);
+    printf("  min %.3f us", errors[0] / 1000.0);
+    for (size_t p = 0; p < CANERR_COUNT(percentiles); p++)
+        printf(", p%g %.3f us", percentiles[p], errors[(long)(percentiles[p] / 100 * (count - 1))] / 1000.0);
+    printf(", max %.3f us\n", errors[count - 1] / 1000.0);
+    for (size_t b = 0; b < CANERR_COUNT(names); b++)
+        printf("  %-10s %10ld  %6.2f%%\n", names[b], buckets[b], buckets[b] * 100.0 / count);
+    printf("Late by a whole period or more: %ld, write failed: %ld\n", late, failed);
+}
+
+// Pace=<us>: send frame count times at fixed period, with optional SCHED_FIFO, pinning and locked memory
+void run_pace(int sock, const char *ifname, const void *buf, size_t len, long period_us, long count, long spin_us,
+              long fifo, long cpu, bool lock) {
+    int64_t *errors = malloc(count * sizeof(int64_t));
+    uint64_t period_ns = period_us * 1000ULL, deadline;
+    long sent = 0, failed = 0;
+
+    if (errors == NULL)
+        err_exit("Error: Not enough memory for deadline errors\n");
+    memset(errors, 0, count * sizeof(int64_t));    // touch every page now, not while pacing
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            printf("Warning: Not pinned to CPU %ld: %s\n", cpu, strerror(errno));
+    }
+    if (fifo > 0) {
+        struct sched_param param = { .sched_priority = fifo };
+        if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+            printf("Warning: SCHED_FIFO not set (needs CAP_SYS_NICE): %s\n", strerror(errno));
+    }
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        printf("Warning: Memory not locked (raise RLIMIT_MEMLOCK): %s\n", strerror(errno));
+    pace_calibrate(&pace_clock);
+    signal(SIGINT,  pace_stop_handler);
+    signal(SIGTERM, pace_stop_handler);
+    printf("Sending %ld frames to %s every %ld us, sleeping until %ld us before each deadline\n",
+           count, ifname, period_us, spin_us);
+    fflush(stdout);
+
+    deadline = pace_mono_ns() + 10000000ULL;        // first frame 10 ms from now
+    for (; sent < count && !pace_stop; sent++, deadline += period_ns) {
+        uint64_t start = pace_wait(&pace_clock, deadline, spin_us * 1000ULL);
+        errors[sent] = (int64_t)(start - deadline);
+        if (write(sock, buf, len) < 0) {
+            failed++;
+            CANERR_PROBE(send_failed, ((const struct can_frame *)buf)->can_id, canerr_now_ns(), errno);
+        } else
+            CANERR_PROBE(frame_sent, ((const struct can_frame *)buf)->can_id, canerr_now_ns());
+    }
+    pace_report(errors, sent, failed, period_ns);
+    free(errors);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Burst mode: Burst=<n> frames as fast as the kernel takes them, spread over Senders threads    //
+//  with a socket each, so the CAN path of several cores is measured instead of one. Frames are   //
+//  partitioned before start: without Streams every sender owns one contiguous share, with        //
+//  Streams=<s> frame k belongs to logical stream k % s and every stream is sent by one sender    //
+//  only, which keeps order inside a stream. Each sender fills batches of its own frames and      //
+//  hands them to sendmmsg(). Fuzz frames are derived from Seed and frame number, so a workload   //
+//  is the same whatever number of senders.                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct burst_sender {
+    pthread_t thread;
+    int index;
+    int sock;
+    long frames;                                    // frames of this sender's partition
+    long sent, retries, failed;                     // failed frames are skipped
+    uint64_t start_ns, end_ns;
+    double cpu_s;                                   // user and system time of sender thread
+    struct can_frame frames_buf[BURST_BATCH];
+    struct iovec iovs[BURST_BATCH];
+    struct mmsghdr msgs[BURST_BATCH];
+};
+
+struct burst {
+    const char *ifname;
+    const void *buf;                                // frame sent when not fuzzing
+    size_t len;
+    long count;
+    long senders;
+    long streams;                                   // 0 without ordering
+    long first_cpu;                                 // -1 without pinning
+    bool fuzz;
+    uint64_t seed;
+    pthread_barrier_t barrier;
+    struct burst_sender sender[BURST_MAX_SENDERS];
+};
+
+struct burst burst;
+volatile sig_atomic_t burst_stop = 0;
+
+void burst_stop_handler(int sig) {
+    (void)sig;
+    burst_stop = 1;
+}
+
+uint64_t burst_mix(uint64_t x) {                   // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// error frame number k of fuzz workload: random class bits with random sub codes and counters
+void burst_fuzz_frame(struct can_frame *frame, uint64_t seed, uint64_t k) {
+    uint64_t r = burst_mix(seed + k * 0x9E3779B97F4A7C15ULL);
+    canid_t classes = r & ((CAN_ERR_CNT << 1) - 1);      // class bits 0..9
+
+    canerr_frame_init(frame);
+    frame->can_id |= classes != 0 ? classes : CAN_ERR_PROT;
+    r = burst_mix(r);
+    memcpy(frame->data, &r, sizeof(frame->data));
+}
+
+// frames of sender's partition
+long burst_share(const struct burst *b, int index) {
+    if (b->streams == 0)
+        return b->count / b->senders + (index < b->count % b->senders);
+    return (b->count / b->streams) * ((b->streams - 1 - index) / b->senders + 1) +   // whole rounds of streams,
+           (index < b->count % b->streams ? ((b->count % b->streams) - 1 - index) / b->senders + 1 : 0);   // then last round
+}
+
+// frame number of n-th frame of sender in workload order
+long burst_frame_number(const struct burst *b, int index, long n) {
+    long per_stream, stream;
+
+    if (b->streams == 0)                            // contiguous shares, remainder to first senders
+        return index * (b->count / b->senders) + (index < b->count % b->senders ? index : b->count % b->senders) + n;
+    per_stream = (b->streams - 1 - index) / b->senders + 1;   // streams index, index + senders...
+    stream = index + (n % per_stream) * b->senders;
+    return (n / per_stream) * b->streams + stream;
+}
+
+void *burst_sender_thread(void *arg) {
+    struct burst_sender *s = arg;
+    struct burst *b = &burst;
+    struct pollfd pfd = { .fd = s->sock, .events = POLLOUT };
+    struct rusage usage;
+
+    for (int i = 0; i < BURST_BATCH; i++) {
+        s->iovs[i].iov_base = b->fuzz ? (void *)&s->frames_buf[i] : (void *)b->buf;
+        s->iovs[i].iov_len  = b->len;
+        memset(&s->msgs[i], 0, sizeof(s->msgs[i]));
+        s->msgs[i].msg_hdr.msg_iov    = &s->iovs[i];
+        s->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    pthread_barrier_wait(&b->barrier);
+    s->start_ns = canerr_now_ns();
+    for (long pos = 0; pos < s->frames && !burst_stop; ) {
+        int n = s->frames - pos < BURST_BATCH ? s->frames - pos : BURST_BATCH;
+        int done = 0;
+        if (b->fuzz)
+            for (int i = 0; i < n; i++)
+                burst_fuzz_frame(&s->frames_buf[i], b->seed, burst_frame_number(b, s->index, pos + i));
+        while (done < n && !burst_stop) {
+            int ret = sendmmsg(s->sock, s->msgs + done, n - done, 0);
+            if (ret > 0) {
+                done    += ret;
+                s->sent += ret;
+            } else if (errno == ENOBUFS || errno == EAGAIN) {     // TX queue of real adapter is full
+                s->retries++;
+                poll(&pfd, 1, 10);
+            } else {
+                s->failed++;                        // skip frame, keep partition order for the rest
+                done++;
+            }
         }
-        else if (strcasecmp(argv[i], "EOF")       == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_EOF;                 // generate EOF suberror
-            location_processed = true;
+        pos += done;
+    }
+    s->end_ns = canerr_now_ns();
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        s->cpu_s = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    return NULL;
+}
+
+void burst_report(const struct burst *b) {
+    uint64_t first = UINT64_MAX, last = 0;
+    long total = 0;
+
+    printf("\n%-7s %12s %10s %14s %8s %8s %8s\n", "Sender", "Frames", "Seconds", "Frames/s", "CPU %", "Retries", "Failed");
+    for (int i = 0; i < b->senders; i++) {
+        const struct burst_sender *s = &b->sender[i];
+        double seconds = (double)(s->end_ns - s->start_ns) / 1e9;
+        printf("%-7d %12ld %10.3f %14.0f %8.1f %8ld %8ld\n", i, s->sent, seconds, seconds > 0 ? s->sent / seconds : 0,
+               seconds > 0 ? s->cpu_s * 100 / seconds : 0, s->retries, s->failed);
+        total += s->sent;
+        if (s->start_ns < first)
+            first = s->start_ns;
+        if (s->end_ns > last)
+            last = s->end_ns;
+    }
+    if (last > first)
+        printf("Total %ld frames in %.3f s: %.0f frames/s with %ld senders%s\n", total, (double)(last - first) / 1e9,
+               total / ((double)(last - first) / 1e9), b->senders, b->streams ? ", order kept in every stream" : "");
+}
+
+// Burst=<n>: send n frames to interface from several sender threads, print throughput of each
+void run_burst(const char *ifname, const void *buf, size_t len, long count, long senders, long streams,
+               bool fuzz, long seed, long first_cpu) {
+    struct burst *b = &burst;
+    struct sockaddr_can addr;
+    const int on = 1;
+
+    b->ifname    = ifname;
+    b->buf       = buf;
+    b->len       = len;
+    b->count     = count;
+    b->senders   = streams > 0 && streams < senders ? streams : senders;  // more senders would have nothing
+    b->streams   = streams;
+    b->fuzz      = fuzz;
+    b->seed      = seed;
+    b->first_cpu = first_cpu;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = if_nametoindex(ifname);
+    pthread_barrier_init(&b->barrier, NULL, b->senders);
+    for (int i = 0; i < b->senders; i++) {
+        struct burst_sender *s = &b->sender[i];
+        s->index  = i;
+        s->frames = burst_share(b, i);
+        if ((s->sock = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW)) < 0)
+            err_exit("Error while opening socket");
+        setsockopt(s->sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);   // senders receive nothing
+        if (len > sizeof(struct can_frame))
+            setsockopt(s->sock, SOL_CAN_RAW, CAN_RAW_XL_FRAMES, &on, sizeof(on));
+        if (bind(s->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            err_exit("Error in socket bind");
+    }
+    signal(SIGINT,  burst_stop_handler);
+    signal(SIGTERM, burst_stop_handler);
+    printf("Sending %ld %s to %s with %ld senders%s\n", count, fuzz ? "fuzzed error frames" : "frames", ifname,
+           b->senders, streams ? ", order kept per stream" : "");
+    fflush(stdout);
+
+    for (int i = 0; i < b->senders; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (first_cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((first_cpu + i) % CPU_SETSIZE, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
         }
-        else if (strcasecmp(argv[i], "INTERM")    == STR_EQUAL) { 
-            if (location_processed) show_loc_err_and_exit;
-            frame.can_id  |= CAN_ERR_PROT;                         // generate Protocol Location error
-            frame.data[3]  = CAN_ERR_PROT_LOC_INTERM;              // generate INTERM suberror
-            location_processed = true;
+        if ((errno = pthread_create(&b->sender[i].thread, &attr, burst_sender_thread, &b->sender[i])) != 0)
+            err_exit("Error starting sender thread\n");
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < b->senders; i++) {
+        pthread_join(b->sender[i].thread, NULL);
+        close(b->sender[i].sock);
+    }
+    pthread_barrier_destroy(&b->barrier);
+    burst_report(b);
+}
+
+
+
+// LostArBit=<00..29>, Data<0..7>=<00..FF>, TxCount=<00..FF> and RxCount=<00..FF> options, returns false
+// when option has none of these shapes
+bool apply_numeric_option(struct can_frame *frame, char *arg, bool *arbitration_processed, bool *transceiver_processed) {
+    // LostArBit=29 (Totallength=12)
+    if ((strlen(arg) == 12)                    && // 'LostArBit=29'
+             (arg[9]  == '=')                       && // '='
+             (arg[10] >= '0' && arg[10] <= '2') && // valid bits are from 00 to 29 (in decimal)
+             (arg[11] >= '0' && arg[11] <= '9')) { // valid bits are from 00 to 29 (in decimal)
+        unsigned char arb_bit_num = (arg[10] - '0') * 10 + arg[11] - '0'; // convert decimal bitnumber to byte
+        arg[9] = 0;                                    // terminate string for comparison
+        if (strcasecmp(arg, "LostArBit") == STR_EQUAL) { 
+            if (*arbitration_processed) show_arb_err_and_exit();
+            frame->can_id  |= CAN_ERR_LOSTARB;              // generate LostArbitartionBit error
+            frame->data[0]  = arb_bit_num;                  // bitnumber
+            *arbitration_processed = true;
         }
-        // error status of CAN transceiver / data[4]
-        else if (strcasecmp(argv[i], "TransUnspec")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_UNSPEC;                   // generate EOF suberror
-            location_processed = true;
+        else {
+            arg[9] = '=';                              // undo string termination
+            show_invalid_option(arg);
         }
-        else if (strcasecmp(argv[i], "CanHiNoWire")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANH_NO_WIRE;             // generate CanHiNoWire suberror
-            location_processed = true;
+    }
+    // Data1=F4 (Totallength=8)                            // since this does not set any error bit, has to be combined with other errors
+    else if ((strlen(arg) == 8)                    &&  // 'Data1=F4'
+             (arg[4]  >= '0' && arg[4] <= '7') &&  // valid data bytes are from 0 to 7 (in decimal)
+             (arg[5]  == '=')                      &&  // '='
+             ((arg[6] >= '0' && arg[6] <= '9') || (arg[6] >= 'A' && arg[6] <= 'F')) && // first hexadecimal digit
+             ((arg[7] >= '0' && arg[7] <= '9') || (arg[7] >= 'A' && arg[7] <= 'F'))) { // second hexadecimal digit
+        unsigned char data_byte_value, data_byte_no = 0;
+        data_byte_no = arg[4] - '0';                   // convert order number of data byte (Data1 to 1, Data2 to 2...)
+        data_byte_value = 0;
+        if (arg[6] >= 'A')                             // convert higher digit hexadecimal char to byte
+            data_byte_value += (arg[6] - 'A' + 10) * 16;
+        else
+            data_byte_value += (arg[6] - '0'     ) * 16;
+        if (arg[7] >= 'A')                             // convert lower digit hexadecimal char to byte
+            data_byte_value += (arg[7] - 'A' + 10);
+        else
+            data_byte_value += (arg[7] - '0'     ); 
+        arg[4] = 0;                                    // terminate string for comparison
+        if (strcasecmp(arg, "Data") == STR_EQUAL) { 
+            if (*transceiver_processed) show_transc_err_and_exit();
+            frame->data[data_byte_no] = data_byte_value;    // populate proper data byte
+            *transceiver_processed    = true;
         }
-        else if (strcasecmp(argv[i], "CanHiShortToBAT")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANH_SHORT_TO_BAT;        // generate CanHiShortToBAT suberror
-            location_processed = true;
+        else {
+            arg[4] = data_byte_no + '0';               // undo string termination
+            show_invalid_option(arg);
         }
-        else if (strcasecmp(argv[i], "CanHiShortToVCC")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANH_SHORT_TO_VCC;        // generate CanHiShortToVCC suberror
-            location_processed = true;
+    }
+    // RxCount=F4 or TxCount=3A (Totallength=10)
+    else if ((strlen(arg) == 10)                    && // 'RxCounter=F4' or 'TxCounter=3A'
+             (arg[7] == '=')                        && // '='
+             ((arg[8] >= '0' && arg[8] <= '9') || (arg[8] >= 'A' && arg[8] <= 'F')) && // first hexadecimal digit
+             ((arg[9] >= '0' && arg[9] <= '9') || (arg[9] >= 'A' && arg[9] <= 'F'))) { // second hexadecimal digit
+        unsigned char counter_value = 0;
+        if (arg[8] >= 'A')                            // convert higher digit hexadecimal char to byte
+            counter_value += (arg[8] - 'A' + 10) * 16;
+        else
+            counter_value += (arg[8] - '0'     ) * 16;
+        if (arg[9] >= 'A')                            // convert lower digit hexadecimal char to byte
+            counter_value += (arg[9] - 'A' + 10);
+        else
+            counter_value += (arg[9] - '0'     ); 
+        arg[7] = 0;                                   // terminate string for comparison
+        if (strcasecmp(arg, "TxCount") == STR_EQUAL) { 
+            frame->can_id |= CAN_ERR_CNT;                 // generate TxCounter error
+            frame->data[6] = counter_value;               // populate proper data byte
         }
-        else if (strcasecmp(argv[i], "CanHiShortToGND")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANH_SHORT_TO_GND;        // generate CanHiShortToGND suberror
-            location_processed = true;
+        else if (strcasecmp(arg, "RxCount") == STR_EQUAL) { 
+            frame->can_id |= CAN_ERR_CNT;                 // generate RxCounter error
+            frame->data[7] = counter_value;               // populate proper data byte
         }
-        else if (strcasecmp(argv[i], "CanLoNoWire")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANL_NO_WIRE;             // generate CanLoNoWire suberror
-            location_processed = true;
+        else {
+            arg[7] = '=';                            // undo string termination
+            show_invalid_option(arg);
         }
-        else if (strcasecmp(argv[i], "CanLoShortToBAT")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANL_SHORT_TO_BAT;        // generate CanLoShortToBAT suberror
-            location_processed = true;
+    }
+    else
+        return false;
+    return true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Run=<file> mode: scenario runner for regression suites. Every worker thread owns one vcan     //
+//  interface of the pool with a simulator socket and a monitor socket on it, so scenarios of     //
+//  different workers never see each other's frames. Scenarios are dealt round robin into         //
+//  per worker deques, owner takes from the bottom and idle workers steal from the top of others. //
+//  Scenario file has one scenario per line, # starts a comment:                                  //
+//  <name> <option> <option>... [= <expected canerr_decode text>]                                 //
+//  Without expectation the monitor has to receive exactly the frame which was sent.              //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum run_status { RUN_PASS, RUN_FAIL, RUN_TIMEOUT, RUN_ERROR };
+
+struct scenario {
+    char name[64];
+    struct can_frame frame;
+    char expected[RUN_TEXT_SIZE];
+    enum run_status status;
+    uint64_t latency_ns;                            // from write() to monitor receiving the frame
+    char got[RUN_TEXT_SIZE];
+};
+
+struct run_deque {
+    pthread_mutex_t lock;
+    int *items;                                     // scenario indices
+    int top;                                        // next index for thieves
+    int bottom;                                     // one past next index for owner
+};
+
+struct run_worker {
+    pthread_t thread;
+    int id;
+    char ifname[IF_NAMESIZE];
+    bool created;                                   // interface was created by runner, delete at end
+    int sim_sock;
+    int mon_sock;
+    struct run_deque deque;
+    long done;
+    long stolen;
+};
+
+struct scenario *scenarios;
+int scenario_count;
+struct run_worker *run_workers;
+long run_worker_count;
+long run_timeout_ms = 1000;
+
+// read scenario file, options are the ones of single frame mode, exits on invalid option
+void load_scenarios(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int capacity = 0, line_no = 0;
+
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        bool arbitration_processed = false, transceiver_processed = false;
+        char *expected, *save, *token;
+        struct scenario *sc;
+
+        line_no++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        expected = strchr(line, '=');
+        while (expected != NULL && expected > line && !isspace((unsigned char)expected[-1]))
+            expected = strchr(expected + 1, '=');   // '=' inside of option like TxCount=80
+        if (expected != NULL)
+            *expected++ = '\0';
+        if ((token = strtok_r(line, " \t", &save)) == NULL)
+            continue;
+        if (scenario_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            if ((scenarios = realloc(scenarios, capacity * sizeof(*scenarios))) == NULL)
+                err_exit("Error allocating scenarios\n");
         }
-        else if (strcasecmp(argv[i], "CanLoShortToVCC")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANL_SHORT_TO_VCC;        // generate CanLoShortToVCC suberror
-            location_processed = true;
+        sc = &scenarios[scenario_count++];
+        memset(sc, 0, sizeof(*sc));
+        snprintf(sc->name, sizeof(sc->name), "%s", token);
+        canerr_frame_init(&sc->frame);
+        while ((token = strtok_r(NULL, " \t", &save)) != NULL) {
+            if (canerr_apply_option(&sc->frame, token))
+                continue;
+            if (apply_numeric_option(&sc->frame, token, &arbitration_processed, &transceiver_processed))
+                continue;
+            printf("%s:%d: ", path, line_no);
+            show_invalid_option(token);
         }
-        else if (strcasecmp(argv[i], "CanLoShortToGND")       == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANL_SHORT_TO_GND;        // generate CanLoShortToGND suberror
-            location_processed = true;
+        if ((sc->frame.can_id & CAN_ERR_MASK) == 0) {   // CAN_RAW_ERR_FILTER of monitor would drop it
+            printf("%s:%d: Error: Scenario %s sets no error class, it could only time out\n", path, line_no, sc->name);
+            exit(EXIT_FAILURE);
         }
-        else if (strcasecmp(argv[i], "CanLoShortToCanHi")     == STR_EQUAL) { 
-            if (transceiver_processed) show_transc_err_and_exit;
-            frame.can_id  |= CAN_ERR_TRX;                          // generate Transceiver error
-            frame.data[4]  = CAN_ERR_TRX_CANL_SHORT_TO_CANH;       // generate CanLoShortToCanHi suberror
-            location_processed = true;
+        if (expected != NULL) {
+            expected += strspn(expected, " \t");
+            expected[strcspn(expected, " \t")] = '\0';
+            snprintf(sc->expected, sizeof(sc->expected), "%s", expected);
         }
-        // LostArBit=29 (Totallength=12)
-        else if ((strlen(argv[i]) == 12)                    && // 'LostArBit=29'
-                 (argv[i][9]  == '=')                       && // '='
-                 (argv[i][10] >= '0' && argv[i][10] <= '2') && // valid bits are from 00 to 29 (in decimal)
-                 (argv[i][11] >= '0' && argv[i][11] <= '9')) { // valid bits are from 00 to 29 (in decimal)
-            unsigned char arb_bit_num = (argv[i][10] - '0') * 10 + argv[i][11] - '0'; // convert decimal bitnumber to byte
-            argv[i][9] = 0;                                    // terminate string for comparison
-            if (strcasecmp(argv[i], "LostArBit") == STR_EQUAL) { 
-                if (arbitration_processed) show_arb_err_and_exit;
-                frame.can_id  |= CAN_ERR_LOSTARB;              // generate LostArbitartionBit error
-                frame.data[0]  = arb_bit_num;                  // bitnumber
-                arbitration_processed = true;
-            }
-            else {
-                argv[i][9] = '=';                              // undo string termination
-                show_invalid_option(argv[i]);
-            }
+        else
+            canerr_decode(&sc->frame, sc->expected, sizeof(sc->expected));
+    }
+    fclose(f);
+    if (scenario_count == 0)
+        err_exit("Error: Scenario file has no scenarios\n");
+}
+
+// one rtnetlink request, returns 0 or negative errno from kernel acknowledge
+int run_netlink(int type, int flags, const char *ifname, bool vcan) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+        char attrs[128];
+    } req;
+    struct {
+        struct nlmsghdr nh;
+        struct nlmsgerr err;
+    } ack;
+    struct rtattr *rta, *info;
+    int fd, ret;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type  = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    req.ifi.ifi_family = AF_UNSPEC;
+    if (vcan) {
+        req.ifi.ifi_flags  = IFF_UP;
+        req.ifi.ifi_change = IFF_UP;
+    }
+    rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+    rta->rta_type = IFLA_IFNAME;
+    rta->rta_len  = RTA_LENGTH(strlen(ifname) + 1);
+    strcpy(RTA_DATA(rta), ifname);
+    req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+    if (vcan) {
+        info = (struct rtattr *)((char *)&req + req.nh.nlmsg_len);
+        info->rta_type = IFLA_LINKINFO;
+        rta = RTA_DATA(info);
+        rta->rta_type = IFLA_INFO_KIND;
+        rta->rta_len  = RTA_LENGTH(strlen("vcan"));
+        memcpy(RTA_DATA(rta), "vcan", strlen("vcan"));
+        info->rta_len = RTA_LENGTH(RTA_ALIGN(rta->rta_len));
+        req.nh.nlmsg_len += RTA_ALIGN(info->rta_len);
+    }
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+        return -errno;
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+        ret = -errno;
+    else if (recv(fd, &ack, sizeof(ack), 0) < (ssize_t)sizeof(ack))
+        ret = -EIO;
+    else
+        ret = ack.nh.nlmsg_type == NLMSG_ERROR ? ack.err.error : 0;
+    close(fd);
+    return ret;
+}
+
+// make sure vcan interface exists and is up, existing interfaces of the pool are reused
+void run_vcan_up(struct run_worker *w) {
+    int ret;
+
+    w->created = if_nametoindex(w->ifname) == 0;
+    if ((ret = run_netlink(RTM_NEWLINK, NLM_F_CREATE, w->ifname, true)) < 0) {
+        printf("Error: Can not create and start %s: %s\n", w->ifname, strerror(-ret));
+        printf("( needs vcan module and CAP_NET_ADMIN, or create interfaces of Pool yourself )\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int run_socket(const char *ifname, bool monitor) {
+    struct sockaddr_can addr;
+    can_err_mask_t errmask = CAN_ERR_MASK;
+    int sock;
+
+    if ((sock = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW)) < 0)
+        err_exit("Error while opening socket");
+    if (monitor) {                                  // error frames only
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errmask, sizeof(errmask));
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = if_nametoindex(ifname);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        err_exit("Error in socket bind");
+    return sock;
+}
+
+// owner end of deque, newest work first
+int run_pop(struct run_deque *d) {
+    int idx = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top)
+        idx = d->items[--d->bottom];
+    pthread_mutex_unlock(&d->lock);
+    return idx;
+}
+
+// thief end of deque, oldest work first, so owner and thief rarely meet
+int run_steal(struct run_deque *d) {
+    int idx = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top)
+        idx = d->items[d->top++];
+    pthread_mutex_unlock(&d->lock);
+    return idx;
+}
+
+// inject scenario frame and wait for monitor to see it
+void run_scenario(struct run_worker *w, struct scenario *sc) {
+    struct pollfd pfd = { .fd = w->mon_sock, .events = POLLIN };
+    struct can_frame rx;
+    uint64_t sent, deadline;
+
+    while (recv(w->mon_sock, &rx, sizeof(rx), MSG_DONTWAIT) > 0)
+        ;                                           // late frames of previous timed out scenario
+    sent = canerr_now_ns();
+    if (write(w->sim_sock, &sc->frame, sizeof(sc->frame)) < 0) {
+        sc->status = RUN_ERROR;
+        snprintf(sc->got, sizeof(sc->got), "%s", strerror(errno));
+        return;
+    }
+    deadline = sent + run_timeout_ms * 1000000ULL;
+    while (1) {
+        uint64_t now = canerr_now_ns();
+        if (now >= deadline || poll(&pfd, 1, (deadline - now + 999999) / 1000000) <= 0) {
+            sc->status = RUN_TIMEOUT;
+            return;
         }
-        // Data1=F4 (Totallength=8)                            // since this does not set any error bit, has to be combined with other errors
-        else if ((strlen(argv[i]) == 8)                    &&  // 'Data1=F4'
-                 (argv[i][4]  >= '0' && argv[i][4] <= '7') &&  // valid data bytes are from 0 to 7 (in decimal)
-                 (argv[i][5]  == '=')                      &&  // '='
-                 ((argv[i][6] >= '0' && argv[i][6] <= '9') || (argv[i][6] >= 'A' && argv[i][6] <= 'F')) && // first hexadecimal digit
-                 ((argv[i][7] >= '0' && argv[i][7] <= '9') || (argv[i][6] >= 'A' && argv[i][6] <= 'F'))) { // second hexadecimal digit
-            unsigned char data_byte_value, data_byte_no = 0;
-            data_byte_no = argv[i][4] - '0';                   // convert order number of data byte (Data1 to 1, Data2 to 2...)
-            data_byte_value = 0;
-            if (argv[i][6] >= 'A')                             // convert higher digit hexadecimal char to byte
-                data_byte_value += (argv[i][6] - 'A' + 10) * 16;
-            else
-                data_byte_value += (argv[i][6] - '0'     ) * 16;
-            if (argv[i][7] >= 'A')                             // convert lower digit hexadecimal char to byte
-                data_byte_value += (argv[i][7] - 'A' + 10);
-            else
-                data_byte_value += (argv[i][7] - '0'     ); 
-            argv[i][4] = 0;                                    // terminate string for comparison
-            if (strcasecmp(argv[i], "Data") == STR_EQUAL) { 
-                if (transceiver_processed) show_transc_err_and_exit;
-                frame.data[data_byte_no] = data_byte_value;    // populate proper data byte
-                arbitration_processed    = true;
-            }
-            else {
-                argv[i][4] = data_byte_no + '0';               // undo string termination
-                show_invalid_option(argv[i]);
-            }
+        if (recv(w->mon_sock, &rx, sizeof(rx), MSG_DONTWAIT) == sizeof(rx))
+            break;
+    }
+    sc->latency_ns = canerr_now_ns() - sent;
+    canerr_decode(&rx, sc->got, sizeof(sc->got));
+    sc->status = strcmp(sc->got, sc->expected) == 0 ? RUN_PASS : RUN_FAIL;
+}
+
+void *run_worker_thread(void *arg) {
+    struct run_worker *w = arg;
+    int idx;
+
+    while (1) {
+        if ((idx = run_pop(&w->deque)) < 0) {       // own deque empty, look for a victim
+            for (long i = 1; i < run_worker_count && idx < 0; i++)
+                idx = run_steal(&run_workers[(w->id + i) % run_worker_count].deque);
+            if (idx < 0)
+                break;                              // nothing is ever added, so all work is taken
+            w->stolen++;
         }
-        // RxCount=F4 or TxCount=3A (Totallength=10)
-        else if ((strlen(argv[i]) == 10)                    && // 'RxCounter=F4' or 'TxCounter=3A'
-                 (argv[i][7] == '=')                        && // '='
-                 ((argv[i][8] >= '0' && argv[i][8] <= '9') || (argv[i][8] >= 'A' && argv[i][8] <= 'F')) && // first hexadecimal digit
-                 ((argv[i][9] >= '0' && argv[i][9] <= '9') || (argv[i][9] >= 'A' && argv[i][9] <= 'F'))) { // second hexadecimal digit
-            unsigned char counter_value = 0;
-            if (argv[i][8] >= 'A')                            // convert higher digit hexadecimal char to byte
-                counter_value += (argv[i][8] - 'A' + 10) * 16;
-            else
-                counter_value += (argv[i][8] - '0'     ) * 16;
-            if (argv[i][9] >= 'A')                            // convert lower digit hexadecimal char to byte
-                counter_value += (argv[i][9] - 'A' + 10);
-            else
-                counter_value += (argv[i][9] - '0'     ); 
-            argv[i][7] = 0;                                   // terminate string for comparison
-            if (strcasecmp(argv[i], "TxCount") == STR_EQUAL) { 
-                frame.can_id |= CAN_ERR_CNT;                 // generate TxCounter error
-                frame.data[6] = counter_value;               // populate proper data byte
-            }
-            else if (strcasecmp(argv[i], "RxCount") == STR_EQUAL) { 
-                frame.can_id |= CAN_ERR_CNT;                 // generate RxCounter error
-                frame.data[7] = counter_value;               // populate proper data byte
-            }
-            else {
-                argv[i][7] = '=';                            // undo string termination
-                show_invalid_option(argv[i]);
-            }
+        run_scenario(w, &scenarios[idx]);
+        w->done++;
+    }
+    return NULL;
+}
+
+void run_report(uint64_t wall_ns) {
+    static const char *status_names[] = { "PASS", "FAIL", "TIMEOUT", "ERROR" };
+    long counts[4] = { 0 };
+    uint64_t latency_sum = 0, latency_max = 0;
+
+    for (int i = 0; i < scenario_count; i++) {
+        struct scenario *sc = &scenarios[i];
+        counts[sc->status]++;
+        if (sc->status == RUN_PASS || sc->status == RUN_FAIL) {
+            latency_sum += sc->latency_ns;
+            if (sc->latency_ns > latency_max)
+                latency_max = sc->latency_ns;
         }
+        if (sc->status != RUN_PASS)
+            printf("%-7s %s: expected %s, got %s\n", status_names[sc->status], sc->name, sc->expected,
+                   sc->status == RUN_TIMEOUT ? "nothing" : sc->got);
+    }
+    printf("\n%-10s %8s %8s\n", "Interface", "Done", "Stolen");
+    for (long i = 0; i < run_worker_count; i++)
+        printf("%-10s %8ld %8ld\n", run_workers[i].ifname, run_workers[i].done, run_workers[i].stolen);
+    printf("\n%d scenarios: %ld passed, %ld failed, %ld timed out, %ld errors in %.3f s with %ld workers\n",
+           scenario_count, counts[RUN_PASS], counts[RUN_FAIL], counts[RUN_TIMEOUT], counts[RUN_ERROR],
+           (double)wall_ns / 1e9, run_worker_count);
+    if (counts[RUN_PASS] + counts[RUN_FAIL] > 0)
+        printf("Monitor latency: average %.1f us, maximum %.1f us\n",
+               (double)latency_sum / (counts[RUN_PASS] + counts[RUN_FAIL]) / 1000, (double)latency_max / 1000);
+}
+
+// canerrsim Run=<file> [Workers=<n>] [Timeout=<ms>] [Pool=<prefix>] [KeepPool], returns exit code
+int run_scenarios(int argc, char *argv[]) {
+    const char *pool = "vcanrun";
+    bool keep_pool = false;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t start;
+
+    for (int i = 2; i < argc; i++) {
+        if (parse_number_option(argv[i], "Workers", 1, RUN_MAX_WORKERS, &workers))
+            ;
+        else if (parse_number_option(argv[i], "Timeout", 1, 60000, &run_timeout_ms))
+            ;
+        else if (strncasecmp(argv[i], "Pool=", 5) == STR_EQUAL && strlen(argv[i] + 5) > 0 && strlen(argv[i] + 5) < IF_NAMESIZE - 4)
+            pool = argv[i] + 5;
+        else if (strcasecmp(argv[i], "KeepPool") == STR_EQUAL)
+            keep_pool = true;
+        else
+            show_invalid_option(argv[i]);
+    }
+    load_scenarios(argv[1] + 4);
+    if (workers < 1)
+        workers = 1;
+    if (workers > scenario_count)
+        workers = scenario_count;                   // no interfaces which would only steal
+
+    run_worker_count = workers;
+    if ((run_workers = calloc(workers, sizeof(*run_workers))) == NULL)
+        err_exit("Error allocating workers\n");
+    for (long i = 0; i < workers; i++) {
+        struct run_worker *w = &run_workers[i];
+        w->id = i;
+        snprintf(w->ifname, sizeof(w->ifname), "%.11s%d", pool, (int)i);
+        run_vcan_up(w);
+        w->sim_sock = run_socket(w->ifname, false);
+        w->mon_sock = run_socket(w->ifname, true);
+        pthread_mutex_init(&w->deque.lock, NULL);
+        if ((w->deque.items = malloc((scenario_count / workers + 1) * sizeof(int))) == NULL)
+            err_exit("Error allocating work queues\n");
+    }
+    for (int i = 0; i < scenario_count; i++) {      // round robin, neighbours in file go to different workers
+        struct run_deque *d = &run_workers[i % workers].deque;
+        d->items[d->bottom++] = i;
+    }
+    printf("Running %d scenarios on %ld interfaces %s0..%s%ld\n", scenario_count, workers, pool, pool, workers - 1);
+    fflush(stdout);
+
+    start = canerr_now_ns();
+    for (long i = 0; i < workers; i++)
+        if ((errno = pthread_create(&run_workers[i].thread, NULL, run_worker_thread, &run_workers[i])) != 0)
+            err_exit("Error starting worker thread\n");
+    for (long i = 0; i < workers; i++)
+        pthread_join(run_workers[i].thread, NULL);
+    run_report(canerr_now_ns() - start);
+
+    for (long i = 0; i < workers; i++) {
+        close(run_workers[i].sim_sock);
+        close(run_workers[i].mon_sock);
+        if (run_workers[i].created && !keep_pool)
+            run_netlink(RTM_DELLINK, 0, run_workers[i].ifname, false);
+        free(run_workers[i].deque.items);
+    }
+    for (int i = 0; i < scenario_count; i++)
+        if (scenarios[i].status != RUN_PASS)
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+
+
+void print_binary(uint32_t number) {
+    uint32_t mask = 0x80000000; // start with the most significant bit
+    for (int i = 0; i < 32; i++) {
+        putchar((number & mask) ? '1' : '0');
+        mask >>= 1; // shift the mask to the right
+    }
+}
+
+
+
+int main(int argc, char *argv[]) {
+    int sock;
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    struct can_frame frame;
+    bool show_bits = false, transceiver_processed = false, arbitration_processed = false;
+    long xl_len = 0, xl_prio = CANXL_PRIO_MASK, xl_sdt = 0;
+    long leader_port = 0, followers = 1, start_delay = 500;
+    long bridge_port = 0, bridge_delay = 20;
+    long pace_us = 0, pace_count = 1000, spin_us = SYNC_SPIN_NS / 1000, fifo = 0, cpu = -1;
+    bool lock_memory = false;
+    long burst_count = 0, senders = 1, streams = 0, seed = 1;
+    bool fuzz = false;
+    char *leader = NULL;
+    static struct canxl_frame xl;
+    char tmp_str[256];
+
+    printf("CAN Sockets Error Messages Simulator\n");
+    if (argc >= 2 && strncasecmp(argv[1], "Run=", 4) == STR_EQUAL)
+        return run_scenarios(argc, argv);   // scenario file instead of CAN interface
+    if (argc < 3)
+        show_help_and_exit();
+ 
+    // initialize CAN frame
+    canerr_frame_init(&frame);
+
+    // Parse command line parameters
+    for (int i = 2; i < argc; i++) {
+        //printf("strlen(argv[%d]) = %d\n", i, strlen(argv[i]));
+
+        // error class (mask) in can_id, or error class with sub code in data[1..4]
+        if (canerr_apply_option(&frame, argv[i]))
+            continue;
+        if (apply_numeric_option(&frame, argv[i], &arbitration_processed, &transceiver_processed))
+            continue;
+        if (parse_number_option(argv[i], "XlLen", CANXL_MIN_DLEN, CANXL_MAX_DLEN, &xl_len))
+            ; // CAN XL data frame instead of error frame
+        else if (parse_number_option(argv[i], "XlPrio", 0, CANXL_PRIO_MASK, &xl_prio))
+            ;
+        else if (parse_number_option(argv[i], "XlSdt", 0, 0xFF, &xl_sdt))
+            ;
+        else if (parse_number_option(argv[i], "Leader", 1, 65535, &leader_port))
+            ; // distribute frame and start time to followers
+        else if (parse_number_option(argv[i], "Followers", 1, SYNC_MAX_FOLLOWERS, &followers))
+            ;
+        else if (parse_number_option(argv[i], "StartDelay", 10, 60000, &start_delay))
+            ;
+        else if (parse_number_option(argv[i], "Bridge", 1, 65535, &bridge_port))
+            ; // inject records forwarded by canerrdump Bridge=
+        else if (parse_number_option(argv[i], "BridgeDelay", 0, 10000, &bridge_delay))
+            ;
+        else if (parse_number_option(argv[i], "Pace", 1, 10000000, &pace_us))
+            ; // send frame repeatedly at precise deadlines
+        else if (parse_number_option(argv[i], "Count", 1, 10000000, &pace_count))
+            ;
+        else if (parse_number_option(argv[i], "Spin", 0, 100000, &spin_us))
+            ;
+        else if (parse_number_option(argv[i], "Fifo", 1, 99, &fifo))
+            ;
+        else if (parse_number_option(argv[i], "Cpu", 0, CPU_SETSIZE - 1, &cpu))
+            ;
+        else if (strcasecmp(argv[i], "LockMemory") == STR_EQUAL)
+            lock_memory = true;
+        else if (parse_number_option(argv[i], "Burst", 1, 1000000000, &burst_count))
+            ; // max rate injection from several sender threads
+        else if (parse_number_option(argv[i], "Senders", 1, BURST_MAX_SENDERS, &senders))
+            ;
+        else if (parse_number_option(argv[i], "Streams", 1, 1000000, &streams))
+            ;
+        else if (parse_number_option(argv[i], "Seed", 0, LONG_MAX, &seed))
+            ;
+        else if (strcasecmp(argv[i], "Fuzz") == STR_EQUAL)
+            fuzz = true;
+        else if (strncasecmp(argv[i], "Follow=", 7) == STR_EQUAL)
+            leader = argv[i] + 7;                   // take frame and start time from leader
         else if (strcasecmp(argv[i], "ShowBits")  == STR_EQUAL)    // DEBUG helper
             show_bits = true; // Display frame as bits
         else
             show_invalid_option(argv[i]);
     }
 
+    if (xl_len > 0 && (frame.can_id & CAN_ERR_MASK))
+        err_exit("Error: CAN XL frames can not carry error classes, use XlLen alone or with Data<0..7>\n");
+
+    CANERR_PROBE(frame_built, frame.can_id, canerr_now_ns());
+
     if (show_bits == true) {
         printf("CAN ID   = ");
         print_binary(frame.can_id);
@@ -562,11 +1605,44 @@ int main(int argc, char *argv[]) {
     if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
         err_exit("Error in socket bind");
 
+    if (xl_len > 0)
+        build_xl_frame(&xl, &frame, xl_len, xl_prio, xl_sdt);
+
+    if (bridge_port > 0)
+        run_bridge(sock, can_interface_name, bridge_port, bridge_delay);
+    else if (leader_port > 0) {
+        if (xl_len > 0)
+            enable_xl_frames(sock);
+        run_leader(sock, can_interface_name, leader_port, followers, start_delay, &frame, xl_len, xl_prio, xl_sdt,
+                   xl_len > 0 ? (const void *)&xl : (const void *)&frame,
+                   xl_len > 0 ? CANXL_HDR_SIZE + xl_len : sizeof(frame));
+    }
+    else if (leader != NULL)
+        run_follower(sock, can_interface_name, leader);
+    else if (burst_count > 0) {
+        if (fuzz && xl_len > 0)
+            err_exit("Error: Fuzz builds error frames, it can not be used with XlLen\n");
+        run_burst(can_interface_name, xl_len > 0 ? (const void *)&xl : (const void *)&frame,
+                  xl_len > 0 ? CANXL_HDR_SIZE + xl_len : sizeof(frame), burst_count, senders, streams, fuzz, seed, cpu);
+    }
+    else if (pace_us > 0) {
+        if (xl_len > 0)
+            enable_xl_frames(sock);
+        run_pace(sock, can_interface_name, xl_len > 0 ? (const void *)&xl : (const void *)&frame,
+                 xl_len > 0 ? CANXL_HDR_SIZE + xl_len : sizeof(frame), pace_us, pace_count, spin_us,
+                 fifo, cpu, lock_memory);
+    }
+    else if (xl_len > 0)
+        send_xl_frame(sock, &xl);
     // Send CAN error frame
-    if (write(sock, &frame, sizeof(frame)) < 0)
+    else if (write(sock, &frame, sizeof(frame)) < 0) {
+        CANERR_PROBE(send_failed, frame.can_id, canerr_now_ns(), errno);
         err_exit("Error writing to socket");
-    else
+    }
+    else {
+        CANERR_PROBE(frame_sent, frame.can_id, canerr_now_ns());
         printf("CAN error frame sent\n");
+    }
 
     close(sock);
 
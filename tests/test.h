@@ -0,0 +1,44 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  test.h - minimal assertions of canerrsim and canerrdump unit tests                            //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  Failed checks print file, line and the failed condition and tests go on, test_report()        //
+//  prints the summary and gives exit code for make test.                                         //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CANERR_TEST_H
+#define CANERR_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+
+static int test_checks   = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                                    \
+        test_checks++;                                                                      \
+        if (!(cond)) {                                                                      \
+            test_failures++;                                                                \
+            fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond);              \
+        }                                                                                   \
+    } while (0)
+
+#define CHECK_STR(got, expected) do {                                                       \
+        const char *got_ = (got), *expected_ = (expected);                                  \
+        test_checks++;                                                                      \
+        if (strcmp(got_, expected_) != 0) {                                                 \
+            test_failures++;                                                                \
+            fprintf(stderr, "%s:%d: FAILED: %s\n    got:      \"%s\"\n    expected: \"%s\"\n", \
+                    __FILE__, __LINE__, #got, got_, expected_);                             \
+        }                                                                                   \
+    } while (0)
+
+static inline int test_report(const char *name) {
+    fprintf(stderr, "%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif
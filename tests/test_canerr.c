@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  test_canerr.c - unit tests of canerr.h error frame builder and decoder                        //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  Built with -std=c99 -pedantic, so it also checks that canerr.h stays plain C99. Every option  //
+//  name of the tables has to build a frame which decodes back to the same name.                  //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "../canerr.h"
+#include "test.h"
+
+// build frame from space separated option names, false if one of them is unknown
+static bool build(struct can_frame *frame, const char *options) {
+    char text[256], *name;
+
+    canerr_frame_init(frame);
+    snprintf(text, sizeof(text), "%s", options);
+    for (name = strtok(text, " "); name != NULL; name = strtok(NULL, " "))
+        if (!canerr_apply_option(frame, name))
+            return false;
+    return true;
+}
+
+static const char *decode(const struct can_frame *frame) {
+    static char str[256];
+    canerr_decode(frame, str, sizeof(str));
+    return str;
+}
+
+static void test_classes(void) {
+    struct can_frame frame;
+    char expected[64];
+
+    for (size_t i = 0; i < CANERR_COUNT(canerr_class_codes); i++) {
+        CHECK(build(&frame, canerr_class_codes[i].name));
+        CHECK(frame.can_id == (CAN_ERR_FLAG | canerr_class_codes[i].value));
+        CHECK(frame.can_dlc == CAN_ERR_DLC);
+        CHECK_STR(decode(&frame), canerr_class_codes[i].name);
+    }
+    CHECK(build(&frame, "busoff"));                 // names are case insensitive
+    CHECK_STR(decode(&frame), "BusOff");
+    CHECK(!build(&frame, "BusOf"));
+    CHECK(!build(&frame, "Unspec"));                // only reachable through CtrlUnspec and such
+
+    for (size_t i = 0; i < CANERR_COUNT(canerr_ctrl_codes); i++) {
+        CHECK(build(&frame, canerr_ctrl_codes[i].name));
+        snprintf(expected, sizeof(expected), "Ctrl(%s)", canerr_ctrl_codes[i].name);
+        CHECK_STR(decode(&frame), expected);
+    }
+    for (size_t i = 1; i < CANERR_COUNT(canerr_trx_codes); i++) {
+        CHECK(build(&frame, canerr_trx_codes[i].name));
+        CHECK(frame.data[4] == canerr_trx_codes[i].value);
+        snprintf(expected, sizeof(expected), "Trans(%s)", canerr_trx_codes[i].name);
+        CHECK_STR(decode(&frame), expected);
+    }
+}
+
+static void test_sub_codes(void) {
+    struct can_frame frame;
+    char expected[64];
+
+    for (size_t i = 0; i < CANERR_COUNT(canerr_prot_type_codes); i++) {
+        CHECK(build(&frame, canerr_prot_type_codes[i].name));
+        snprintf(expected, sizeof(expected), "Prot(Type(%s),Loc(Unspec))", canerr_prot_type_codes[i].name);
+        CHECK_STR(decode(&frame), expected);
+    }
+    for (size_t i = 1; i < CANERR_COUNT(canerr_prot_loc_codes); i++) {
+        CHECK(build(&frame, canerr_prot_loc_codes[i].name));
+        CHECK(frame.data[3] == canerr_prot_loc_codes[i].value);
+        snprintf(expected, sizeof(expected), "Prot(Type(Unspec),Loc(%s))", canerr_prot_loc_codes[i].name);
+        CHECK_STR(decode(&frame), expected);
+    }
+
+    CHECK(build(&frame, "WarningTX PassiveTX"));    // controller bits are combined
+    CHECK_STR(decode(&frame), "Ctrl(WarningTX,PassiveTX)");
+    CHECK(build(&frame, "Bit0 Bit1"));              // protocol type keeps the last one like canerrsim
+    CHECK_STR(decode(&frame), "Prot(Type(Bit1),Loc(Unspec))");
+    CHECK(build(&frame, "WarningTX CtrlUnspec"));
+    CHECK_STR(decode(&frame), "Ctrl(Unspec)");
+    CHECK(build(&frame, "CanHiNoWire TransUnspec"));
+    CHECK_STR(decode(&frame), "Trans(Unspec)");
+
+    CHECK(build(&frame, "BusOff Bit0 DATA"));       // example of canerr.h header comment
+    CHECK_STR(decode(&frame), "BusOff,Prot(Type(Bit0),Loc(DATA))");
+    CHECK(build(&frame, "TX BusOff NoAck"));
+    frame.can_id |= CAN_ERR_LOSTARB;
+    frame.data[0] = 9;
+    CHECK_STR(decode(&frame), "LostArBit09,NoAck,BusOff,Prot(Type(TX),Loc(Unspec))");
+
+    canerr_frame_init(&frame);
+    frame.can_id |= CAN_ERR_CNT;
+    frame.data[6] = 128;
+    frame.data[7] = 5;
+    CHECK_STR(decode(&frame), "Count(TX=128,RX=5)");
+    canerr_frame_init(&frame);
+    frame.can_id |= CAN_ERR_TRX;
+    frame.data[4] = 0xFF;
+    CHECK_STR(decode(&frame), "Trans(Unknown)");
+    canerr_frame_init(&frame);
+    CHECK_STR(decode(&frame), "");
+}
+
+static void test_append(void) {
+    struct can_frame frame;
+    char str[16];
+    size_t len = 0;
+
+    canerr_append(str, sizeof(str), &len, "%s", "Bus");
+    canerr_append(str, sizeof(str), &len, "%d", 42);
+    CHECK(len == 5);
+    CHECK_STR(str, "Bus42");
+    canerr_append(str, sizeof(str), &len, "%s", "0123456789abcdef");   // cut at end of buffer
+    CHECK(len == sizeof(str) - 1);
+    CHECK_STR(str, "Bus420123456789");
+    canerr_append(str, sizeof(str), &len, "%s", "more");               // full buffer stays as it is
+    CHECK(len == sizeof(str) - 1);
+    CHECK_STR(str, "Bus420123456789");
+
+    CHECK(build(&frame, "NoAck BusOff Bit0 DATA"));
+    len = canerr_decode(&frame, str, sizeof(str));  // decoded text cut, length matches the string
+    CHECK(len == strlen(str));
+    CHECK_STR(str, "NoAck,BusOff,Pr");
+    CHECK(canerr_decode(&frame, str, 0) == 0);
+}
+
+static void test_name_cmp(void) {
+    CHECK(canerr_name_cmp("BusOff", "busoff") == 0);
+    CHECK(canerr_name_cmp("BUSOFF", "BusOff") == 0);
+    CHECK(canerr_name_cmp("Bus", "BusOff") < 0);
+    CHECK(canerr_name_cmp("BusOff", "Bus") > 0);
+}
+
+int main(void) {
+    test_classes();
+    test_sub_codes();
+    test_append();
+    test_name_cmp();
+    return test_report("test_canerr");
+}
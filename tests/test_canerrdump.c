@@ -0,0 +1,721 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  test_canerrdump.c - unit tests of canerrdump parts which need no CAN interface                //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  canerrdump.c is included with its main renamed, so tests call the same functions the tool     //
+//  runs. Records come from canerr_apply_option() instead of sockets, lines which canerrdump      //
+//  prints are taken from a temporary file standing in for stdout.                                //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define main canerrdump_main
+#include "../canerrdump.c"
+#undef main
+
+#include <sys/wait.h>
+#include "test.h"
+
+#define TEST_MS 1000000ULL
+#define TEST_BASE_NS 1700000000000000000ULL     // 2023-11-14, any fixed time works
+
+// error frame record of interface built from space separated canerrsim option names
+struct canerr_record error_record(int iface, uint64_t ns, const char *options) {
+    struct canerr_record rec = { .iface = iface, .ifname = stream.ifnames[iface], .type = CANERR_FRAME_ERROR };
+    char text[256], *save;
+
+    canerr_frame_init(&rec.frame);
+    snprintf(text, sizeof(text), "%s", options);
+    for (char *name = strtok_r(text, " ", &save); name != NULL; name = strtok_r(NULL, " ", &save))
+        if (!canerr_apply_option(&rec.frame, name))
+            fprintf(stderr, "Unknown option %s in test\n", name);
+    rec.len = sizeof(rec.frame);
+    rec.timestamp.tv_sec  = ns / 1000000000ULL;
+    rec.timestamp.tv_nsec = ns % 1000000000ULL;
+    return rec;
+}
+
+// stdout of canerrdump goes to a temporary file between stdout_begin() and stdout_end()
+int stdout_saved = -1;
+
+FILE *stdout_begin(void) {
+    FILE *f = tmpfile();
+
+    fflush(stdout);
+    stdout_saved = dup(STDOUT_FILENO);
+    dup2(fileno(f), STDOUT_FILENO);
+    return f;
+}
+
+size_t stdout_end(FILE *f, char *out, size_t size) {
+    size_t len;
+
+    fflush(stdout);
+    dup2(stdout_saved, STDOUT_FILENO);
+    close(stdout_saved);
+    rewind(f);
+    len = fread(out, 1, size - 1, f);
+    out[len] = '\0';
+    fclose(f);
+    return len;
+}
+
+// exit code of fn(arg) run in a child, 0 if fn returns, for options which have to be refused
+int exit_code(void (*fn)(const char *), const char *arg) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(2);
+        fn(arg);
+        exit(EXIT_SUCCESS);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void test_streams(void) {
+    memset(&stream, 0, sizeof(stream));
+    stream.count = 2;
+    snprintf(stream.ifnames[0], IF_NAMESIZE, "can0");
+    snprintf(stream.ifnames[1], IF_NAMESIZE, "can1");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Format=                                                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void run_format(const char *template) {
+    compile_format(template);
+}
+
+void test_format(void) {
+    struct canerr_record rec = error_record(0, TEST_BASE_NS + 123456789, "Bit0 DATA");
+    char line[512];
+
+    rec.frame.can_id |= CAN_ERR_CNT;
+    rec.frame.data[6] = 96;
+    rec.frame.data[7] = 0;
+
+    compile_format("%ts %if %id %class %loc %tec/%rec 100%% %prot|%ctrl|%trx|%arb");
+    format_template(&rec, line, sizeof(line));
+    CHECK_STR(line, "1700000000.123456 can0 0x208 Prot,Count DATA 96/0 100% Bit0|-|-|-\n");
+
+    compile_format("%dlc:%data %err");
+    format_template(&rec, line, sizeof(line));
+    CHECK_STR(line, "8:00 00 08 0A 00 00 60 00 Count(TX=96,RX=0),Prot(Type(Bit0),Loc(DATA))\n");
+
+    compile_format("%ID%If%tecx");                  // names are case insensitive, text may follow directly
+    format_template(&rec, line, sizeof(line));
+    CHECK_STR(line, "0x208can096x\n");
+
+    compile_format("");                             // empty template prints empty lines
+    CHECK(format_op_count == 1);
+    format_template(&rec, line, sizeof(line));
+    CHECK_STR(line, "\n");
+
+    compile_format("%ts %if");                      // data frames and kernel messages keep their own lines
+    rec.type = CANERR_FRAME_CC;
+    rec.frame.can_id = 0x123;
+    format_line(&rec, false, line, sizeof(line));
+    CHECK_STR(line, "0x123 [8] 00 00 08 0A 00 00 60 00 \n");
+
+    format_op_count = 0;                            // default line format again
+    rec = error_record(1, TEST_BASE_NS, "TX BusOff NoAck");
+    rec.frame.can_id |= CAN_ERR_LOSTARB;
+    rec.frame.data[0] = 9;
+    rec.frame.data[4] = 0xAA;
+    format_line(&rec, true, line, sizeof(line));
+    CHECK_STR(line, "can1 0x06A [8] 09 00 80 00 AA 00 00 00  ERR=LostArBit09,NoAck,BusOff,Prot(Type(TX),Loc(Unspec))\n");
+
+    CHECK(exit_code(run_format, "%ts %bogus") == EXIT_FAILURE);
+    CHECK(exit_code(run_format, "%ts %if") == 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Expect=                                                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct expect test_expect;
+
+void run_expect_open(const char *pattern) {
+    memset(&test_expect, 0, sizeof(test_expect));
+    expect_open(&test_expect, pattern, false);
+}
+
+// feed "iface ms options" steps separated by ';' to a fresh automaton, returns what it printed
+const char *run_expect(const char *pattern, const char *steps, uint64_t tick_ms) {
+    static char out[8192];
+    char text[1024], *save;
+    FILE *f;
+
+    run_expect_open(pattern);
+    snprintf(text, sizeof(text), "%s", steps);
+    f = stdout_begin();
+    for (char *step = strtok_r(text, ";", &save); step != NULL; step = strtok_r(NULL, ";", &save)) {
+        int iface, used = 0;
+        unsigned long ms;
+        if (sscanf(step, " %d %lu %n", &iface, &ms, &used) < 2)
+            continue;
+        struct canerr_record rec = error_record(iface, TEST_BASE_NS + ms * TEST_MS, step + used);
+        expect_batch(&test_expect, &rec, 1);
+    }
+    if (tick_ms > 0)
+        expect_tick(&test_expect, TEST_BASE_NS + tick_ms * TEST_MS);
+    stdout_end(f, out, sizeof(out));
+    return out;
+}
+
+void test_expect_automaton(void) {
+    const char *escalation = "WarningTX Prot(Bit0,DATA){3,} PassiveTX BusOff within 500ms";
+    const char *out;
+    char pattern[512];
+
+    // two interfaces run attempts of their own, can1 breaks the sequence with its BusOff
+    out = run_expect(escalation,
+                     "0 0 BusOff; 0 1 WarningTX; 1 2 WarningTX; 0 3 Bit0 DATA; 1 4 Bit0 DATA; 0 5 Bit0 DATA;"
+                     "1 6 BusOff; 0 7 Bit0 DATA; 0 8 Bit0 DATA; 0 9 PassiveTX; 0 10 BusOff", 0);
+    CHECK(test_expect.matches == 1);
+    CHECK(test_expect.violations == 1);
+    CHECK(test_expect.timeouts == 0);
+    CHECK(strstr(out, "EXPECT match on can0 after 7 events in 9.000 ms\n") != NULL);
+    CHECK(strstr(out, "EXPECT violated on can1 after 2 events in 4.000 ms, expected Prot(Bit0,DATA){3,}, "
+                      "got: 0x040 [8] 00 00 00 00 00 00 00 00  ERR=BusOff\n") != NULL);
+    CHECK(expect_close(&test_expect) == 1);         // violation fails the run
+
+    // "within" ends attempts on the next frame and on timer ticks without any frame
+    out = run_expect(escalation, "0 0 WarningTX; 0 200 Bit0 DATA; 0 600 Bit0 DATA; 1 1000 WarningTX", 1600);
+    CHECK(test_expect.timeouts == 2);
+    CHECK(test_expect.matches == 0 && test_expect.violations == 0);
+    CHECK(strstr(out, "EXPECT timeout on can0 after 2 events in 500.000 ms, still waiting for Prot(Bit0,DATA){3,}\n") != NULL);
+    CHECK(strstr(out, "EXPECT timeout on can1 after 1 events in 500.000 ms") != NULL);
+
+    // exact count, optional item and Any
+    run_expect("NoAck{2} BusOff? Restarted", "0 0 NoAck; 0 1 NoAck; 0 2 Restarted; 0 3 NoAck; 0 4 NoAck; 0 5 BusOff; 0 6 Restarted", 0);
+    CHECK(test_expect.matches == 2 && test_expect.violations == 0);
+    CHECK(expect_close(&test_expect) == 0);
+    run_expect("NoAck{2} BusOff? Restarted", "0 0 NoAck; 0 1 NoAck; 0 2 NoAck", 0);
+    CHECK(test_expect.matches == 0 && test_expect.violations == 1);
+    run_expect("NoAck{2,3} Restarted", "0 0 NoAck; 0 1 NoAck; 0 2 NoAck; 0 3 Restarted", 0);
+    CHECK(test_expect.matches == 1 && test_expect.violations == 0);
+    run_expect("BusOff Any Restarted", "0 0 BusOff; 0 1 Bit1; 0 2 Restarted", 0);
+    CHECK(test_expect.matches == 1);
+    run_expect("Ctrl+ BusOff", "0 0 WarningTX; 0 1 PassiveTX; 0 2 WarningRX; 0 3 BusOff", 0);
+    CHECK(test_expect.matches == 1);
+
+    // sub codes: bit names must all be set, locations must be equal
+    run_expect("Ctrl(WarningTX,PassiveTX)", "0 0 WarningTX; 0 1 PassiveTX; 0 2 WarningTX PassiveTX WarningRX", 0);
+    CHECK(test_expect.matches == 1 && test_expect.violations == 0);
+    run_expect("Prot(DATA)", "0 0 Bit0 ACK; 0 1 Bit1 DATA", 0);
+    CHECK(test_expect.matches == 1 && test_expect.violations == 0);
+
+    CHECK(exit_code(run_expect_open, "Prot(Bit0") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "BusOff{0}") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "BusOff{3,1}") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "Bogus") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "BusOff within") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "BusOff within 5 minutes") == EXIT_FAILURE);
+    CHECK(exit_code(run_expect_open, "NoAck{65}") == EXIT_FAILURE);   // more states than bits
+    CHECK(exit_code(run_expect_open, "NoAck{64}") == 0);
+
+    pattern[0] = '\0';                              // items beyond the last state are refused, not dropped
+    for (int i = 0; i < EXPECT_MAX_STATES; i++)
+        strcat(pattern, "NoAck ");
+    strcat(pattern, "within 500ms");
+    CHECK(exit_code(run_expect_open, pattern) == 0);
+    memcpy(pattern + strlen(pattern) - 12, "BusOff within 500ms", 20);
+    CHECK(exit_code(run_expect_open, pattern) == EXIT_FAILURE);
+}
+
+// data frames and kernel messages pass expect_batch() without touching attempts
+void test_expect_batch(void) {
+    struct canerr_record recs[3];
+
+    run_expect_open("WarningTX BusOff");
+    recs[0] = error_record(0, TEST_BASE_NS, "WarningTX");
+    recs[1] = error_record(0, TEST_BASE_NS + TEST_MS, "NoAck");
+    recs[1].type = CANERR_FRAME_CC;
+    recs[2] = error_record(0, TEST_BASE_NS + 2 * TEST_MS, "BusOff");
+    FILE *f = stdout_begin();
+    expect_batch(&test_expect, recs, 3);
+    char out[512];
+    stdout_end(f, out, sizeof(out));
+    CHECK(test_expect.matches == 1 && test_expect.violations == 0);
+    CHECK_STR(out, "EXPECT match on can0 after 2 events in 2.000 ms\n");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Incident=                                                                                     //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct incident test_incident;
+
+void run_incident_open(const char *trigger) {
+    incident_open(&test_incident, "/tmp", 1, 1, trigger, 64);
+}
+
+void test_incident_trigger(void) {
+    char names[65 * 8] = "";
+    size_t len = 0;
+
+    for (int i = 0; i < EXPECT_MAX_STATES; i++)
+        canerr_append(names, sizeof(names), &len, "%sBusOff", i ? " " : "");
+    CHECK(exit_code(run_incident_open, names) == 0);
+    canerr_append(names, sizeof(names), &len, " Trans");
+    CHECK(exit_code(run_incident_open, names) == EXIT_FAILURE);   // 65th name is refused, not dropped
+    CHECK(exit_code(run_incident_open, "") == EXIT_FAILURE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Capture=, Read= and Follow=                                                                   //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TEST_CAPTURE_RECORDS 5000               // more than two 64 KiB blocks
+#define TEST_CAPTURE_BLOCK (64 * 1024)
+
+const char *capture_options[] = { "BusOff", "NoAck", "WarningTX PassiveTX", "Bit0 DATA", "CanHiNoWire" };
+const char kmsg_text[] = "mcp251x spi0.0 can0: bus-off";
+struct canfd_frame fd_frames[TEST_CAPTURE_RECORDS / 97 + 1];
+struct canerr_record capture_recs[TEST_CAPTURE_RECORDS];
+char *expected_lines;
+size_t expected_len;
+
+// mix of error frames, CAN FD data frames and one kernel log message on two interfaces
+void make_capture_records(void) {
+    expected_len = 0;
+    for (int i = 0; i < TEST_CAPTURE_RECORDS; i++) {
+        struct canerr_record *rec = &capture_recs[i];
+        *rec = error_record(i % 2, TEST_BASE_NS + i * 1000ULL, capture_options[i % CANERR_COUNT(capture_options)]);
+        if (i % 97 == 50) {
+            struct canfd_frame *fd = &fd_frames[i / 97];
+            fd->can_id = 0x100 + i / 97;
+            fd->len    = 12 + i % 40;
+            for (int b = 0; b < fd->len; b++)
+                fd->data[b] = i + b;
+            canerr_record_set(rec, CANERR_FRAME_FD, (const uint8_t *)fd, sizeof(*fd));
+        } else if (i == 1234)
+            canerr_record_set(rec, CANERR_FRAME_KMSG, (const uint8_t *)kmsg_text, strlen(kmsg_text));
+        expected_len += format_line(rec, true, expected_lines + expected_len, 4096);
+    }
+}
+
+void write_capture(struct capture *cap, const char *path, int first, int last) {
+    if (first == 0) {
+        *cap = (struct capture){ .fd = -1, .flush_ns = CAPTURE_FLUSH_MS * 1000000ULL };
+        capture_open(cap, path, TEST_CAPTURE_BLOCK, &stream);
+    }
+    for (int i = first; i < last; i++) {
+        capture_add(cap, &capture_recs[i]);
+        if (i % 1000 == 999)
+            capture_flush(cap);                     // partial block rewritten when it fills later
+    }
+}
+
+// temporary capture file with the lines canerrdump prints for capture_recs
+char capture_dir[] = "/tmp/canerrdump-test-XXXXXX", capture_path[64], *capture_out, *capture_block;
+
+bool capture_setup(void) {
+    if (mkdtemp(capture_dir) == NULL)
+        return false;
+    snprintf(capture_path, sizeof(capture_path), "%s/test.cap", capture_dir);
+    expected_lines = malloc(TEST_CAPTURE_RECORDS * 256);
+    capture_out    = malloc(TEST_CAPTURE_RECORDS * 256);
+    capture_block  = aligned_alloc(4096, TEST_CAPTURE_BLOCK);
+    test_streams();
+    make_capture_records();
+    return true;
+}
+
+void capture_teardown(void) {
+    unlink(capture_path);
+    rmdir(capture_dir);
+    snprintf(capture_dir, sizeof(capture_dir), "/tmp/canerrdump-test-XXXXXX");
+    free(capture_block);
+    free(capture_out);
+    free(expected_lines);
+}
+
+// Read= of a finished capture prints the same lines as live output
+void test_capture_read(void) {
+    static struct capture cap;
+    size_t block_size = 0, len;
+    int fd;
+    FILE *f;
+
+    if (!capture_setup()) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    write_capture(&cap, capture_path, 0, TEST_CAPTURE_RECORDS);
+    capture_close(&cap);
+    fd = capture_read_open(capture_path, &stream, &block_size);
+    CHECK(block_size == TEST_CAPTURE_BLOCK);
+    CHECK(stream.count == 2);
+    CHECK_STR(stream.ifnames[1], "can1");
+    f = stdout_begin();
+    capture_read_all(fd, capture_block, block_size, CAN_ERR_MASK, true);
+    len = stdout_end(f, capture_out, TEST_CAPTURE_RECORDS * 256);
+    CHECK(len == expected_len);
+    CHECK(memcmp(capture_out, expected_lines, expected_len) == 0);
+
+    // error mask like CAN_RAW_ERR_FILTER, data frames only when asked for
+    f = stdout_begin();
+    capture_read_all(fd, capture_block, block_size, CAN_ERR_BUSOFF, false);
+    stdout_end(f, capture_out, TEST_CAPTURE_RECORDS * 256);
+    CHECK(strstr(capture_out, "can0 0x040 [8] 00 00 00 00 00 00 00 00  ERR=BusOff\n") == capture_out);
+    CHECK(strstr(capture_out, "NoAck") == NULL && strstr(capture_out, " FD ") == NULL);
+    CHECK(strstr(capture_out, "KMSG BusOff   mcp251x spi0.0 can0: bus-off\n") != NULL);
+    close(fd);
+    close(stream.cancel_fd);
+    capture_teardown();
+}
+
+struct follow_args {
+    int fd;
+    char *block;
+    size_t block_size;
+};
+
+void *follow_thread(void *arg) {
+    struct follow_args *a = arg;
+    capture_follow(a->fd, capture_path, a->block, a->block_size, CAN_ERR_MASK, true);
+    return NULL;
+}
+
+// Follow= of a capture still being written sees every record once, then stops with the writer
+void test_capture_follow(void) {
+    static struct capture cap;
+    struct follow_args args = { .fd = -1 };
+    pthread_t thread;
+    size_t len;
+    FILE *f;
+
+    if (!capture_setup()) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    write_capture(&cap, capture_path, 0, TEST_CAPTURE_RECORDS / 3);
+    capture_flush(&cap);
+    args.fd    = capture_read_open(capture_path, &stream, &args.block_size);
+    args.block = capture_block;
+    f = stdout_begin();
+    pthread_create(&thread, NULL, follow_thread, &args);
+    write_capture(&cap, capture_path, TEST_CAPTURE_RECORDS / 3, TEST_CAPTURE_RECORDS);
+    capture_close(&cap);
+    pthread_join(thread, NULL);
+    len = stdout_end(f, capture_out, TEST_CAPTURE_RECORDS * 256);
+    CHECK(len == expected_len);
+    CHECK(memcmp(capture_out, expected_lines, expected_len) == 0);
+    close(args.fd);
+    close(stream.cancel_fd);
+    capture_teardown();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Bridge=                                                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void test_bridge(void) {
+    static struct bridge b;
+    static struct canerr_record recs[CANERR_MAX_BATCH];
+    static struct canfd_frame fd;
+    char dgram[CANERR_BRIDGE_DGRAM_MAX] __attribute__((aligned(8)));
+    int sv[2], n = 0, count = 0, datagrams = 0;
+    ssize_t len;
+
+    test_streams();
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+        CHECK(!"socketpair");
+        return;
+    }
+    b.fd = sv[0];
+    for (int i = 0; i < CANERR_MAX_BATCH; i++)
+        recs[i] = error_record(i % 2, TEST_BASE_NS + i, capture_options[i % CANERR_COUNT(capture_options)]);
+    fd.can_id = 0x7FF;
+    fd.len    = 64;
+    memset(fd.data, 0x5A, sizeof(fd.data));
+    canerr_record_set(&recs[10], CANERR_FRAME_FD, (const uint8_t *)&fd, sizeof(fd));
+    bridge_send_batch(&b, recs, CANERR_MAX_BATCH);
+    CHECK(b.records == CANERR_MAX_BATCH && b.failed == 0);
+    CHECK(b.datagrams == 2);                        // 64 small records do not fit in one datagram
+
+    while ((len = recv(sv[1], dgram, sizeof(dgram), MSG_DONTWAIT)) > 0) {
+        const struct canerr_bridge_header *hdr = (const struct canerr_bridge_header *)dgram;
+        const struct canerr_cap_record *rec;
+        size_t pos = 0;
+        int records = 0;
+        CHECK((size_t)len <= sizeof(*hdr) + CANERR_BRIDGE_PAYLOAD);
+        CHECK(hdr->seq == (uint64_t)datagrams);
+        while ((rec = canerr_bridge_next(dgram, len, &pos)) != NULL) {
+            const struct canerr_record *orig = &recs[n++];
+            CHECK(rec->iface == orig->iface && rec->type == orig->type);
+            CHECK(rec->timestamp_ns == canerr_timespec_ns(&orig->timestamp));
+            CHECK(rec->len == canerr_record_size(orig));
+            CHECK(memcmp(rec + 1, orig->raw != NULL ? orig->raw : (const uint8_t *)&orig->frame, rec->len) == 0);
+            records++;
+        }
+        CHECK(pos == (size_t)len);                  // whole datagram decoded
+        CHECK(records == hdr->count);
+        count += records;
+        datagrams++;
+    }
+    CHECK(datagrams == 2 && count == CANERR_MAX_BATCH && n == CANERR_MAX_BATCH);
+
+    // foreign and truncated datagrams give no records
+    bridge_send_batch(&b, recs, 1);
+    len = recv(sv[1], dgram, sizeof(dgram), 0);
+    size_t pos = 0;
+    CHECK(canerr_bridge_next(dgram, len - 8, &pos) == NULL);
+    pos = 0;
+    ((struct canerr_bridge_header *)dgram)->version++;
+    CHECK(canerr_bridge_next(dgram, len, &pos) == NULL);
+    pos = 0;
+    ((struct canerr_bridge_header *)dgram)->version--;
+    ((struct canerr_bridge_header *)dgram)->magic = 0;
+    CHECK(canerr_bridge_next(dgram, len, &pos) == NULL);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  MQTT=                                                                                         //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void test_mqtt_length(void) {
+    static const struct {
+        size_t value;
+        size_t len;
+        uint8_t bytes[4];
+    } cases[] = {                                   // boundaries of MQTT 3.1.1 section 2.2.3
+        { 0,         1, { 0x00 } },
+        { 127,       1, { 0x7F } },
+        { 128,       2, { 0x80, 0x01 } },
+        { 16383,     2, { 0xFF, 0x7F } },
+        { 16384,     3, { 0x80, 0x80, 0x01 } },
+        { 2097151,   3, { 0xFF, 0xFF, 0x7F } },
+        { 2097152,   4, { 0x80, 0x80, 0x80, 0x01 } },
+        { 268435455, 4, { 0xFF, 0xFF, 0xFF, 0x7F } },
+    };
+    uint8_t out[8];
+
+    for (size_t i = 0; i < CANERR_COUNT(cases); i++) {
+        memset(out, 0xEE, sizeof(out));
+        CHECK(mqtt_put_length(out, cases[i].value) == cases[i].len);
+        CHECK(memcmp(out, cases[i].bytes, cases[i].len) == 0);
+        CHECK(out[cases[i].len] == 0xEE);
+    }
+    CHECK(mqtt_put_string(out, "can0", 4) == 6);
+    CHECK(memcmp(out, "\0\4can0", 6) == 0);
+}
+
+// first byte of PUBLISH which mqtt_send_queued() sends after reconnect, 0 if none
+uint8_t mqtt_resend(struct mqtt *m, int *broker) {
+    uint8_t packet[sizeof(struct mqtt_message) + 16];
+    int sv[2];
+
+    mqtt_disconnect(m);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return 0;
+    m->fd   = sv[0];
+    *broker = sv[1];
+    if (mqtt_send_queued(m) != 1 || recv(*broker, packet, sizeof(packet), 0) <= 0)
+        return 0;
+    return packet[0];
+}
+
+void test_mqtt_resend(void) {
+    static struct mqtt_message queue[4];
+    struct mqtt m = { .fd = -1, .topic = "canerr", .queue = queue, .queue_size = CANERR_COUNT(queue) };
+    uint8_t puback[4] = { 0x40, 2 };
+    int sv[2], broker;
+
+    m.wake_fd = eventfd(0, EFD_CLOEXEC);
+    pthread_mutex_init(&m.lock, NULL);
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);   // QoS 0 send fails, resent without DUP
+    close(sv[1]);
+    m.fd = sv[0];
+    mqtt_push(&m, "can0", "event", "{}", 2);
+    CHECK(mqtt_send_queued(&m) == -1);
+    CHECK(mqtt_resend(&m, &broker) == 0x30);
+    CHECK(mqtt_drained(&m));
+    CHECK(m.published == 1);
+    close(broker);
+
+    m.qos = 1;                                      // QoS 1 message in flight is resent with DUP
+    mqtt_push(&m, "can0", "event", "{}", 2);
+    CHECK(mqtt_resend(&m, &broker) == 0x32);
+    close(broker);
+    CHECK(mqtt_resend(&m, &broker) == 0x3A);
+    puback[2] = queue[m.tail % m.queue_size].id >> 8;
+    puback[3] = (queue[m.tail % m.queue_size].id + 1) & 0xFF;
+    CHECK(write(broker, puback, sizeof(puback)) == sizeof(puback));
+    CHECK(mqtt_receive(&m));                        // PUBACK of another packet releases nothing
+    CHECK(m.inflight == 1);
+    puback[3] = queue[m.tail % m.queue_size].id & 0xFF;
+    CHECK(write(broker, puback, sizeof(puback)) == sizeof(puback));
+    CHECK(mqtt_receive(&m));
+    CHECK(m.inflight == 0);
+    CHECK(mqtt_drained(&m));
+    CHECK(m.published == 2);
+    close(broker);
+    mqtt_disconnect(&m);
+    close(m.wake_fd);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Dashboard=                                                                                    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *sha1_hex(const char *text) {
+    static char hex[41];
+    uint8_t digest[20];
+
+    dash_sha1((const uint8_t *)text, strlen(text), digest);
+    for (int i = 0; i < 20; i++)
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    return hex;
+}
+
+const char *base64(const char *text) {
+    static char out[64];
+    dash_base64((const uint8_t *)text, strlen(text), out);
+    return out;
+}
+
+void test_dash_encoding(void) {
+    char text[1001];
+
+    CHECK_STR(sha1_hex(""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");      // FIPS 180 examples
+    CHECK_STR(sha1_hex("abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    CHECK_STR(sha1_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),   // padding in second block
+              "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    memset(text, 'a', 1000);
+    text[1000] = '\0';
+    CHECK_STR(sha1_hex(text), "291e9a6c66994949b57ba5e650361e98fc36b1ba");
+    text[55] = '\0';                                // longest message with length in the same block
+    CHECK_STR(sha1_hex(text), "c1c8bbdc22796e28c0e15163d20899b65621d65a");
+    text[55] = 'a';
+    text[64] = '\0';
+    CHECK_STR(sha1_hex(text), "0098ba824b5c16427bd7a1122a5a442a25ec644d");
+
+    CHECK_STR(base64(""), "");                      // RFC 4648 examples
+    CHECK_STR(base64("f"), "Zg==");
+    CHECK_STR(base64("fo"), "Zm8=");
+    CHECK_STR(base64("foo"), "Zm9v");
+    CHECK_STR(base64("foob"), "Zm9vYg==");
+    CHECK_STR(base64("fooba"), "Zm9vYmE=");
+    CHECK_STR(base64("foobar"), "Zm9vYmFy");
+}
+
+void test_dash_handshake(void) {
+    static struct dash d;
+    static char reply[16384];
+    struct dash_client c = { .tx = malloc(DASH_QUEUE_SIZE) };
+    char *page = NULL;
+    ssize_t len, ret;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        CHECK(!"socketpair");
+        return;
+    }
+    c.fd = sv[0];
+    c.rx_len = snprintf(c.rx, sizeof(c.rx), "GET /ws HTTP/1.1\r\nHost: server.example.com\r\nUpgrade: websocket\r\n"
+                        "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                        "Sec-WebSocket-Version: 13\r\n\r\n");
+    CHECK(dash_http(&d, &c));
+    CHECK(c.websocket && c.fresh && c.rx_len == 0);
+    len = recv(sv[1], reply, sizeof(reply) - 1, MSG_DONTWAIT);
+    reply[len > 0 ? len : 0] = '\0';
+    CHECK(strncmp(reply, "HTTP/1.1 101 Switching Protocols\r\n", 34) == 0);
+    CHECK(strstr(reply, "\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != NULL);   // RFC 6455 example
+
+    c.websocket = false;                            // page request gets the page, anything else 404
+    c.rx_len = snprintf(c.rx, sizeof(c.rx), "GET / HTTP/1.1\r\n\r\n");
+    CHECK(!dash_http(&d, &c));
+    c.rx_len = snprintf(c.rx, sizeof(c.rx), "GET /favicon.ico HTTP/1.1\r\n\r\n");
+    CHECK(!dash_http(&d, &c));
+    CHECK(c.tx_len == 0);
+    for (len = 0; (ret = recv(sv[1], reply + len, sizeof(reply) - 1 - len, MSG_DONTWAIT)) > 0; len += ret)
+        ;
+    reply[len] = '\0';
+    CHECK(strncmp(reply, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    CHECK((page = strstr(reply, "\r\n\r\n")) != NULL && strncmp(page + 4, dash_page, strlen(dash_page)) == 0);
+    CHECK(page != NULL && strcmp(page + 4 + strlen(dash_page), "HTTP/1.1 404 Not Found\r\n"
+                                 "Content-Length: 0\r\nConnection: close\r\n\r\n") == 0);
+    close(sv[0]);
+    close(sv[1]);
+    free(c.tx);
+}
+
+// slow browser: unsent frame tails are queued and sent on POLLOUT, only a client too far behind is dropped
+void test_dash_queue(void) {
+    static char msg[30000], got[200000];
+    struct dash_client c = { .tx = malloc(DASH_QUEUE_SIZE) };
+    int sv[2], sndbuf = 4096, sent;
+    size_t got_len = 0;
+
+    for (size_t i = 0; i < sizeof(msg); i++)
+        msg[i] = 'a' + i % 26;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    c.fd = sv[0];
+    CHECK(dash_send_frame(&c, 0x1, msg, sizeof(msg)));
+    CHECK(dash_send_frame(&c, 0x1, msg, 1000));
+    CHECK(c.fd >= 0 && c.tx_len > 0);               // socket took only a part
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    for (int i = 0; i < 10000 && (c.tx_len > 0 || got_len < 4 + sizeof(msg) + 4 + 1000); i++) {
+        ssize_t ret = read(sv[1], got + got_len, sizeof(got) - got_len);
+        if (ret > 0)
+            got_len += ret;
+        CHECK(dash_flush(&c) || c.fd >= 0);
+    }
+    CHECK(c.tx_len == 0 && c.fd >= 0);
+    CHECK(got_len == 4 + sizeof(msg) + 4 + 1000);   // both frames with 126 length headers, in order
+    CHECK((uint8_t)got[0] == 0x81 && (uint8_t)got[1] == 126 && (uint8_t)got[2] == sizeof(msg) >> 8);
+    CHECK(memcmp(got + 4, msg, sizeof(msg)) == 0);
+    CHECK(memcmp(got + 4 + sizeof(msg) + 4, msg, 1000) == 0);
+
+    for (sent = 0; sent < 10 && dash_send_frame(&c, 0x1, msg, sizeof(msg)); sent++)
+        CHECK(c.tx_len <= DASH_QUEUE_SIZE);
+    CHECK(sent >= 2);                               // two whole pushes fit into the queue
+    CHECK(sent < 10 && c.fd < 0 && c.tx_len == 0);  // then the client is dropped
+    close(sv[1]);
+    free(c.tx);
+}
+
+int main(void) {
+    test_streams();
+    test_format();
+    test_expect_automaton();
+    test_expect_batch();
+    test_incident_trigger();
+    test_capture_read();
+    test_capture_follow();
+    test_bridge();
+    test_mqtt_length();
+    test_mqtt_resend();
+    test_dash_encoding();
+    test_dash_handshake();
+    test_dash_queue();
+    return test_report("test_canerrdump");
+}
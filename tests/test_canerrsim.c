@@ -0,0 +1,360 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                //
+//  test_canerrsim.c - unit tests of canerrsim parts which need no CAN interface                  //
+//                                                                                                //
+//  SPDX-License-Identifier: LGPL-2.1-or-later OR BSD-3-Clause                                    //
+//                                                                                                //
+//  canerrsim.c is included with its main renamed, so tests call the same functions the tool      //
+//  runs, with socketpairs standing in for UDP and CAN sockets.                                   //
+//                                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define main canerrsim_main
+#include "../canerrsim.c"
+#undef main
+
+#include <sys/wait.h>
+#include "test.h"
+
+// exit code of fn(arg) run in a child, 0 if fn returns, for options which have to be refused
+int exit_code(void (*fn)(const char *), const char *arg) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(2);
+        fn(arg);
+        exit(EXIT_SUCCESS);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Options and Run=                                                                              //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// apply space separated options like canerrsim command line does
+void run_options(const char *options) {
+    bool arbitration_processed = false, transceiver_processed = false;
+    struct can_frame frame;
+    char text[256], *save;
+
+    canerr_frame_init(&frame);
+    snprintf(text, sizeof(text), "%s", options);
+    for (char *arg = strtok_r(text, " ", &save); arg != NULL; arg = strtok_r(NULL, " ", &save))
+        if (!canerr_apply_option(&frame, arg) &&
+            !apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed))
+            show_invalid_option(arg);
+}
+
+void test_numeric_options(void) {
+    bool arbitration_processed = false, transceiver_processed = false;
+    struct can_frame frame;
+    char arg[16], str[128];
+
+    canerr_frame_init(&frame);
+    snprintf(arg, sizeof(arg), "LostArBit=09");
+    CHECK(apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed));
+    CHECK(frame.can_id & CAN_ERR_LOSTARB && frame.data[0] == 9 && arbitration_processed);
+    snprintf(arg, sizeof(arg), "Data4=AA");
+    CHECK(apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed));
+    CHECK(frame.data[4] == 0xAA);
+    snprintf(arg, sizeof(arg), "TxCount=80");
+    CHECK(apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed));
+    snprintf(arg, sizeof(arg), "RxCount=7F");
+    CHECK(apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed));
+    CHECK(frame.can_id & CAN_ERR_CNT && frame.data[6] == 0x80 && frame.data[7] == 0x7F);
+    snprintf(arg, sizeof(arg), "BusOff");
+    CHECK(!apply_numeric_option(&frame, arg, &arbitration_processed, &transceiver_processed));
+    CHECK(canerr_apply_option(&frame, "TX") && canerr_apply_option(&frame, "BusOff") && canerr_apply_option(&frame, "NoAck"));
+    canerr_decode(&frame, str, sizeof(str));        // example of canerrsim header comment, with counters
+    CHECK_STR(str, "LostArBit09,NoAck,BusOff,Count(TX=128,RX=127),Prot(Type(TX),Loc(Unspec))");
+
+    CHECK(exit_code(run_options, "LostArBit=09 LostArBit=10") == EXIT_FAILURE);   // only one lost bit
+    CHECK(exit_code(run_options, "Data4=AA Data5=BB") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "LostArBit=30") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "Data4=GG") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "Data8=AA") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "TxCount=8") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "Bogus") == EXIT_FAILURE);
+    CHECK(exit_code(run_options, "LostArBit=29 Data7=FF TxCount=FF RxCount=00 BusOff") == 0);
+}
+
+void run_scenario_file(const char *text) {
+    char path[] = "/tmp/canerrsim-test-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0 || write(fd, text, strlen(text)) != (ssize_t)strlen(text))
+        exit(2);
+    close(fd);
+    free(scenarios);
+    scenarios = NULL;
+    scenario_count = 0;
+    load_scenarios(path);
+    unlink(path);
+}
+
+void test_scenarios(void) {
+    run_scenario_file("# regression suite\n"
+                      "arb   LostArBit=09 Data4=AA TX BusOff NoAck\n"
+                      "\n"
+                      "count TxCount=80 RxCount=7F   = Count(TX=128,RX=127)   # driver reports counters\n"
+                      "wrong BusOff = NoAck\r\n");
+    CHECK(scenario_count == 3);
+    CHECK_STR(scenarios[0].name, "arb");
+    CHECK(scenarios[0].frame.data[0] == 9 && scenarios[0].frame.data[4] == 0xAA);
+    CHECK_STR(scenarios[0].expected, "LostArBit09,NoAck,BusOff,Prot(Type(TX),Loc(Unspec))");
+    CHECK_STR(scenarios[1].name, "count");
+    CHECK_STR(scenarios[1].expected, "Count(TX=128,RX=127)");
+    CHECK(scenarios[2].frame.can_id == (CAN_ERR_FLAG | CAN_ERR_BUSOFF));
+    CHECK_STR(scenarios[2].expected, "NoAck");     // expectation is taken as written
+
+    CHECK(exit_code(run_scenario_file, "data Data4=AA\n") == EXIT_FAILURE);   // no error class
+    CHECK(exit_code(run_scenario_file, "bad BusOff Bogus\n") == EXIT_FAILURE);
+    CHECK(exit_code(run_scenario_file, "# only comments\n\n") == EXIT_FAILURE);
+    CHECK(exit_code(run_scenario_file, "ok BusOff\n") == 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Burst=                                                                                        //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// every frame number goes to exactly one sender, with Streams every stream to one sender in order
+void check_partition(long count, long senders, long streams) {
+    static signed char seen[1000];
+    static int owner[1000];
+    static long last[1000];
+    struct burst b = { .count = count, .senders = streams > 0 && streams < senders ? streams : senders, .streams = streams };
+    long total = 0;
+    bool ok = true;
+
+    memset(seen, 0, sizeof(seen));
+    for (long s = 0; s < streams; s++)
+        owner[s] = -1, last[s] = -1;
+    for (int i = 0; i < b.senders; i++) {
+        long share = burst_share(&b, i), prev = -1;
+        total += share;
+        for (long n = 0; n < share; n++) {
+            long k = burst_frame_number(&b, i, n);
+            if (k < 0 || k >= count || seen[k]) {
+                ok = false;
+                continue;
+            }
+            seen[k] = 1;
+            if (streams == 0 && prev >= 0 && k != prev + 1)
+                ok = false;                         // contiguous share
+            if (streams > 0) {
+                if (owner[k % streams] >= 0 && owner[k % streams] != i)
+                    ok = false;
+                if (k <= last[k % streams])
+                    ok = false;                     // order inside stream
+                owner[k % streams] = i;
+                last[k % streams]  = k;
+            }
+            prev = k;
+        }
+    }
+    if (!ok || total != count)
+        fprintf(stderr, "Partition of %ld frames to %ld senders and %ld streams is wrong\n", count, senders, streams);
+    CHECK(ok && total == count);
+}
+
+void test_burst_partition(void) {
+    static const long counts[] = { 1, 2, 7, 64, 100, 999 };
+    static const long streams[] = { 0, 1, 2, 3, 5, 8, 13 };
+    struct can_frame a, b;
+    long bad = 0;
+
+    for (size_t c = 0; c < CANERR_COUNT(counts); c++)
+        for (long senders = 1; senders <= 9; senders++)
+            for (size_t s = 0; s < CANERR_COUNT(streams); s++)
+                check_partition(counts[c], senders, streams[s]);
+
+    // fuzz frames depend on seed and frame number only, not on the sender which sends them
+    burst_fuzz_frame(&a, 1, 12345);
+    burst_fuzz_frame(&b, 1, 12345);
+    CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+    CHECK(a.can_id & CAN_ERR_FLAG && (a.can_id & CAN_ERR_MASK) != 0 && a.can_dlc == CAN_ERR_DLC);
+    burst_fuzz_frame(&b, 1, 12346);
+    CHECK(memcmp(&a, &b, sizeof(a)) != 0);
+    burst_fuzz_frame(&b, 2, 12345);
+    CHECK(memcmp(&a, &b, sizeof(a)) != 0);
+    for (uint64_t k = 0; k < 10000; k++) {          // every frame has some of error class bits 0..9
+        burst_fuzz_frame(&a, 7, k);
+        if ((a.can_id & CAN_ERR_MASK) == 0 || (a.can_id & CAN_ERR_MASK) >= CAN_ERR_CNT << 1)
+            bad++;
+    }
+    CHECK(bad == 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Follow=                                                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int follow_port, follow_sock = -1;
+
+void run_follow(const char *leader) {
+    char text[64];
+
+    snprintf(text, sizeof(text), "%s", leader);
+    run_follower(follow_sock, "vcan0", text);
+}
+
+// fake leader in a child which answers HELLO of one follower with given START line
+pid_t start_leader(int listen_fd, const char *start) {
+    char line[256];
+    pid_t pid;
+    FILE *peer;
+
+    if ((pid = fork()) != 0)
+        return pid;
+    if ((peer = fdopen(accept(listen_fd, NULL, NULL), "r+")) == NULL ||
+        fgets(line, sizeof(line), peer) == NULL || strncmp(line, "HELLO ", 6) != 0)
+        _exit(1);
+    fputs(start, peer);
+    fflush(peer);
+    while (fgets(line, sizeof(line), peer) != NULL)
+        ;
+    _exit(0);
+}
+
+// follower exit code for START line of leader
+int follow_start(int listen_fd, const char *start) {
+    char leader[32];
+    int status, code;
+    pid_t pid = start_leader(listen_fd, start);
+
+    snprintf(leader, sizeof(leader), "127.0.0.1:%d", follow_port);
+    code = exit_code(run_follow, leader);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return code;
+}
+
+void test_follow_start(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0), sv[2];
+
+    CHECK(fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, 1) == 0);
+    CHECK(getsockname(fd, (struct sockaddr *)&addr, &len) == 0);
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);   // stands in for CAN socket
+    follow_port = ntohs(addr.sin_port);
+    follow_sock = sv[0];
+
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 0 7 0\n") == 0);
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0\n") == EXIT_FAILURE);
+    CHECK(follow_start(fd, "START 0 20000040 9 0 0 0 0 0 0 0 0 0 7 0\n") == EXIT_FAILURE);     // Dlc
+    CHECK(follow_start(fd, "START 0 20000040 -1 0 0 0 0 0 0 0 0 0 7 0\n") == EXIT_FAILURE);
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 -5 7 0\n") == EXIT_FAILURE);    // XlLen
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 2049 7 0\n") == EXIT_FAILURE);
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 0 2048 0\n") == EXIT_FAILURE);  // XlPrio
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 0 7 256\n") == EXIT_FAILURE);   // XlSdt
+    CHECK(follow_start(fd, "START 0 20000040 8 0 0 0 0 0 0 0 0 0 -1 0\n") == EXIT_FAILURE);
+    close(sv[0]);
+    close(sv[1]);
+    close(fd);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Bridge=                                                                                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// datagram like canerrdump Bridge= sends, returns its length
+size_t make_datagram(char *dgram, uint64_t seq, const struct canerr_record *recs, int n) {
+    struct canerr_bridge_header *hdr = (struct canerr_bridge_header *)dgram;
+    size_t len = sizeof(*hdr);
+
+    hdr->magic   = CANERR_BRIDGE_MAGIC;
+    hdr->version = CANERR_BRIDGE_VERSION;
+    hdr->count   = n;
+    hdr->seq     = seq;
+    hdr->sent_ns = 0;
+    for (int i = 0; i < n; i++)
+        len += canerr_cap_put(dgram + len, &recs[i]);
+    return len;
+}
+
+void test_bridge(void) {
+    static char dgram[CANERR_BRIDGE_DGRAM_MAX] __attribute__((aligned(8)));
+    static const char text[] = "flexcan can0: bus-off";
+    struct bridge_rx *b = &bridge_rx;
+    struct canerr_record recs[3] = { { .type = CANERR_FRAME_ERROR }, { .type = CANERR_FRAME_FD }, { .type = CANERR_FRAME_KMSG } };
+    struct canfd_frame fd = { .can_id = 0x321, .len = 20 }, got_fd;
+    const struct canerr_cap_record *rec;
+    int net[2], can[2];
+    size_t len, pos = 0;
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, net) < 0 || socketpair(AF_UNIX, SOCK_DGRAM, 0, can) < 0) {
+        CHECK(!"socketpair");
+        return;
+    }
+    canerr_frame_init(&recs[0].frame);
+    canerr_apply_option(&recs[0].frame, "BusOff");
+    recs[0].timestamp.tv_sec = 100;
+    memset(fd.data, 0xA5, fd.len);
+    canerr_record_set(&recs[1], CANERR_FRAME_FD, (const uint8_t *)&fd, sizeof(fd));
+    canerr_record_set(&recs[2], CANERR_FRAME_KMSG, (const uint8_t *)text, strlen(text));
+
+    // sequence gaps are counted as lost, foreign datagrams are skipped, lower sequence restarts schedule
+    b->fd = net[1];
+    len = make_datagram(dgram, 0, recs, 3);
+    CHECK(send(net[0], dgram, len, 0) == (ssize_t)len);
+    len = make_datagram(dgram, 3, recs, 1);
+    CHECK(send(net[0], dgram, len, 0) == (ssize_t)len);
+    CHECK(send(net[0], "not a bridge datagram", 21, 0) == 21);
+    len = make_datagram(dgram, 1, recs, 2);
+    CHECK(send(net[0], dgram, len, 0) == (ssize_t)len);
+    b->anchored = true;
+    bridge_receive(b);
+    CHECK(b->head == 3 && b->datagrams == 3 && b->records == 6);
+    CHECK(b->lost == 2);
+    CHECK(!b->anchored);
+    CHECK(b->lens[2] == len && memcmp(b->dgrams[2], dgram, len) == 0);   // gap of skipped one closed
+
+    // records of first datagram are injected as frames of their type, driver messages are not
+    while ((rec = canerr_bridge_next(b->dgrams[0], b->lens[0], &pos)) != NULL)
+        bridge_inject(b, can[0], rec);
+    CHECK(b->injected == 2 && b->failed == 0);
+    struct can_frame got;
+    CHECK(recv(can[1], &got, sizeof(got), MSG_DONTWAIT) == sizeof(got));
+    CHECK(memcmp(&got, &recs[0].frame, sizeof(got)) == 0);
+    CHECK(recv(can[1], &got_fd, sizeof(got_fd), MSG_DONTWAIT) == CANFD_MTU);   // FD payload filled up again
+    CHECK(got_fd.can_id == 0x321 && got_fd.len == 20 && memcmp(got_fd.data, fd.data, 20) == 0);
+    CHECK(recv(can[1], &got, sizeof(got), MSG_DONTWAIT) < 0);
+
+    // schedule keeps original spacing, starts over when injection is far late
+    b->anchored = false;
+    b->resyncs  = 0;
+    CHECK(bridge_due(b, 5000000000ULL, 1000, 20) == 1000 + 20000000ULL);
+    CHECK(bridge_due(b, 5000000000ULL + 3000000ULL, 2000, 20) == 1000 + 23000000ULL);
+    CHECK(b->resyncs == 0);
+    CHECK(bridge_due(b, 5000000000ULL + 4000000ULL, 5000000000ULL, 20) == 5000000000ULL + 20000000ULL);
+    CHECK(b->resyncs == 1);
+    close(net[0]);
+    close(net[1]);
+    close(can[0]);
+    close(can[1]);
+}
+
+int main(void) {
+    test_numeric_options();
+    test_scenarios();
+    test_burst_partition();
+    test_follow_start();
+    test_bridge();
+    return test_report("test_canerrsim");
+}